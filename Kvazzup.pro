@@ -70,17 +70,27 @@ SOURCES +=\
     src/media/processing/aecinputfilter.cpp \
     src/media/processing/aecprocessor.cpp \
     src/media/processing/audiocapturefilter.cpp \
+    src/media/processing/audiojitterbuffer.cpp \
+    src/media/processing/audiomixer.cpp \
     src/media/processing/audiomixerfilter.cpp \
     src/media/processing/audiooutputdevice.cpp \
+    src/media/processing/bitratecontroller.cpp \
     src/media/processing/camerafilter.cpp \
     src/media/processing/cameraframegrabber.cpp \
+    src/media/processing/decodescheduler.cpp \
     src/media/processing/displayfilter.cpp \
     src/media/processing/filter.cpp \
+    src/media/processing/filterexecutor.cpp \
+    src/media/processing/framepool.cpp \
+    src/media/processing/frametracer.cpp \
     src/media/processing/filtergraph.cpp \
     src/media/processing/kvazaarfilter.cpp \
     src/media/processing/openhevcfilter.cpp \
+    src/media/processing/optimized/cpufeatures.cpp \
     src/media/processing/opusdecoderfilter.cpp \
     src/media/processing/opusencoderfilter.cpp \
+    src/media/processing/resamplefilter.cpp \
+    src/media/processing/resampler.cpp \
     src/media/processing/rgb32toyuv.cpp \
     src/media/processing/scalefilter.cpp \
     src/media/processing/screensharefilter.cpp \
@@ -149,21 +159,36 @@ HEADERS  += \
     src/media/processing/aecinputfilter.h \
     src/media/processing/aecprocessor.h \
     src/media/processing/audiocapturefilter.h \
+    src/media/processing/audiojitterbuffer.h \
+    src/media/processing/audiomixer.h \
     src/media/processing/audiomixerfilter.h \
     src/media/processing/audiooutputdevice.h \
+    src/media/processing/bitratecontroller.h \
     src/media/processing/camerafilter.h \
     src/media/processing/cameraframegrabber.h \
+    src/media/processing/decodescheduler.h \
     src/media/processing/displayfilter.h \
     src/media/processing/filter.h \
+    src/media/processing/filterexecutor.h \
     src/media/processing/filtergraph.h \
+    src/media/processing/framepool.h \
+    src/media/processing/frametracer.h \
     src/media/processing/kvazaarfilter.h \
     src/media/processing/openhevcfilter.h \
+    src/media/processing/optimized/cpufeatures.h \
+    src/media/processing/optimized/mix.h \
+    src/media/processing/optimized/resample.h \
     src/media/processing/optimized/rgb2yuv.h \
+    src/media/processing/optimized/rowbands.h \
+    src/media/processing/optimized/scale.h \
     src/media/processing/optimized/yuv2rgb.h \
     src/media/processing/opusdecoderfilter.h \
     src/media/processing/opusencoderfilter.h \
+    src/media/processing/resamplefilter.h \
+    src/media/processing/resampler.h \
     src/media/processing/rgb32toyuv.h \
     src/media/processing/scalefilter.h \
+    src/media/processing/spscqueue.h \
     src/media/processing/screensharefilter.h \
     src/media/processing/yuvtorgb32.h \
     src/serverstatusview.h \
@@ -213,7 +238,7 @@ QT += network
 QT += svg # for icons
 QT += opengl
 
-win32-g++: QMAKE_CXXFLAGS += -msse4.1 -mavx2 -fopenmp
+win32-g++: QMAKE_CXXFLAGS += -fopenmp
 
 # common includes
 INCLUDEPATH += $$PWD/../include/openhevc_dec
@@ -269,7 +294,7 @@ win32-g++{
 
 unix {
   LIBS += -lkvazaar
-  QMAKE_CXXFLAGS += -msse4.1 -mavx2 -fopenmp
+  QMAKE_CXXFLAGS += -fopenmp
   QMAKE_LFLAGS += -fopenmp
   INCLUDEPATH += /usr/include/opus/
   INCLUDEPATH += /usr/local/include/uvgrtp/
@@ -0,0 +1,103 @@
+#-------------------------------------------------
+#
+# Headless benchmark of the Kvazzup filter graph.
+# Uses the same libraries as Kvazzup.pro.
+#
+#-------------------------------------------------
+
+QT       += core multimedia concurrent
+QT       -= gui
+
+message("Parsing benchmark project file.")
+
+TARGET = KvazzupBenchmark
+
+TEMPLATE = app
+
+CONFIG += console
+CONFIG -= app_bundle
+
+INCLUDEPATH += src
+
+SOURCES +=\
+    src/benchmark/benchmarkstatistics.cpp \
+    src/benchmark/main.cpp \
+    src/benchmark/nullsink.cpp \
+    src/benchmark/stageprobe.cpp \
+    src/benchmark/syntheticsource.cpp \
+    src/common.cpp \
+    src/media/processing/decodescheduler.cpp \
+    src/media/processing/filter.cpp \
+    src/media/processing/filterexecutor.cpp \
+    src/media/processing/framepool.cpp \
+    src/media/processing/frametracer.cpp \
+    src/media/processing/kvazaarfilter.cpp \
+    src/media/processing/openhevcfilter.cpp \
+    src/media/processing/optimized/cpufeatures.cpp \
+    src/media/processing/opusdecoderfilter.cpp \
+    src/media/processing/opusencoderfilter.cpp \
+    src/media/processing/rgb32toyuv.cpp \
+    src/media/processing/yuvtorgb32.cpp
+
+HEADERS  += \
+    src/benchmark/benchmarkstatistics.h \
+    src/benchmark/nullsink.h \
+    src/benchmark/stageprobe.h \
+    src/benchmark/syntheticsource.h \
+    src/common.h \
+    src/global.h \
+    src/media/processing/decodescheduler.h \
+    src/media/processing/filter.h \
+    src/media/processing/filterexecutor.h \
+    src/media/processing/framepool.h \
+    src/media/processing/frametracer.h \
+    src/media/processing/kvazaarfilter.h \
+    src/media/processing/openhevcfilter.h \
+    src/media/processing/optimized/cpufeatures.h \
+    src/media/processing/optimized/rgb2yuv.h \
+    src/media/processing/optimized/rowbands.h \
+    src/media/processing/optimized/yuv2rgb.h \
+    src/media/processing/opusdecoderfilter.h \
+    src/media/processing/opusencoderfilter.h \
+    src/media/processing/rgb32toyuv.h \
+    src/media/processing/spscqueue.h \
+    src/media/processing/yuvtorgb32.h \
+    src/statisticsinterface.h
+
+win32-g++: QMAKE_CXXFLAGS += -fopenmp
+
+# common includes
+INCLUDEPATH += $$PWD/../include/openhevc_dec
+INCLUDEPATH += $$PWD/../include/
+
+LIBS += -lopus
+LIBS += -lLibOpenHevcWrapper
+
+win32{
+  INCLUDEPATH += $$PWD/../include/opus
+}
+
+win32-msvc{
+  DEFINES += PIC
+  LIBS += -lkvazaar_lib
+  LIBS += -L$$PWD/../msvc_libs
+  LIBS += -ladvapi32
+  LIBS += -lkernel32
+}
+
+win32-g++{
+  LIBS += -lkvazaar
+  LIBS += -fopenmp
+  LIBS += -L$$PWD/../libs
+  LIBS += -lssp
+}
+
+unix {
+  LIBS += -lkvazaar
+  QMAKE_CXXFLAGS += -fopenmp
+  QMAKE_LFLAGS += -fopenmp
+  INCLUDEPATH += /usr/include/opus/
+}
+
+INCLUDEPATH += $$PWD/../
+DEPENDPATH += $$PWD/../
@@ -0,0 +1,132 @@
+#include "benchmarkstatistics.h"
+
+
+BenchmarkStatistics::BenchmarkStatistics():
+  mutex_(),
+  filters_(),
+  nextID_(1),
+  encodedBytes_(),
+  kernels_()
+{}
+
+
+void BenchmarkStatistics::addEncodedPacket(QString type, uint32_t size)
+{
+  mutex_.lock();
+  encodedBytes_[type] += size;
+  mutex_.unlock();
+}
+
+
+uint32_t BenchmarkStatistics::addFilter(QString type, QString identifier, uint64_t TID)
+{
+  Q_UNUSED(identifier);
+  Q_UNUSED(TID);
+
+  mutex_.lock();
+  uint32_t id = nextID_++;
+  filters_[id] = {type, 0, 0};
+  mutex_.unlock();
+  return id;
+}
+
+
+void BenchmarkStatistics::updateBufferStatus(uint32_t id, uint16_t buffersize,
+                                             uint16_t maxBufferSize)
+{
+  Q_UNUSED(maxBufferSize);
+
+  mutex_.lock();
+  if (filters_.find(id) != filters_.end() && filters_[id].maxBuffer < buffersize)
+  {
+    filters_[id].maxBuffer = buffersize;
+  }
+  mutex_.unlock();
+}
+
+
+void BenchmarkStatistics::packetDropped(uint32_t id)
+{
+  mutex_.lock();
+  if (filters_.find(id) != filters_.end())
+  {
+    ++filters_[id].dropped;
+  }
+  mutex_.unlock();
+}
+
+
+void BenchmarkStatistics::kernelInfo(QString kernel, QString implementation)
+{
+  mutex_.lock();
+  kernels_[kernel] = implementation;
+  mutex_.unlock();
+}
+
+
+void BenchmarkStatistics::reset()
+{
+  mutex_.lock();
+  for (auto& filter : filters_)
+  {
+    filter.second.dropped = 0;
+    filter.second.maxBuffer = 0;
+  }
+  encodedBytes_.clear();
+  mutex_.unlock();
+}
+
+
+uint32_t BenchmarkStatistics::dropped(QString filter) const
+{
+  uint32_t dropped = 0;
+  mutex_.lock();
+  for (auto& stats : filters_)
+  {
+    if (stats.second.name == filter)
+    {
+      dropped += stats.second.dropped;
+    }
+  }
+  mutex_.unlock();
+  return dropped;
+}
+
+
+uint16_t BenchmarkStatistics::maxBuffer(QString filter) const
+{
+  uint16_t maxBuffer = 0;
+  mutex_.lock();
+  for (auto& stats : filters_)
+  {
+    if (stats.second.name == filter && stats.second.maxBuffer > maxBuffer)
+    {
+      maxBuffer = stats.second.maxBuffer;
+    }
+  }
+  mutex_.unlock();
+  return maxBuffer;
+}
+
+
+uint64_t BenchmarkStatistics::encodedBytes(QString type) const
+{
+  uint64_t bytes = 0;
+  mutex_.lock();
+  auto it = encodedBytes_.find(type);
+  if (it != encodedBytes_.end())
+  {
+    bytes = it->second;
+  }
+  mutex_.unlock();
+  return bytes;
+}
+
+
+std::map<QString, QString> BenchmarkStatistics::kernels() const
+{
+  mutex_.lock();
+  std::map<QString, QString> kernels = kernels_;
+  mutex_.unlock();
+  return kernels;
+}
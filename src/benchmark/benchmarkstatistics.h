@@ -0,0 +1,83 @@
+#pragma once
+
+#include "statisticsinterface.h"
+
+#include <QMutex>
+#include <QStringList>
+
+#include <map>
+
+// Collects the statistics the filters report during benchmark. Only the
+// filter related statistics are kept, everything else is ignored.
+
+class BenchmarkStatistics : public StatisticsInterface
+{
+public:
+  BenchmarkStatistics();
+
+  virtual void addSession(uint32_t sessionID) {}
+  virtual void removeSession(uint32_t sessionID) {}
+
+  virtual void videoInfo(double framerate, QSize resolution) {}
+  virtual void audioInfo(uint32_t sampleRate, uint16_t channelCount) {}
+
+  virtual void incomingMedia(uint32_t sessionID, QString name, QStringList& ipList,
+                             QStringList& audioPorts, QStringList& videoPorts) {}
+  virtual void outgoingMedia(uint32_t sessionID, QString name, QStringList& ipList,
+                             QStringList& audioPorts, QStringList& videoPorts) {}
+
+  virtual void sendDelay(QString type, uint32_t delay) {}
+  virtual void receiveDelay(uint32_t sessionID, QString type, int32_t delay) {}
+  virtual void presentPackage(uint32_t sessionID, QString type) {}
+  virtual void jitterBuffer(uint32_t sessionID, QString type, uint32_t targetDelay,
+                            uint32_t lateFrames) {}
+
+  virtual void addEncodedPacket(QString type, uint32_t size);
+
+  virtual void addSendPacket(uint16_t size) {}
+  virtual void addReceivePacket(uint32_t sessionID, QString type, uint16_t size) {}
+
+  virtual uint32_t addFilter(QString type, QString identifier, uint64_t TID);
+  virtual void removeFilter(uint32_t id) {}
+
+  virtual void updateBufferStatus(uint32_t id, uint16_t buffersize,
+                                  uint16_t maxBufferSize);
+
+  virtual void packetDropped(uint32_t id);
+
+  virtual void kernelInfo(QString kernel, QString implementation);
+
+  virtual void addSentSIPMessage(QString type, QString message, QString address) {}
+  virtual void addReceivedSIPMessage(QString type, QString message, QString address) {}
+
+  // forget everything measured so far, but keep the filters
+  void reset();
+
+  // dropped inputs and the largest buffer seen of filter with this name
+  uint32_t dropped(QString filter) const;
+  uint16_t maxBuffer(QString filter) const;
+
+  uint64_t encodedBytes(QString type) const;
+
+  // chosen implementation of each kernel
+  std::map<QString, QString> kernels() const;
+
+private:
+
+  struct FilterStats
+  {
+    QString name;
+    uint32_t dropped;
+    uint16_t maxBuffer;
+  };
+
+  mutable QMutex mutex_;
+
+  // key is filter ID, 0 is reserved for unknown filters
+  std::map<uint32_t, FilterStats> filters_;
+  uint32_t nextID_;
+
+  std::map<QString, uint64_t> encodedBytes_;
+
+  std::map<QString, QString> kernels_;
+};
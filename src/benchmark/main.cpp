@@ -0,0 +1,426 @@
+#include "benchmarkstatistics.h"
+#include "nullsink.h"
+#include "stageprobe.h"
+#include "syntheticsource.h"
+
+#include "media/processing/filterexecutor.h"
+#include "media/processing/framepool.h"
+#include "media/processing/frametracer.h"
+#include "media/processing/kvazaarfilter.h"
+#include "media/processing/openhevcfilter.h"
+#include "media/processing/opusdecoderfilter.h"
+#include "media/processing/opusencoderfilter.h"
+#include "media/processing/rgb32toyuv.h"
+#include "media/processing/yuvtorgb32.h"
+
+#include "common.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QSettings>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QThread>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Headless benchmark of the filter graph. Builds chains like the ones in
+// FilterGraph from a synthetic source through the real conversion, encoder
+// and decoder filters to a null sink and reports the throughput and latency
+// of each stage as well as the number of allocations during measurement.
+
+
+// Every heap allocation of the process is counted, not just the frame buffers.
+std::atomic<uint64_t> heapAllocations(0);
+
+void* operator new(std::size_t size)
+{
+  ++heapAllocations;
+  void* pointer = malloc(size == 0 ? 1 : size);
+  if (pointer == nullptr)
+  {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+void* operator new[](std::size_t size)
+{
+  return operator new(size);
+}
+
+void operator delete(void* pointer) noexcept
+{
+  free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+  free(pointer);
+}
+
+
+const QStringList CHAINS = {"conversion", "video", "camera", "audio"};
+
+struct BenchmarkOptions
+{
+  QSize resolution;
+  uint16_t framerate;
+  int warmup; // seconds
+  int duration; // seconds
+  bool paced;
+  bool pool;
+};
+
+struct Stage
+{
+  std::shared_ptr<Filter> filter;
+  std::unique_ptr<StageProbe> probe;
+};
+
+
+void writeSettings(const BenchmarkOptions& options)
+{
+  QSettings settings("kvazzup.ini", QSettings::IniFormat);
+
+  settings.setValue("video/Preset",            "ultrafast");
+  settings.setValue("video/ResolutionWidth",   options.resolution.width());
+  settings.setValue("video/ResolutionHeight",  options.resolution.height());
+  settings.setValue("video/Framerate",         options.framerate);
+  settings.setValue("video/kvzThreads",        "auto");
+  settings.setValue("video/OWF",               0);
+  settings.setValue("video/WPP",               1);
+  settings.setValue("video/Slices",            0);
+  settings.setValue("video/QP",                32);
+  settings.setValue("video/Intra",             64);
+  settings.setValue("video/VPS",               1);
+  settings.setValue("video/bitrate",           0);
+  settings.setValue("video/scalingList",       0);
+  settings.setValue("video/lossless",          0);
+  settings.setValue("video/mvConstraint",      "none");
+  settings.setValue("video/qpInCU",            0);
+  settings.setValue("video/vaq",               0);
+  settings.setValue("video/OPENHEVC_threads",  QThread::idealThreadCount());
+  settings.setValue("video/rgbThreads",        0);
+  settings.setValue("video/yuvThreads",        0);
+
+  settings.setValue("audio/bitrate",           24000);
+  settings.setValue("audio/complexity",        10);
+  settings.setValue("audio/signalType",        "voice");
+  settings.setValue("audio/frameDuration",     20);
+}
+
+
+bool addStage(std::vector<Stage>& chain, std::shared_ptr<Filter> filter,
+              const BenchmarkOptions& options)
+{
+  if (!filter->init())
+  {
+    printDebug(DEBUG_ERROR, "Benchmark", "Failed to initialize filter", {"Filter"}, {filter->getName()});
+    return false;
+  }
+
+  if (!chain.empty())
+  {
+    chain.back().filter->addOutConnection(filter);
+
+    // the source produces frames on a thread of its own
+    if (options.pool)
+    {
+      filter->setExecutor(&FilterExecutor::instance());
+    }
+  }
+
+  Stage stage = {filter, nullptr};
+  if (filter->outputType() != NONE)
+  {
+    stage.probe = std::unique_ptr<StageProbe>(new StageProbe(filter->getName()));
+    filter->addDataOutCallback(stage.probe.get(), &StageProbe::output);
+  }
+
+  chain.push_back(std::move(stage));
+  return true;
+}
+
+
+bool buildChain(QString name, std::vector<Stage>& chain,
+                StatisticsInterface* stats, const BenchmarkOptions& options)
+{
+  QAudioFormat format;
+  format.setSampleRate(48000);
+  format.setChannelCount(1);
+  format.setSampleSize(16);
+  format.setSampleType(QAudioFormat::SignedInt);
+  format.setByteOrder(QAudioFormat::LittleEndian);
+  format.setCodec("audio/pcm");
+
+  bool ok = true;
+
+  if (name == "conversion")
+  {
+    ok = addStage(chain, std::make_shared<SyntheticSource>("", stats, RGB32VIDEO,
+                                                           options.resolution,
+                                                           options.framerate,
+                                                           options.paced), options)
+        && addStage(chain, std::make_shared<RGB32toYUV>("", stats), options)
+        && addStage(chain, std::make_shared<YUVtoRGB32>("", stats), options)
+        && addStage(chain, std::make_shared<NullSink>("", stats, RGB32VIDEO), options);
+  }
+  else if (name == "video")
+  {
+    ok = addStage(chain, std::make_shared<SyntheticSource>("", stats, YUV420VIDEO,
+                                                           options.resolution,
+                                                           options.framerate,
+                                                           options.paced), options)
+        && addStage(chain, std::make_shared<KvazaarFilter>("", stats), options)
+        && addStage(chain, std::make_shared<OpenHEVCFilter>(1, stats), options)
+        && addStage(chain, std::make_shared<NullSink>("", stats, YUV420VIDEO), options);
+  }
+  else if (name == "camera")
+  {
+    // same as camera to remote view, but without network
+    ok = addStage(chain, std::make_shared<SyntheticSource>("", stats, RGB32VIDEO,
+                                                           options.resolution,
+                                                           options.framerate,
+                                                           options.paced), options)
+        && addStage(chain, std::make_shared<RGB32toYUV>("", stats), options)
+        && addStage(chain, std::make_shared<KvazaarFilter>("", stats), options)
+        && addStage(chain, std::make_shared<OpenHEVCFilter>(1, stats), options)
+        && addStage(chain, std::make_shared<YUVtoRGB32>("", stats), options)
+        && addStage(chain, std::make_shared<NullSink>("", stats, RGB32VIDEO), options);
+  }
+  else if (name == "audio")
+  {
+    ok = addStage(chain, std::make_shared<SyntheticSource>("", stats, format, audioFrameDuration(),
+                                                           options.paced), options)
+        && addStage(chain, std::make_shared<OpusEncoderFilter>("", format, audioFrameDuration(),
+                                                               stats), options)
+        && addStage(chain, std::make_shared<OpusDecoderFilter>(1, format, stats), options)
+        && addStage(chain, std::make_shared<NullSink>("", stats, RAWAUDIO), options);
+  }
+  else
+  {
+    printDebug(DEBUG_ERROR, "Benchmark", "Unknown chain", {"Chain"}, {name});
+    return false;
+  }
+
+  return ok;
+}
+
+
+void stopChain(std::vector<Stage>& chain)
+{
+  // from source to sink so nothing new arrives to a stopped filter
+  for (auto& stage : chain)
+  {
+    stage.filter->stop();
+    stage.filter->emptyBuffer();
+    while (stage.filter->isRunning())
+    {
+      qSleep(1);
+    }
+  }
+}
+
+
+void printReport(QString name, std::vector<Stage>& chain, BenchmarkStatistics& stats,
+                 const BenchmarkOptions& options, uint64_t allocations,
+                 uint64_t poolAllocations, uint64_t poolReuses)
+{
+  QTextStream out(stdout);
+
+  out << endl << "Chain " << name << ": "
+      << options.resolution.width() << "x" << options.resolution.height()
+      << ", " << (options.paced ? QString::number(options.framerate) + " fps source" : "unpaced source")
+      << ", " << (options.pool ? "filter pool" : "thread per filter")
+      << ", " << options.duration << " s" << endl;
+
+  out << qSetFieldWidth(20) << left << "Stage" << qSetFieldWidth(10) << right
+      << "Frames" << "fps" << "p50 ms" << "p99 ms" << "Dropped" << "Buffer"
+      << qSetFieldWidth(0) << endl;
+
+  for (auto& stage : chain)
+  {
+    QString filter = stage.filter->getName();
+    out << qSetFieldWidth(20) << left << filter << qSetFieldWidth(10) << right;
+
+    if (stage.probe)
+    {
+      out << stage.probe->frames()
+          << QString::number(stage.probe->framerate(), 'f', 1)
+          << stage.probe->latency(50)
+          << stage.probe->latency(99);
+    }
+    else
+    {
+      out << "-" << "-" << "-" << "-";
+    }
+
+    out << stats.dropped(filter) << stats.maxBuffer(filter)
+        << qSetFieldWidth(0) << endl;
+  }
+
+  double seconds = options.duration;
+  if (stats.encodedBytes("video") != 0)
+  {
+    out << "Encoded video: " << stats.encodedBytes("video")*8/seconds/1000 << " kbit/s" << endl;
+  }
+  if (stats.encodedBytes("audio") != 0)
+  {
+    out << "Encoded audio: " << stats.encodedBytes("audio")*8/seconds/1000 << " kbit/s" << endl;
+  }
+
+  for (auto& kernel : stats.kernels())
+  {
+    out << "Kernel " << kernel.first << ": " << kernel.second << endl;
+  }
+
+  out << "Heap allocations: " << allocations << " ("
+      << QString::number(allocations/seconds, 'f', 0) << "/s)" << endl;
+  out << "Frame pool allocations: " << poolAllocations
+      << ", reuses: " << poolReuses << endl;
+}
+
+
+bool runChain(QString name, const BenchmarkOptions& options)
+{
+  BenchmarkStatistics stats;
+  std::vector<Stage> chain;
+
+  if (!buildChain(name, chain, &stats, options))
+  {
+    stopChain(chain);
+    return false;
+  }
+
+  // start from the sink so the filters are ready when the frames arrive
+  for (auto stage = chain.rbegin(); stage != chain.rend(); ++stage)
+  {
+    stage->filter->start();
+  }
+
+  QThread::sleep(options.warmup);
+
+  stats.reset();
+  for (auto& stage : chain)
+  {
+    if (stage.probe)
+    {
+      stage.probe->begin();
+    }
+  }
+
+  uint64_t allocations = heapAllocations;
+  uint64_t poolAllocations = FramePool::instance().allocations();
+  uint64_t poolReuses = FramePool::instance().reuses();
+
+  QThread::sleep(options.duration);
+
+  allocations = heapAllocations - allocations;
+  poolAllocations = FramePool::instance().allocations() - poolAllocations;
+  poolReuses = FramePool::instance().reuses() - poolReuses;
+
+  for (auto& stage : chain)
+  {
+    if (stage.probe)
+    {
+      stage.probe->end();
+    }
+  }
+
+  stopChain(chain);
+
+  printReport(name, chain, stats, options, allocations, poolAllocations, poolReuses);
+
+  // the filters use stats until they are destroyed
+  chain.clear();
+  return true;
+}
+
+
+int main(int argc, char *argv[])
+{
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName("KvazzupBenchmark");
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Measures the throughput of Kvazzup filter graph.");
+  parser.addHelpOption();
+  parser.addOptions({
+    {"chain",    "Chain to run: " + CHAINS.join(", ") + " or all.", "chain", "all"},
+    {"width",    "Video width.", "pixels", "640"},
+    {"height",   "Video height.", "pixels", "480"},
+    {"fps",      "Source framerate.", "fps", "30"},
+    {"warmup",   "Seconds to run before measuring.", "seconds", "2"},
+    {"duration", "Seconds to measure.", "seconds", "10"},
+    {"unpaced",  "Produce frames as fast as the graph takes them."},
+    {"pool",     "Run the filters on the shared filter executor."},
+    {"trace",    "Write per frame traces as Chrome trace-event JSON to file.", "file"}
+  });
+  parser.process(app);
+
+  BenchmarkOptions options;
+  options.resolution = QSize(parser.value("width").toInt(), parser.value("height").toInt());
+  options.framerate = parser.value("fps").toUShort();
+  options.warmup = parser.value("warmup").toInt();
+  options.duration = parser.value("duration").toInt();
+  options.paced = !parser.isSet("unpaced");
+  options.pool = parser.isSet("pool");
+
+#ifdef __linux__
+  // KvazaarFilter uses fixed resolution on Linux
+  if (options.resolution != QSize(640, 480))
+  {
+    printDebug(DEBUG_WARNING, "Benchmark", "Kvazaar only supports 640x480 on Linux, using it.");
+    options.resolution = QSize(640, 480);
+  }
+#endif
+
+  if (options.resolution.width() % 8 != 0 || options.resolution.height() % 8 != 0 ||
+      options.framerate == 0 || options.duration <= 0)
+  {
+    printDebug(DEBUG_ERROR, "Benchmark", "Invalid options. Resolution must be divisible by 8.");
+    return 1;
+  }
+
+  // relative to where the benchmark was started
+  QString traceFile = "";
+  if (parser.isSet("trace"))
+  {
+    traceFile = QDir::current().absoluteFilePath(parser.value("trace"));
+    FrameTracer::instance().setEnabled(true);
+  }
+
+  // Use settings of our own so the settings of Kvazzup are not modified.
+  QTemporaryDir settingsDir;
+  if (!settingsDir.isValid() || !QDir::setCurrent(settingsDir.path()))
+  {
+    printDebug(DEBUG_ERROR, "Benchmark", "Could not create directory for settings.");
+    return 1;
+  }
+  writeSettings(options);
+
+  QStringList chains = CHAINS;
+  if (parser.value("chain") != "all")
+  {
+    chains = QStringList{parser.value("chain")};
+  }
+
+  for (QString& chain : chains)
+  {
+    if (!runChain(chain, options))
+    {
+      return 1;
+    }
+  }
+
+  if (traceFile != "" && !FrameTracer::instance().exportChromeTrace(traceFile))
+  {
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,18 @@
+#include "nullsink.h"
+
+
+NullSink::NullSink(QString id, StatisticsInterface* stats, DataType input):
+  Filter(id, "Null Sink", stats, input, NONE),
+  received_(0)
+{}
+
+
+void NullSink::process()
+{
+  std::unique_ptr<Data> input = getInput();
+  while (input)
+  {
+    ++received_;
+    input = getInput();
+  }
+}
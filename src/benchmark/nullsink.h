@@ -0,0 +1,31 @@
+#pragma once
+#include "media/processing/filter.h"
+
+#include <atomic>
+
+// The last filter of a benchmark graph. Throws away everything it receives.
+
+class NullSink : public Filter
+{
+public:
+  NullSink(QString id, StatisticsInterface* stats, DataType input);
+
+  // the data is never read
+  virtual bool stridedInput() const
+  {
+    return true;
+  }
+
+  uint64_t receivedFrames() const
+  {
+    return received_;
+  }
+
+protected:
+
+  void process();
+
+private:
+
+  std::atomic<uint64_t> received_;
+};
@@ -0,0 +1,87 @@
+#include "stageprobe.h"
+
+#include "media/processing/filter.h"
+
+#include <QDateTime>
+
+#include <algorithm>
+
+
+StageProbe::StageProbe(QString name):
+  name_(name),
+  mutex_(),
+  recording_(false),
+  timer_(),
+  duration_(0),
+  latencies_()
+{}
+
+
+void StageProbe::output(std::unique_ptr<Data> data)
+{
+  int64_t latency = QDateTime::currentMSecsSinceEpoch() - data->presentationTime;
+
+  mutex_.lock();
+  if (recording_)
+  {
+    latencies_.push_back(latency);
+  }
+  mutex_.unlock();
+}
+
+
+void StageProbe::begin()
+{
+  mutex_.lock();
+  latencies_.clear();
+  // enough for a few minutes of video without reallocating during measurement
+  latencies_.reserve(8192);
+  recording_ = true;
+  duration_ = 0;
+  timer_.start();
+  mutex_.unlock();
+}
+
+
+void StageProbe::end()
+{
+  mutex_.lock();
+  recording_ = false;
+  duration_ = timer_.elapsed();
+  mutex_.unlock();
+}
+
+
+uint64_t StageProbe::frames() const
+{
+  mutex_.lock();
+  uint64_t frames = latencies_.size();
+  mutex_.unlock();
+  return frames;
+}
+
+
+double StageProbe::framerate() const
+{
+  mutex_.lock();
+  double framerate = duration_ > 0 ? latencies_.size()*1000.0/duration_ : 0;
+  mutex_.unlock();
+  return framerate;
+}
+
+
+int64_t StageProbe::latency(double percentile) const
+{
+  mutex_.lock();
+  std::vector<int64_t> sorted = latencies_;
+  mutex_.unlock();
+
+  if (sorted.empty())
+  {
+    return -1;
+  }
+
+  size_t index = std::min(sorted.size() - 1, (size_t)(percentile/100*sorted.size()));
+  std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+  return sorted[index];
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QString>
+
+#include <memory>
+#include <vector>
+
+struct Data;
+
+// Records the output of one filter in benchmark graph. Latency is measured
+// from the creation of the frame in source to the output of this filter using
+// the presentation time of the frame, same as the delays in statistics.
+
+class StageProbe
+{
+public:
+  StageProbe(QString name);
+
+  // data out callback of the measured filter
+  void output(std::unique_ptr<Data> data);
+
+  // starts a new measurement and forgets everything recorded so far
+  void begin();
+
+  // stops recording
+  void end();
+
+  QString name() const
+  {
+    return name_;
+  }
+
+  uint64_t frames() const;
+  double framerate() const;
+
+  // percentile between 0 and 100 of latency in milliseconds
+  int64_t latency(double percentile) const;
+
+private:
+
+  QString name_;
+
+  mutable QMutex mutex_;
+
+  bool recording_;
+  QElapsedTimer timer_;
+  qint64 duration_;
+
+  std::vector<int64_t> latencies_;
+};
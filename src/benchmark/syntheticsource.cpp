@@ -0,0 +1,204 @@
+#include "syntheticsource.h"
+
+#include "common.h"
+
+#include <QDateTime>
+#include <QElapsedTimer>
+
+#include <cmath>
+
+// the tone generated by the audio source
+const double TONE_FREQUENCY = 440.0;
+const int16_t TONE_AMPLITUDE = 8000;
+const double TWO_PI = 6.283185307179586;
+
+// size of the box moving over the test image
+const int BOX_SIZE = 64;
+
+
+SyntheticSource::SyntheticSource(QString id, StatisticsInterface *stats,
+                                 DataType output, QSize resolution,
+                                 uint16_t framerate, bool paced):
+  Filter(id, "Synthetic Video", stats, NONE, output),
+  resolution_(resolution),
+  framerate_(framerate),
+  format_(),
+  frameSize_(0),
+  paced_(paced),
+  producing_(false),
+  generated_(0),
+  phase_(0)
+{
+  Q_ASSERT(output == YUV420VIDEO || output == RGB32VIDEO);
+
+  if (output == YUV420VIDEO)
+  {
+    frameSize_ = resolution_.width()*resolution_.height()*3/2;
+  }
+  else
+  {
+    frameSize_ = resolution_.width()*resolution_.height()*4;
+  }
+}
+
+
+SyntheticSource::SyntheticSource(QString id, StatisticsInterface* stats,
+                                 QAudioFormat format, uint16_t frameDuration, bool paced):
+  Filter(id, "Synthetic Audio", stats, NONE, RAWAUDIO),
+  resolution_(),
+  framerate_(1000/frameDuration),
+  format_(format),
+  frameSize_(format.sampleRate()*format.bytesPerFrame()*frameDuration/1000),
+  paced_(paced),
+  producing_(false),
+  generated_(0),
+  phase_(0)
+{
+  Q_ASSERT(format.sampleSize() == 16);
+}
+
+
+void SyntheticSource::start()
+{
+  producing_ = true;
+  Filter::start();
+}
+
+
+void SyntheticSource::stop()
+{
+  producing_ = false;
+  Filter::stop();
+}
+
+
+void SyntheticSource::run()
+{
+  QElapsedTimer timer;
+  timer.start();
+
+  uint64_t frames = 0;
+
+  while (producing_)
+  {
+    sendOutput(generateFrame());
+    ++frames;
+    ++generated_;
+
+    if (paced_)
+    {
+      qint64 wait = (qint64)(frames*1000/framerate_) - timer.elapsed();
+      if (wait > 0)
+      {
+        msleep(wait);
+      }
+    }
+  }
+}
+
+
+std::unique_ptr<Data> SyntheticSource::generateFrame()
+{
+  std::unique_ptr<Data> frame(new Data);
+
+  frame->type = output_;
+  frame->data = FrameBuffer(frameSize_);
+  frame->data_size = frameSize_;
+  frame->width = resolution_.width();
+  frame->height = resolution_.height();
+  frame->presentationTime = QDateTime::currentMSecsSinceEpoch();
+  frame->framerate = framerate_;
+  frame->source = LOCAL;
+
+  if (output_ == YUV420VIDEO)
+  {
+    fillYUV(frame->data.get());
+  }
+  else if (output_ == RGB32VIDEO)
+  {
+    fillRGB32(frame->data.get());
+  }
+  else
+  {
+    fillAudio(frame->data.get());
+  }
+
+  return frame;
+}
+
+
+void SyntheticSource::fillYUV(uchar* data)
+{
+  const int width = resolution_.width();
+  const int height = resolution_.height();
+  const int boxX = (generated_*4) % (width - BOX_SIZE);
+  const int boxY = (generated_*2) % (height - BOX_SIZE);
+
+  // luma is a diagonal gradient with a white box moving over it
+  for (int y = 0; y < height; ++y)
+  {
+    for (int x = 0; x < width; ++x)
+    {
+      bool box = x >= boxX && x < boxX + BOX_SIZE && y >= boxY && y < boxY + BOX_SIZE;
+      data[y*width + x] = box ? 235 : (uchar)((x + y + generated_) & 0xff);
+    }
+  }
+
+  uchar* u = data + width*height;
+  uchar* v = u + width*height/4;
+  for (int y = 0; y < height/2; ++y)
+  {
+    for (int x = 0; x < width/2; ++x)
+    {
+      u[y*width/2 + x] = (uchar)(64 + x*128/(width/2));
+      v[y*width/2 + x] = (uchar)(64 + y*128/(height/2));
+    }
+  }
+}
+
+
+void SyntheticSource::fillRGB32(uchar* data)
+{
+  const int width = resolution_.width();
+  const int height = resolution_.height();
+  const int boxX = (generated_*4) % (width - BOX_SIZE);
+  const int boxY = (generated_*2) % (height - BOX_SIZE);
+
+  for (int y = 0; y < height; ++y)
+  {
+    for (int x = 0; x < width; ++x)
+    {
+      uchar* pixel = data + (y*width + x)*4;
+      bool box = x >= boxX && x < boxX + BOX_SIZE && y >= boxY && y < boxY + BOX_SIZE;
+
+      // BGRA byte order like QImage::Format_RGB32 on little endian
+      pixel[0] = box ? 255 : (uchar)(x*255/width);
+      pixel[1] = box ? 255 : (uchar)((x + y + generated_) & 0xff);
+      pixel[2] = box ? 255 : (uchar)(y*255/height);
+      pixel[3] = 255;
+    }
+  }
+}
+
+
+void SyntheticSource::fillAudio(uchar* data)
+{
+  int16_t* samples = (int16_t*)data;
+  const int frames = frameSize_/format_.bytesPerFrame();
+  const double step = TWO_PI*TONE_FREQUENCY/format_.sampleRate();
+
+  for (int i = 0; i < frames; ++i)
+  {
+    int16_t sample = (int16_t)(TONE_AMPLITUDE*sin(phase_));
+    for (int channel = 0; channel < format_.channelCount(); ++channel)
+    {
+      samples[i*format_.channelCount() + channel] = sample;
+    }
+
+    phase_ += step;
+    if (phase_ > TWO_PI)
+    {
+      phase_ -= TWO_PI;
+    }
+  }
+}
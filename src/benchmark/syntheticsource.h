@@ -0,0 +1,63 @@
+#pragma once
+#include "media/processing/filter.h"
+
+#include <QAudioFormat>
+#include <QSize>
+
+#include <atomic>
+
+// Generates moving test video (RGB32 or YUV420) or a sine tone (raw audio) so
+// the filter graph can be benchmarked without a camera or a microphone.
+// The frames are produced on the filter thread either at the given framerate
+// or as fast as the following filters take them.
+
+class SyntheticSource : public Filter
+{
+public:
+  // video source
+  SyntheticSource(QString id, StatisticsInterface* stats, DataType output,
+                  QSize resolution, uint16_t framerate, bool paced);
+
+  // audio source, produces frames of frameDuration ms
+  SyntheticSource(QString id, StatisticsInterface* stats, QAudioFormat format,
+                  uint16_t frameDuration, bool paced);
+
+  virtual void start();
+  virtual void stop();
+
+  uint64_t generatedFrames() const
+  {
+    return generated_;
+  }
+
+protected:
+
+  // the source does not take input
+  void process() {}
+
+  // produces frames until stopped
+  void run();
+
+private:
+
+  std::unique_ptr<Data> generateFrame();
+
+  void fillYUV(uchar* data);
+  void fillRGB32(uchar* data);
+  void fillAudio(uchar* data);
+
+  QSize resolution_;
+  uint16_t framerate_;
+  QAudioFormat format_;
+
+  uint32_t frameSize_;
+
+  // sleep between frames to keep the framerate
+  bool paced_;
+
+  std::atomic<bool> producing_;
+  std::atomic<uint64_t> generated_;
+
+  // position of the sine wave
+  double phase_;
+};
@@ -1,6 +1,8 @@
 
 #include "common.h"
 
+#include "global.h"
+
 // Didn't find sleep in QCore
 #ifdef Q_OS_WIN
 #include <winsock2.h> // for windows.h
@@ -277,6 +279,33 @@ bool settingEnabled(QString parameter)
 }
 
 
+uint16_t audioFrameDuration(int ptime)
+{
+  QSettings settings("kvazzup.ini", QSettings::IniFormat);
+
+  int wanted = settings.value("audio/frameDuration").toInt();
+  if (wanted <= 0)
+  {
+    wanted = DEFAULT_AUDIO_FRAME_DURATION;
+  }
+
+  if (ptime > 0 && ptime < wanted)
+  {
+    wanted = ptime;
+  }
+
+  uint16_t duration = AUDIO_FRAME_DURATIONS[0];
+  for (uint16_t supported : AUDIO_FRAME_DURATIONS)
+  {
+    if (supported <= wanted)
+    {
+      duration = supported;
+    }
+  }
+  return duration;
+}
+
+
 QString getLocalUsername()
 {
   QSettings settings("kvazzup.ini", QSettings::IniFormat);
@@ -72,4 +72,8 @@ void printDebug(DebugType type, const QObject* object, QString description = "",
 
 bool settingEnabled(QString parameter);
 
+// The audio frame duration in ms we want to use according to settings. If the
+// peer has a ptime, the duration is the longest supported one within it.
+uint16_t audioFrameDuration(int ptime = 0);
+
 QString getLocalUsername();
@@ -9,15 +9,24 @@ const QString APPLICATIONNAME = "Kvazzup";
 // how often registrations are sent in seconds
 const int REGISTER_INTERVAL = 600;
 
-// this affects latency of audio. We have to wait until this much audio
-// has arrived before sending the packet. If packet is too small,
-// we waste bandwidth.
-
-// TODO: This should be at least 100 frames per second to reduce latency
-const uint16_t AUDIO_FRAMES_PER_SECOND = 25; // 40 ms of latency
+// Audio frame durations in ms. This affects latency of audio. We have to wait
+// until a frame of audio has arrived before sending the packet. If packet is
+// too small, we waste bandwidth. The duration is negotiated with SDP ptime.
+const uint16_t AUDIO_FRAME_DURATIONS[] = {10, 20, 40};
+const uint16_t DEFAULT_AUDIO_FRAME_DURATION = 20;
 
 const int STREAM_COMPONENTS = 4;
 
+// RTP timestamps of video are always in 90 kHz
+const uint32_t VIDEO_CLOCK_RATE = 90000;
+
+// and the ones of Opus in 48 kHz
+const uint32_t OPUS_CLOCK_RATE = 48000;
+
+// Raw PCM is sent in 16 kHz since larger frames would not fit in a packet.
+// Audio is resampled to and from it when the call uses another rate.
+const uint32_t PCM_SAMPLE_RATE = 16000;
+
 // this macro checks the condition and quits in debug mode and exits the current function in
 #define CHECKERROR(condition, errorString, errorReturnValue) \
   Q_ASSERT(condition); \
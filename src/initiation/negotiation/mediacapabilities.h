@@ -12,12 +12,8 @@ const QList<uint8_t> PREDEFINED_AUDIO_CODECS = {0};
 const QList<uint8_t> PREDEFINED_VIDEO_CODECS = {};
 
 // dynamic payload types.
-#ifdef __linux__
-const QList<RTPMap> DYNAMIC_AUDIO_CODECS = {};
-#else
 // TODO: put number of channels in parameters.
 const QList<RTPMap> DYNAMIC_AUDIO_CODECS = {RTPMap{96, 48000, "opus", ""}};
-#endif
 const QList<RTPMap> DYNAMIC_VIDEO_CODECS = {RTPMap{97, 90000, "h265", ""}};
 
 const QString SESSION_NAME = "HEVC Video Call";
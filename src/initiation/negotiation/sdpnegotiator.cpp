@@ -107,6 +107,16 @@ std::shared_ptr<SDPMessageInfo> SDPNegotiator::negotiateSDP(SDPMessageInfo& remo
                       supportedNums, supportedCodecs,
                       ourMedia.rtpNums, ourMedia.codecs);
 
+      // both of us use the shorter of our frame durations
+      int ptime = 0;
+      for (auto& attribute : remoteMedia.valueAttributes)
+      {
+        if (attribute.type == A_PTIME)
+        {
+          ptime = attribute.value.toInt();
+        }
+      }
+      ourMedia.valueAttributes = {{A_PTIME, QString::number(audioFrameDuration(ptime))}};
     }
     else if (remoteMedia.type == "video")
     {
@@ -204,7 +214,8 @@ bool SDPNegotiator::generateAudioMedia(MediaInfo &audio)
 {
   // we ignore nettype, addrtype and address, because we use a global c=
   audio = {"audio", 0, "RTP/AVP", {},
-           "", "", "", "", {},"", DYNAMIC_AUDIO_CODECS, {A_SENDRECV}, {}};
+           "", "", "", "", {},"", DYNAMIC_AUDIO_CODECS, {A_SENDRECV},
+           {{A_PTIME, QString::number(audioFrameDuration())}}};
 
   // add all the dynamic numbers first because we want to favor dynamic type codecs.
   for(RTPMap codec : audio.codecs)
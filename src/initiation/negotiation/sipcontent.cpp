@@ -38,7 +38,7 @@ bool parseAttributes(QStringListIterator &lineIterator, char &type, QStringList&
                      QList<RTPMap>& codecs, QList<std::shared_ptr<ICEInfo>>& candidates);
 
 void parseFlagAttribute(SDPAttributeType type, QRegularExpressionMatch& match, QList<SDPAttributeType>& attributes);
-void parseValueAttribute(SDPAttributeType type, QRegularExpressionMatch& match, QList<SDPAttribute> valueAttributes);
+void parseValueAttribute(SDPAttributeType type, QRegularExpressionMatch& match, QList<SDPAttribute>& valueAttributes);
 void parseRTPMap(QRegularExpressionMatch& match, QString secondWord, QList<RTPMap>& codecs);
 bool parseICECandidate(QStringList& words, QList<std::shared_ptr<ICEInfo>>& candidates);
 
@@ -199,6 +199,28 @@ QString composeSDPContent(const SDPMessageInfo &sdpInfo)
       }
       }
     }
+
+    for (const SDPAttribute& attribute : mediaStream.valueAttributes)
+    {
+      switch (attribute.type)
+      {
+      case A_PTIME:
+      {
+        sdp += "a=ptime:" + attribute.value + lineEnd;
+        break;
+      }
+      case A_MAXPTIME:
+      {
+        sdp += "a=maxptime:" + attribute.value + lineEnd;
+        break;
+      }
+      default:
+      {
+        qDebug() << "ERROR: Trying to compose SDP value attribute with unimplemented type";
+        break;
+      }
+      }
+    }
   }
 
   for (auto& info : sdpInfo.candidates)
@@ -751,12 +773,12 @@ void parseFlagAttribute(SDPAttributeType type, QRegularExpressionMatch& match, Q
   }
 }
 
-void parseValueAttribute(SDPAttributeType type, QRegularExpressionMatch& match, QList<SDPAttribute> valueAttributes)
+void parseValueAttribute(SDPAttributeType type, QRegularExpressionMatch& match, QList<SDPAttribute>& valueAttributes)
 {
   if(match.lastCapturedIndex() == 3)
   {
     qDebug() << "Correctly matched an SDP value attribute";
-    QString value = match.captured(2);
+    QString value = match.captured(3);
     valueAttributes.push_back(SDPAttribute{type, value});
   }
   else
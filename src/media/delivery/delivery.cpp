@@ -152,6 +152,18 @@ std::shared_ptr<Filter> Delivery::addSendStream(uint32_t sessionID, QHostAddress
       &UvgRTPSender::zrtpFailure,
       this,
       &Delivery::handleZRTPFailure);
+
+    connect(
+      peers_[sessionID]->streams[localPort]->sender.get(),
+      &UvgRTPSender::videoReport,
+      this,
+      &Delivery::videoReport);
+
+    connect(
+      peers_[sessionID]->streams[localPort]->sender.get(),
+      &UvgRTPSender::keyframeRequested,
+      this,
+      &Delivery::keyframeRequested);
   }
 
   return peers_[sessionID]->streams[localPort]->sender;
@@ -228,12 +240,13 @@ bool Delivery::addMediaStream(uint32_t sessionID, uint16_t localPort, uint16_t p
 
   printNormal(this, "Creating mediastream");
 
-  int flags = 0;
+  // RTCP reports are needed for adapting the bitrate
+  int flags = RCE_RTCP;
   // enable encryption if it works
   if (uvg_rtp::crypto::enabled())
   {
     // enable srtp + zrtp
-    flags = RCE_SRTP_KMNGMNT_ZRTP | RCE_SRTP;
+    flags |= RCE_SRTP_KMNGMNT_ZRTP | RCE_SRTP;
   }
 
   QFuture<uvg_rtp::media_stream *> futureRes =
@@ -272,6 +285,24 @@ void Delivery::removeMediaStream(uint32_t sessionID, uint16_t localPort)
 }
 
 
+void Delivery::requestKeyframe(uint32_t sessionID)
+{
+  if (peers_.find(sessionID) == peers_.end())
+  {
+    return;
+  }
+
+  // only the video receiver sends the request
+  for (auto& stream : peers_[sessionID]->streams)
+  {
+    if (stream.second != nullptr && stream.second->receiver != nullptr)
+    {
+      stream.second->receiver->requestKeyframe();
+    }
+  }
+}
+
+
 void Delivery::removePeer(uint32_t sessionID)
 {
   if (peers_.find(sessionID) != peers_.end())
@@ -44,6 +44,9 @@ public:
   //void removeSendStream(uint32_t sessionID, uint16_t localPort);
   //void removeReceiveStream(uint32_t sessionID, uint16_t localPort);
 
+  // asks the peer to send an intra frame of video
+  void requestKeyframe(uint32_t sessionID);
+
   // removes everything related to this peer
    void removePeer(uint32_t sessionID);
 
@@ -53,6 +56,13 @@ signals:
   void handleZRTPFailure(uint32_t sessionID);
   void handleNoEncryption();
 
+  // RTCP reception statistics of our video from a peer, see UvgRTPSender
+  void videoReport(uint32_t sessionID, double fractionLost, uint32_t jitter,
+                   int32_t rtt, double queueFill);
+
+  // the peer cannot decode our video until the next intra frame
+  void keyframeRequested(uint32_t sessionID);
+
 private:
 
   struct MediaStream
@@ -10,6 +10,12 @@
 #define RTP_HEADER_SIZE 2
 #define FU_HEADER_SIZE  1
 
+// See UvgRTPSender
+const char KEYFRAME_REQUEST[] = "PLI ";
+
+// the time the intra frame has to arrive before we ask again
+const int64_t KEYFRAME_REQUEST_INTERVAL = 500;
+
 static void __receiveHook(void *arg, uvg_rtp::frame::rtp_frame *frame)
 {
   if (arg && frame)
@@ -23,7 +29,10 @@ UvgRTPReceiver::UvgRTPReceiver(uint32_t sessionID, QString id, StatisticsInterfa
   Filter(id, "RTP Receiver " + media, stats, NONE, type),
   type_(type),
   addStartCodes_(true),
-  sessionID_(sessionID)
+  sessionID_(sessionID),
+  lastKeyframeRequest_(0),
+  lastTimestamp_(0),
+  timestampValid_(false)
 {
   watcher_.setFuture(stream);
 
@@ -48,6 +57,37 @@ void UvgRTPReceiver::process()
 }
 
 
+void UvgRTPReceiver::requestKeyframe()
+{
+  if (type_ != HEVCVIDEO || !watcher_.isFinished() || watcher_.result() == nullptr ||
+      watcher_.result()->get_rtcp() == nullptr)
+  {
+    return;
+  }
+
+  int64_t now = QDateTime::currentMSecsSinceEpoch();
+  if (now - lastKeyframeRequest_ < KEYFRAME_REQUEST_INTERVAL)
+  {
+    return;
+  }
+  lastKeyframeRequest_ = now;
+
+  char name[4];
+  memcpy(name, KEYFRAME_REQUEST, 4);
+
+  // the packet must have some payload
+  uint8_t payload[4] = {0, 0, 0, 0};
+
+  if (watcher_.result()->get_rtcp()->send_app_packet(name, 0, sizeof(payload), payload) != RTP_OK)
+  {
+    printWarning(this, "Failed to send intra frame request");
+    return;
+  }
+
+  printNormal(this, "Requested an intra frame from peer");
+}
+
+
 void UvgRTPReceiver::receiveHook(uvg_rtp::frame::rtp_frame *frame)
 {
   Q_ASSERT(frame && frame->payload != nullptr);
@@ -60,32 +100,43 @@ void UvgRTPReceiver::receiveHook(uvg_rtp::frame::rtp_frame *frame)
     return;
   }
 
+  // NAL units of the same frame have the same timestamp. The decoder combines
+  // the units with a short start code to the frame before them.
+  uint32_t startCode = 4;
+  if (type_ == HEVCVIDEO && timestampValid_ && frame->header.timestamp == lastTimestamp_)
+  {
+    startCode = 3;
+  }
+  lastTimestamp_ = frame->header.timestamp;
+  timestampValid_ = true;
+
   if (addStartCodes_ && type_ == HEVCVIDEO)
   {
-    frame->payload_len += 4;
+    frame->payload_len += startCode;
   }
 
   Data *received_picture = new Data;
   received_picture->data_size = frame->payload_len;
   received_picture->type = type_;
-  received_picture->data = std::unique_ptr<uchar[]>(new uchar[received_picture->data_size]);
+  received_picture->data = FrameBuffer(received_picture->data_size);
   received_picture->width = 0; // not known at this point. Decoder tells the correct resolution
   received_picture->height = 0;
   received_picture->framerate = 0;
   received_picture->source = REMOTE;
 
-  // TODO: Get this info from RTP
+  // arrival time, the sender's capture time is in the RTP timestamp
   received_picture->presentationTime = QDateTime::currentMSecsSinceEpoch();
+  received_picture->rtpTimestamp = frame->header.timestamp;
+  received_picture->rtpSequence = frame->header.seq;
 
   // TODO: This copying should be done in separate thread as in
   // framedsource if we want to receive 4K with less powerful thread (like in Xeon)
   if (addStartCodes_ && type_ == HEVCVIDEO)
   {
-    memcpy(received_picture->data.get() + 4, frame->payload, received_picture->data_size - 4);
-    received_picture->data[0] = 0;
-    received_picture->data[1] = 0;
-    received_picture->data[2] = 0;
-    received_picture->data[3] = 1;
+    memcpy(received_picture->data.get() + startCode, frame->payload,
+           received_picture->data_size - startCode);
+    memset(received_picture->data.get(), 0, startCode - 1);
+    received_picture->data[startCode - 1] = 1;
   }
   else
   {
@@ -16,6 +16,10 @@ public:
 
   void uninit();
 
+  // Ask the sender for an intra frame with RTCP. Requests are limited so
+  // that the intra frame has time to arrive.
+  void requestKeyframe();
+
 protected:
   void process();
 
@@ -30,4 +34,9 @@ private:
   bool addStartCodes_;
 
   QFutureWatcher<uvg_rtp::media_stream *> watcher_;
+
+  int64_t lastKeyframeRequest_;
+
+  uint32_t lastTimestamp_;
+  bool timestampValid_;
 };
@@ -1,20 +1,44 @@
 #include <QSettings>
+#include <QDateTime>
+#include <QStringList>
 
 #include "uvgrtpsender.h"
 #include "statisticsinterface.h"
 #include "common.h"
+#include "global.h"
+
+#include <opus.h>
+
+#include <algorithm>
+#include <cstring>
+
+// uvgRTP does not support RTCP feedback messages, so picture loss is
+// indicated with an application-defined packet of this name.
+const char KEYFRAME_REQUEST[] = "PLI ";
+
+// seconds between 1900 (NTP) and 1970 (Unix)
+const uint64_t NTP_OFFSET = 2208988800ULL;
 
 UvgRTPSender::UvgRTPSender(uint32_t sessionID, QString id, StatisticsInterface *stats,
                            DataType type, QString media, QFuture<uvg_rtp::media_stream *> mstream):
   Filter(id, "RTP Sender " + media, stats, type, NONE),
   type_(type),
+  removeStartCodes_(false),
   mstream_(nullptr),
+  watcher_(),
   frame_(0),
+  audioTimestampValid_(false),
+  audioTimestamp_(0),
+  sessionID_(sessionID),
+  dataFormat_(RTP_FORMAT_GENERIC),
   rtpFlags_(RTP_NO_FLAGS),
-  sessionID_(sessionID)
+  encrypted_(uvg_rtp::crypto::enabled())
 {
   updateSettings();
 
+  // each sender is fed by the last filter of one send graph
+  enableLockFreeBuffer();
+
   switch (type)
   {
     case HEVCVIDEO:
@@ -35,7 +59,19 @@ UvgRTPSender::UvgRTPSender(uint32_t sessionID, QString id, StatisticsInterface *
           [this]()
           {
             if (!(mstream_ = watcher_.result()))
+            {
               emit zrtpFailure(sessionID_);
+            }
+            else if (type_ == HEVCVIDEO && mstream_->get_rtcp() != nullptr)
+            {
+              // reports of how the peer receives our video for rate control
+              mstream_->get_rtcp()->install_receiver_hook(
+                    std::bind(&UvgRTPSender::receiverReport, this, std::placeholders::_1));
+              mstream_->get_rtcp()->install_sender_hook(
+                    std::bind(&UvgRTPSender::senderReport, this, std::placeholders::_1));
+              mstream_->get_rtcp()->install_app_hook(
+                    std::bind(&UvgRTPSender::appPacket, this, std::placeholders::_1));
+            }
           });
 }
 
@@ -57,6 +93,22 @@ void UvgRTPSender::updateSettings()
 
     if (settings.value("video/Slices").toInt() == 1)
     {
+      // each WPP row or tile of a frame is sent separately
+      uint32_t slices = 1;
+      if (settings.value("video/WPP").toInt() == 1)
+      {
+        slices *= (settings.value("video/ResolutionHeight").toUInt() + 63)/64;
+      }
+      if (settings.value("video/Tiles").toInt() == 1)
+      {
+        QStringList dimensions = settings.value("video/tileDimensions").toString().split("x");
+        if (dimensions.size() == 2)
+        {
+          slices *= std::max(1, dimensions.at(0).toInt()*dimensions.at(1).toInt());
+        }
+      }
+
+      maxBufferSize_ = vps * intra * std::max(slices, (uint32_t)1);
       rtpFlags_ |= RTP_SLICE;
     }
     else
@@ -70,11 +122,54 @@ void UvgRTPSender::updateSettings()
       rtpFlags_ &= ~RTP_SLICE;
     }
 
+    // The lock-free ring is sized from the limit when it is created, but
+    // it cannot be resized while frames are moving through it.
+    uint32_t capacity = lockFreeCapacity();
+    if (capacity != 0 && (uint32_t)maxBufferSize_ > capacity/2)
+    {
+      maxBufferSize_ = capacity/2;
+    }
+
     printDebug(DEBUG_NORMAL, this,  "Updated buffersize", {"Size"}, {QString::number(maxBufferSize_)});
   }
 }
 
 
+uint32_t UvgRTPSender::audioTimestamp(const Data* input)
+{
+  // the capture reads several frames at once, so the clock only sets the start
+  if (!audioTimestampValid_)
+  {
+    uint32_t rate = type_ == OPUSAUDIO ? OPUS_CLOCK_RATE : PCM_SAMPLE_RATE;
+    audioTimestamp_ = input->presentationTime*(rate/1000);
+    audioTimestampValid_ = true;
+  }
+
+  int samples = 0;
+  if (type_ == OPUSAUDIO)
+  {
+    // Opus always has a 48 kHz RTP clock whatever its internal rate
+    samples = opus_packet_get_nb_samples(input->data.get(), input->data_size, OPUS_CLOCK_RATE);
+  }
+  else
+  {
+    // mono 16-bit PCM
+    samples = input->data_size/sizeof(int16_t);
+  }
+
+  uint32_t timestamp = audioTimestamp_;
+  if (samples > 0)
+  {
+    audioTimestamp_ += samples;
+  }
+  else
+  {
+    printWarning(this, "Could not count the samples of an audio packet");
+  }
+  return timestamp;
+}
+
+
 void UvgRTPSender::process()
 {
   // TODO
@@ -86,7 +181,28 @@ void UvgRTPSender::process()
 
   while (input)
   {
-    ret = mstream_->push_frame(std::move(input->data), input->data_size, rtpFlags_);
+    // Slices of the same frame must have the same timestamp. The receiver
+    // paces the frames by it, so it is the capture time, not the send time.
+    uint32_t timestamp = input->presentationTime*(VIDEO_CLOCK_RATE/1000);
+
+    if (type_ == OPUSAUDIO || type_ == RAWAUDIO)
+    {
+      timestamp = audioTimestamp(input.get());
+    }
+
+    if (!encrypted_ || input->data.isShared())
+    {
+      // Without SRTP uvgRTP sends straight from our buffer, which may be
+      // Kvazaar's output. SRTP encrypts the frame in place, so uvgRTP has to
+      // copy it if other senders are still using it.
+      int flags = encrypted_ ? rtpFlags_ | RTP_COPY : rtpFlags_;
+      ret = mstream_->push_frame(input->data.get(), input->data_size, timestamp, flags);
+    }
+    else
+    {
+      ret = mstream_->push_frame(input->data.release(input->data_size),
+                                 input->data_size, timestamp, rtpFlags_);
+    }
 
     if (ret != RTP_OK)
     {
@@ -98,3 +214,59 @@ void UvgRTPSender::process()
     input = getInput();
   }
 }
+
+
+void UvgRTPSender::receiverReport(std::unique_ptr<uvg_rtp::frame::rtcp_receiver_report> report)
+{
+  for (auto& block : report->report_blocks)
+  {
+    reportBlock(block);
+  }
+}
+
+
+void UvgRTPSender::senderReport(std::unique_ptr<uvg_rtp::frame::rtcp_sender_report> report)
+{
+  // the peer sends its reception report with its own sender report if it sends media
+  for (auto& block : report->report_blocks)
+  {
+    reportBlock(block);
+  }
+}
+
+
+void UvgRTPSender::reportBlock(const uvg_rtp::frame::rtcp_report_block& block)
+{
+  // fraction is fixed point with 8 fractional bits
+  double fractionLost = block.fraction/256.0;
+  uint32_t jitter = (uint64_t)block.jitter*1000/VIDEO_CLOCK_RATE;
+
+  // Round-trip time is the current time minus the time of our last sender
+  // report and the time the peer held it. Times are the middle 32 bits of NTP.
+  int32_t rtt = -1;
+  if (block.lsr != 0)
+  {
+    int64_t now = QDateTime::currentMSecsSinceEpoch();
+    uint32_t ntpNow = (uint32_t)(((now/1000 + NTP_OFFSET) << 16) |
+                                 (((now%1000) << 16)/1000));
+    rtt = (int32_t)(((uint64_t)(uint32_t)(ntpNow - block.lsr - block.dlsr))*1000 >> 16);
+  }
+
+  double queueFill = 0;
+  if (maxBufferSize_ > 0)
+  {
+    queueFill = std::min(1.0, (double)bufferedInputs()/maxBufferSize_);
+  }
+
+  emit videoReport(sessionID_, fractionLost, jitter, rtt, queueFill);
+}
+
+
+void UvgRTPSender::appPacket(std::unique_ptr<uvg_rtp::frame::rtcp_app_packet> packet)
+{
+  if (memcmp(packet->name, KEYFRAME_REQUEST, 4) == 0)
+  {
+    printNormal(this, "Peer requested an intra frame");
+    emit keyframeRequested(sessionID_);
+  }
+}
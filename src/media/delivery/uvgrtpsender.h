@@ -23,14 +23,44 @@ protected:
 signals:
   void zrtpFailure(uint32_t sessionID);
 
+  // The peer reported how it receives our video. Jitter and round-trip time
+  // are in milliseconds, rtt is -1 if unknown. queueFill is how full our send
+  // buffer is from 0 to 1.
+  void videoReport(uint32_t sessionID, double fractionLost, uint32_t jitter,
+                   int32_t rtt, double queueFill);
+
+  // the peer cannot decode our video until the next intra frame
+  void keyframeRequested(uint32_t sessionID);
+
 private:
+
+  // called by uvgRTP with the RTCP reports of the peer
+  void receiverReport(std::unique_ptr<uvg_rtp::frame::rtcp_receiver_report> report);
+  void senderReport(std::unique_ptr<uvg_rtp::frame::rtcp_sender_report> report);
+
+  void reportBlock(const uvg_rtp::frame::rtcp_report_block& block);
+
+  void appPacket(std::unique_ptr<uvg_rtp::frame::rtcp_app_packet> packet);
+
+  // RTP timestamp of an audio packet in the clock rate of its payload
+  uint32_t audioTimestamp(const Data* input);
+
   DataType type_;
   bool removeStartCodes_;
 
   uvg_rtp::media_stream * mstream_;
   QFutureWatcher<uvg_rtp::media_stream *> watcher_;
   uint64_t frame_;
+
+  // Audio timestamps advance by the samples sent. Only the first one comes
+  // from the clock.
+  bool audioTimestampValid_;
+  uint32_t audioTimestamp_;
+
   uint32_t sessionID_;
   rtp_format_t dataFormat_;
   int rtpFlags_;
+
+  // SRTP is used if uvgRTP supports it, see Delivery
+  bool encrypted_;
 };
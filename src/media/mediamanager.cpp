@@ -46,6 +46,26 @@ void MediaManager::init(std::shared_ptr<VideoviewFactory> viewfactory, Statistic
     this,
     &MediaManager::handleNoEncryption);
 
+  // the filter graph adapts our video to the reports of peers
+  connect(
+    streamer_.get(),
+    &Delivery::videoReport,
+    fg_.get(),
+    &FilterGraph::videoReport);
+
+  // recovering from lost video with intra frames
+  connect(
+    streamer_.get(),
+    &Delivery::keyframeRequested,
+    fg_.get(),
+    &FilterGraph::sendKeyframe);
+
+  connect(
+    fg_.get(),
+    &FilterGraph::requestKeyframe,
+    streamer_.get(),
+    &Delivery::requestKeyframe);
+
   // 0 is the selfview index. The view should be created by GUI
   fg_->init(viewfactory_->getVideo(0, 0), stats);
   streamer_->init(stats_);
@@ -211,12 +231,14 @@ void MediaManager::createOutgoingMedia(uint32_t sessionID,
 
       if(remoteMedia.type == "audio")
       {
-        fg_->sendAudioTo(sessionID, std::shared_ptr<Filter>(framedSource));
+        fg_->sendAudioTo(sessionID, std::shared_ptr<Filter>(framedSource),
+                         frameDuration(remoteMedia));
         fg_->mic(mic_);
       }
       else if(remoteMedia.type == "video")
       {
-        fg_->sendVideoto(sessionID, std::shared_ptr<Filter>(framedSource));
+        fg_->sendVideoto(sessionID, std::shared_ptr<Filter>(framedSource),
+                         bandwidthLimit(remoteMedia));
       }
       else
       {
@@ -373,6 +395,38 @@ QString MediaManager::rtpNumberToCodec(const MediaInfo& info)
   return "pcm";
 }
 
+
+uint32_t MediaManager::bandwidthLimit(const MediaInfo& info)
+{
+  // application specific bandwidth is given in kbps
+  for (auto& bitrate : info.bitrate)
+  {
+    if (bitrate.startsWith("AS:"))
+    {
+      bool ok = false;
+      uint32_t kbps = bitrate.mid(3).toUInt(&ok);
+      if (ok)
+      {
+        return kbps*1000;
+      }
+    }
+  }
+  return 0;
+}
+
+uint16_t MediaManager::frameDuration(const MediaInfo& info)
+{
+  for (auto& attribute : info.valueAttributes)
+  {
+    if (attribute.type == A_PTIME)
+    {
+      return audioFrameDuration(attribute.value.toInt());
+    }
+  }
+  return audioFrameDuration();
+}
+
+
 void MediaManager::transportAttributes(const QList<SDPAttributeType>& attributes, bool& send, bool& recv)
 {
   send = true;
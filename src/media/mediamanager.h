@@ -93,6 +93,12 @@ private:
 
   QString rtpNumberToCodec(const MediaInfo& info);
 
+  // bandwidth in bits/s from b=AS field, 0 if not limited
+  uint32_t bandwidthLimit(const MediaInfo& info);
+
+  // the audio frame duration in ms we send to this peer based on its ptime
+  uint16_t frameDuration(const MediaInfo& info);
+
   void transportAttributes(const QList<SDPAttributeType> &attributes, bool& send, bool& recv);
 
   void sdpToStats(uint32_t sessionID, std::shared_ptr<SDPMessageInfo> sdp, bool incoming);
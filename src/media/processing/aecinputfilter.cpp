@@ -7,7 +7,10 @@
 
 AECInputFilter::AECInputFilter(QString id, StatisticsInterface* stats):
   Filter(id, "AEC input", stats, RAWAUDIO, RAWAUDIO)
-{}
+{
+  // only audio capture sends us input
+  enableLockFreeBuffer();
+}
 
 
 AECInputFilter::~AECInputFilter()
@@ -15,9 +18,9 @@ AECInputFilter::~AECInputFilter()
   aec_->cleanup();
 }
 
-void AECInputFilter::initInput(QAudioFormat format)
+void AECInputFilter::initInput(QAudioFormat format, uint16_t frameDuration)
 {
-  aec_ = std::make_shared<AECProcessor>(format);
+  aec_ = std::make_shared<AECProcessor>(format, frameDuration);
 }
 
 
@@ -33,7 +36,8 @@ void AECInputFilter::process()
 
   while(input)
   {
-    input->data = aec_->processInputFrame(std::move(input->data), input->data_size);
+    input->data = aec_->processInputFrame(input->data.release(input->data_size),
+                                          input->data_size);
 
     if (input->data != nullptr)
     {
@@ -11,7 +11,8 @@ public:
   AECInputFilter(QString id, StatisticsInterface* stats);
   ~AECInputFilter();
 
-  void initInput(QAudioFormat format);
+  // frame duration in ms
+  void initInput(QAudioFormat format, uint16_t frameDuration);
 
   std::shared_ptr<AECProcessor> getAEC()
   {
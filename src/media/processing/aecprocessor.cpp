@@ -5,7 +5,6 @@
 #include <QSettings>
 
 #include "common.h"
-#include "global.h"
 
 
 bool PREPROCESSOR = true;
@@ -15,9 +14,9 @@ bool PREPROCESSOR = true;
 // if you are in a large room, optimal time may be larger.
 const int REVERBERATION_TIME_MS = 100;
 
-AECProcessor::AECProcessor(QAudioFormat format):
+AECProcessor::AECProcessor(QAudioFormat format, uint16_t frameDuration):
   format_(format),
-  samplesPerFrame_(format.sampleRate()/AUDIO_FRAMES_PER_SECOND),
+  samplesPerFrame_(format.sampleRate()*frameDuration/1000),
   preprocessor_(nullptr),
   echo_state_(nullptr),
   echoSize_(0),
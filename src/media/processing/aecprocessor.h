@@ -18,7 +18,7 @@ class AECProcessor : public QObject
 {
   Q_OBJECT
 public:
-  AECProcessor(QAudioFormat format);
+  AECProcessor(QAudioFormat format, uint16_t frameDuration);
 
   void updateSettings();
 
@@ -3,7 +3,6 @@
 #include "statisticsinterface.h"
 
 #include "common.h"
-#include "global.h"
 
 #include <QAudioInput>
 #include <QTime>
@@ -12,13 +11,14 @@
 
 
 AudioCaptureFilter::AudioCaptureFilter(QString id, QAudioFormat format,
-                                       StatisticsInterface *stats):
+                                       uint16_t frameDuration, StatisticsInterface *stats):
   Filter(id, "Audio_Capture", stats, NONE, RAWAUDIO),
   deviceInfo_(),
   format_(format),
   audioInput_(nullptr),
   input_(nullptr),
-  frameSize_(format.sampleRate()*format.bytesPerFrame()/AUDIO_FRAMES_PER_SECOND),
+  frameDuration_(frameDuration),
+  frameSize_(format.sampleRate()*format.bytesPerFrame()*frameDuration/1000),
   buffer_(frameSize_, 0),
   wantedState_(QAudio::StoppedState)
 {}
@@ -87,6 +87,10 @@ bool AudioCaptureFilter::init()
   if (!info.isFormatSupported(format_)) {
     printWarning(this, "Default audio format not supported - trying to use nearest");
     format_ = info.nearestFormat(format_);
+
+    // the frames stay as long, a resampler converts them after us
+    frameSize_ = format_.sampleRate()*format_.bytesPerFrame()*frameDuration_/1000;
+    buffer_ = QByteArray(frameSize_, 0);
   }
 
   if(format_.sampleRate() != -1)
@@ -152,7 +156,7 @@ void AudioCaptureFilter::readMore()
       // create audio data packet to be sent to filter graph
       newSample->presentationTime = QDateTime::currentMSecsSinceEpoch();
       newSample->type = RAWAUDIO;
-      newSample->data = std::unique_ptr<uint8_t[]>(new uint8_t[readData]);
+      newSample->data = FrameBuffer(readData);
 
       memcpy(newSample->data.get(), buffer_.constData(), readData);
 
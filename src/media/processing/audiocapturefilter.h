@@ -13,7 +13,9 @@ class AudioCaptureFilter : public Filter
 {
   Q_OBJECT
 public:
-  AudioCaptureFilter(QString id, QAudioFormat format, StatisticsInterface* stats);
+  // sends frames of frameDuration ms
+  AudioCaptureFilter(QString id, QAudioFormat format, uint16_t frameDuration,
+                     StatisticsInterface* stats);
   virtual ~AudioCaptureFilter();
 
   virtual bool init(); // setups audio device and parameters.
@@ -21,6 +23,12 @@ public:
   virtual void start(); // resumes audio input
   virtual void stop(); // suspends audio input
 
+  // the format of the microphone, which may differ from the one asked for
+  QAudioFormat format() const
+  {
+    return format_;
+  }
+
 protected:
 
   // this does nothing. ReadMore does the sending of
@@ -46,6 +54,7 @@ private:
   QIODevice *input_;
   bool pullMode_;
 
+  uint16_t frameDuration_;
   int frameSize_;
   QByteArray buffer_;
 
@@ -0,0 +1,377 @@
+#include "audiojitterbuffer.h"
+
+#include "filter.h"
+
+#include "common.h"
+#include "global.h"
+
+#include <QDateTime>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+// how many times the jitter we buffer on top of one packet
+const double JITTER_MULTIPLIER = 3;
+
+// ms, after this the jitter is better heard as breaks than as delay
+const uint32_t MAX_DELAY = 200;
+
+// ms of concealment after which the peer is considered silent
+const uint32_t MAX_CONCEALMENT = 200;
+
+// the longest Opus packet in ms
+const uint32_t MAX_PACKET_DURATION = 120;
+
+// sequence numbers further than this from the highest one are not from this stream
+const int64_t MAX_SEQUENCE_JUMP = 1000;
+
+
+AudioJitterBuffer::AudioJitterBuffer(QAudioFormat format, uint16_t frameDuration, bool opus):
+  format_(format),
+  frameSamples_(format.sampleRate()*format.channelCount()*frameDuration/1000),
+  samplesPerMs_(format.sampleRate()*format.channelCount()/1000),
+  opus_(opus),
+  dec_(nullptr),
+  clockRate_(opus ? OPUS_CLOCK_RATE : PCM_SAMPLE_RATE),
+  mutex_(),
+  packets_(),
+  highestSequence_(0),
+  nextSequence_(0),
+  sequenceValid_(false),
+  playing_(false),
+  pcm_(),
+  decoded_(samplesPerMs_*MAX_PACKET_DURATION, 0),
+  packetSamples_(frameSamples_),
+  concealedSamples_(0),
+  lastTimestamp_(0),
+  extendedTimestamp_(0),
+  previousTransit_(0),
+  jitter_(0),
+  targetDelay_(frameDuration),
+  latePackets_(0),
+  minLag_(format.sampleRate()*5/2000*format.channelCount()),
+  maxLag_(format.sampleRate()*12/1000*format.channelCount())
+{
+  if (opus_)
+  {
+    int error = 0;
+    dec_ = opus_decoder_create(format_.sampleRate(), format_.channelCount(), &error);
+
+    if (error)
+    {
+      printDebug(DEBUG_WARNING, "AudioJitterBuffer", "Failed to initialize opus decoder.",
+                 {"Errorcode"}, {QString::number(error)});
+      dec_ = nullptr;
+    }
+  }
+}
+
+
+AudioJitterBuffer::~AudioJitterBuffer()
+{
+  if (dec_)
+  {
+    opus_decoder_destroy(dec_);
+    dec_ = nullptr;
+  }
+}
+
+
+void AudioJitterBuffer::inputPacket(std::unique_ptr<Data> packet)
+{
+  int64_t arrival = QDateTime::currentMSecsSinceEpoch();
+
+  QMutexLocker locker(&mutex_);
+
+  int64_t sequence = packet->rtpSequence;
+  if (!sequenceValid_)
+  {
+    highestSequence_ = sequence;
+    extendedTimestamp_ = packet->rtpTimestamp;
+    previousTransit_ = arrival - extendedTimestamp_*1000/clockRate_;
+    sequenceValid_ = true;
+  }
+  else
+  {
+    // the signed differences survive the wraparounds
+    sequence = highestSequence_ + (int16_t)(packet->rtpSequence - (uint16_t)highestSequence_);
+    extendedTimestamp_ += (int32_t)(packet->rtpTimestamp - lastTimestamp_);
+  }
+  lastTimestamp_ = packet->rtpTimestamp;
+
+  int64_t transit = arrival - extendedTimestamp_*1000/clockRate_;
+  jitter_ += (std::abs(transit - previousTransit_) - jitter_)/16;
+  previousTransit_ = transit;
+
+  targetDelay_ = std::min((uint32_t)(packetSamples_/samplesPerMs_ + JITTER_MULTIPLIER*jitter_),
+                          MAX_DELAY);
+
+  if (std::abs(sequence - highestSequence_) > MAX_SEQUENCE_JUMP)
+  {
+    printDebug(DEBUG_WARNING, "AudioJitterBuffer", "Audio sequence number jumped. Restarting.",
+               {"Jump"}, {QString::number(sequence - highestSequence_)});
+    packets_.clear();
+    playing_ = false;
+  }
+  else if (playing_ && sequence < nextSequence_)
+  {
+    // this packet has already been concealed
+    ++latePackets_;
+    return;
+  }
+
+  highestSequence_ = packets_.empty() ? sequence : std::max(highestSequence_, sequence);
+  packets_[sequence] = std::move(packet);
+
+  // the playout has stopped, do not let the delay grow without a limit
+  while (packets_.size() > 1 && bufferedMs() > 2*MAX_DELAY)
+  {
+    packets_.erase(packets_.begin());
+    if (playing_)
+    {
+      nextSequence_ = packets_.begin()->first;
+    }
+  }
+}
+
+
+bool AudioJitterBuffer::readFrame(int16_t* output)
+{
+  QMutexLocker locker(&mutex_);
+
+  if (!playing_)
+  {
+    // start once the buffer has filled to its target
+    if (packets_.empty() || bufferedMs() < targetDelay_)
+    {
+      return false;
+    }
+
+    playing_ = true;
+    nextSequence_ = packets_.begin()->first;
+    concealedSamples_ = 0;
+  }
+
+  while (pcm_.size() < frameSamples_)
+  {
+    if (!decodeNext())
+    {
+      // the peer has stopped sending, let the buffer fill again
+      playing_ = false;
+      break;
+    }
+  }
+
+  if (playing_)
+  {
+    adjustDepth();
+  }
+
+  uint32_t samples = std::min((uint32_t)pcm_.size(), frameSamples_);
+  memcpy(output, pcm_.data(), samples*sizeof(int16_t));
+  memset(output + samples, 0, (frameSamples_ - samples)*sizeof(int16_t));
+
+  if (playing_)
+  {
+    pcm_.erase(pcm_.begin(), pcm_.begin() + samples);
+  }
+  else
+  {
+    pcm_.clear();
+  }
+  return true;
+}
+
+
+bool AudioJitterBuffer::decodeNext()
+{
+  auto packet = packets_.find(nextSequence_);
+  if (packet != packets_.end())
+  {
+    decodePacket(packet->second.get(), false);
+    packets_.erase(packet);
+    ++nextSequence_;
+    concealedSamples_ = 0;
+    return true;
+  }
+
+  if (concealedSamples_ >= MAX_CONCEALMENT*samplesPerMs_)
+  {
+    return false;
+  }
+
+  if (!packets_.empty())
+  {
+    // the packet is lost or late, the one after it may carry it as FEC
+    if (dec_ != nullptr && packets_.begin()->first == nextSequence_ + 1)
+    {
+      decodePacket(packets_.begin()->second.get(), true);
+    }
+    else
+    {
+      conceal(packetSamples_);
+    }
+    ++nextSequence_;
+  }
+  else
+  {
+    // nothing has arrived, so this adds to our delay
+    conceal(frameSamples_);
+  }
+  return true;
+}
+
+
+bool AudioJitterBuffer::decodeAvailable(uint32_t samples)
+{
+  while (pcm_.size() < samples && packets_.find(nextSequence_) != packets_.end())
+  {
+    decodeNext();
+  }
+  return pcm_.size() >= samples;
+}
+
+
+void AudioJitterBuffer::decodePacket(const Data* packet, bool fec)
+{
+  uint32_t channels = format_.channelCount();
+
+  if (!opus_)
+  {
+    uint32_t samples = packet->data_size/sizeof(int16_t);
+    const int16_t* pcm = (const int16_t*)packet->data.get();
+    pcm_.insert(pcm_.end(), pcm, pcm + samples);
+    packetSamples_ = samples;
+    return;
+  }
+
+  if (dec_ == nullptr)
+  {
+    conceal(packetSamples_);
+    return;
+  }
+
+  // FEC recovers the packet before, which we expect to be as long as the last one
+  int frameSize = fec ? packetSamples_/channels : decoded_.size()/channels;
+  int frames = opus_decode(dec_, packet->data.get(), packet->data_size,
+                           decoded_.data(), frameSize, fec ? 1 : 0);
+
+  if (frames < 0)
+  {
+    printDebug(DEBUG_WARNING, "AudioJitterBuffer", "Failed to decode audio packet.",
+               {"Error"}, {QString::number(frames)});
+    conceal(packetSamples_);
+    return;
+  }
+
+  pcm_.insert(pcm_.end(), decoded_.begin(), decoded_.begin() + frames*channels);
+
+  if (!fec)
+  {
+    packetSamples_ = frames*channels;
+  }
+}
+
+
+void AudioJitterBuffer::conceal(uint32_t samples)
+{
+  concealedSamples_ += samples;
+
+  if (dec_ != nullptr)
+  {
+    // Opus continues the signal and fades it out by itself
+    int frames = opus_decode(dec_, nullptr, 0, decoded_.data(),
+                             samples/format_.channelCount(), 0);
+    if (frames > 0)
+    {
+      pcm_.insert(pcm_.end(), decoded_.begin(),
+                  decoded_.begin() + frames*format_.channelCount());
+      return;
+    }
+  }
+
+  pcm_.insert(pcm_.end(), samples, 0);
+}
+
+
+uint32_t AudioJitterBuffer::bufferedMs() const
+{
+  return (pcm_.size() + packets_.size()*packetSamples_)/samplesPerMs_;
+}
+
+
+void AudioJitterBuffer::adjustDepth()
+{
+  uint32_t packetMs = packetSamples_/samplesPerMs_;
+
+  // what is left after this frame
+  int64_t depth = (int64_t)bufferedMs() - frameSamples_/samplesPerMs_;
+
+  if (depth > targetDelay_ + packetMs)
+  {
+    // removing a period needs two of them and a frame left after
+    decodeAvailable(frameSamples_ + 2*maxLag_);
+    uint32_t maxLag = std::min({maxLag_, (uint32_t)pcm_.size()/2,
+                                (uint32_t)pcm_.size() - frameSamples_});
+    if (maxLag < minLag_)
+    {
+      return;
+    }
+
+    uint32_t lag = findPeriod(maxLag);
+
+    // crossfade from the first period to the second one
+    for (uint32_t i = 0; i < lag; ++i)
+    {
+      pcm_[i] = (pcm_[i]*(int32_t)(lag - i) + pcm_[lag + i]*(int32_t)i)/(int32_t)lag;
+    }
+    pcm_.erase(pcm_.begin() + lag, pcm_.begin() + 2*lag);
+  }
+  else if (depth + packetMs < targetDelay_)
+  {
+    uint32_t maxLag = std::min(maxLag_, (uint32_t)pcm_.size()/2);
+    if (maxLag < minLag_)
+    {
+      return;
+    }
+
+    uint32_t lag = findPeriod(maxLag);
+
+    // after the first period, crossfade from the second period back to the
+    // first one so the second period follows it again
+    pcm_.insert(pcm_.begin() + lag, lag, 0);
+    for (uint32_t i = 0; i < lag; ++i)
+    {
+      pcm_[lag + i] = (pcm_[2*lag + i]*(int32_t)(lag - i) + pcm_[i]*(int32_t)i)/(int32_t)lag;
+    }
+  }
+}
+
+
+uint32_t AudioJitterBuffer::findPeriod(uint32_t maxLag) const
+{
+  // the lag at which the signal best resembles itself, a pitch period for voice
+  uint32_t best = minLag_;
+  double bestScore = 0;
+
+  for (uint32_t lag = minLag_; lag <= maxLag; lag += format_.channelCount())
+  {
+    int64_t correlation = 0;
+    int64_t energy = 1;
+    for (uint32_t i = 0; i < minLag_; ++i)
+    {
+      correlation += pcm_[i]*pcm_[lag + i];
+      energy += pcm_[lag + i]*pcm_[lag + i];
+    }
+
+    double score = correlation/std::sqrt((double)energy);
+    if (lag == minLag_ || score > bestScore)
+    {
+      best = lag;
+      bestScore = score;
+    }
+  }
+  return best;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <opus.h>
+
+#include <QAudioFormat>
+#include <QMutex>
+
+#include <map>
+#include <memory>
+#include <vector>
+
+struct Data;
+
+// Holds the received audio packets of one stream in the order of their RTP
+// sequence numbers and gives them to playout one frame at a time. The depth
+// of the buffer follows the jitter of the packet arrivals. Missing packets
+// are concealed with Opus forward error correction or packet loss
+// concealment. When the buffer is deeper or shallower than its target, one
+// pitch period is removed or repeated so the delay changes without a gap.
+
+class AudioJitterBuffer
+{
+public:
+  // Gives frames of frameDuration ms in format. Opus packets are decoded,
+  // others are expected to be raw PCM in format.
+  AudioJitterBuffer(QAudioFormat format, uint16_t frameDuration, bool opus);
+  ~AudioJitterBuffer();
+
+  // the packet must have its RTP sequence number and timestamp
+  void inputPacket(std::unique_ptr<Data> packet);
+
+  // Writes one frame to output. Returns false without writing anything while
+  // the buffer is filling up.
+  bool readFrame(int16_t* output);
+
+  bool opus() const
+  {
+    return opus_;
+  }
+
+  // number of int16 samples readFrame writes
+  uint32_t frameSamples() const
+  {
+    return frameSamples_;
+  }
+
+  // how much the buffer aims to hold in ms
+  uint32_t targetDelay() const
+  {
+    return targetDelay_;
+  }
+
+  // packets that arrived after they were concealed
+  uint32_t latePackets() const
+  {
+    return latePackets_;
+  }
+
+private:
+
+  // decodes or conceals the next packet to pcm_, false if the stream has
+  // been silent too long
+  bool decodeNext();
+
+  // decodes the packets that are in order until pcm_ has enough samples
+  bool decodeAvailable(uint32_t samples);
+
+  void decodePacket(const Data* packet, bool fec);
+  void conceal(uint32_t samples);
+
+  // ms of audio in pcm_ and packets_
+  uint32_t bufferedMs() const;
+
+  // removes or repeats a pitch period at the start of pcm_
+  void adjustDepth();
+  uint32_t findPeriod(uint32_t maxLag) const;
+
+  QAudioFormat format_;
+  uint32_t frameSamples_;
+  uint32_t samplesPerMs_;
+
+  bool opus_;
+  OpusDecoder* dec_;
+  uint32_t clockRate_;
+
+  QMutex mutex_;
+
+  // packets by extended sequence number
+  std::map<int64_t, std::unique_ptr<Data>> packets_;
+  int64_t highestSequence_;
+  int64_t nextSequence_;
+  bool sequenceValid_;
+  bool playing_;
+
+  // decoded samples waiting for playout
+  std::vector<int16_t> pcm_;
+  std::vector<int16_t> decoded_;
+
+  // the size of the last packet, also used for concealment
+  uint32_t packetSamples_;
+  uint32_t concealedSamples_;
+
+  // interarrival jitter of RFC 3550
+  uint32_t lastTimestamp_;
+  int64_t extendedTimestamp_;
+  int64_t previousTransit_;
+  double jitter_;
+
+  uint32_t targetDelay_;
+  uint32_t latePackets_;
+
+  // pitch periods searched for time-stretching
+  uint32_t minLag_;
+  uint32_t maxLag_;
+};
@@ -0,0 +1,132 @@
+#include "audiomixer.h"
+
+#include "audiojitterbuffer.h"
+#include "filter.h"
+#include "optimized/mix.h"
+#include "statisticsinterface.h"
+
+#include "common.h"
+#include "global.h"
+
+// ms between the jitter buffer statistics
+const uint32_t STATS_INTERVAL = 1000;
+
+
+AudioMixer::AudioMixer(StatisticsInterface* stats):
+  stats_(stats),
+  simd_(bestSIMD(SIMD_AVX2)),
+  format_(),
+  frameDuration_(DEFAULT_AUDIO_FRAME_DURATION),
+  frameSamples_(0),
+  mutex_(),
+  inputs_(),
+  frame_(),
+  sum_(),
+  statsFrames_(0)
+{
+  stats_->kernelInfo("Audio mixer", simdName(simd_));
+}
+
+
+AudioMixer::~AudioMixer()
+{}
+
+
+void AudioMixer::init(QAudioFormat format, uint16_t frameDuration)
+{
+  QMutexLocker locker(&mutex_);
+
+  format_ = format;
+  frameDuration_ = frameDuration;
+  frameSamples_ = format_.sampleRate()*format_.channelCount()*frameDuration_/1000;
+
+  frame_.resize(frameSamples_);
+  sum_.resize(frameSamples_);
+
+  for (auto& input : inputs_)
+  {
+    bool opus = input.second.buffer->opus();
+    input.second.buffer = std::make_unique<AudioJitterBuffer>(format_, frameDuration_, opus);
+  }
+}
+
+
+void AudioMixer::addInput(uint32_t sessionID, bool opus)
+{
+  QMutexLocker locker(&mutex_);
+  inputs_[sessionID] = {std::make_unique<AudioJitterBuffer>(format_, frameDuration_, opus),
+                        1.0f, false};
+}
+
+
+void AudioMixer::removeInput(uint32_t sessionID)
+{
+  QMutexLocker locker(&mutex_);
+  inputs_.erase(sessionID);
+}
+
+
+void AudioMixer::inputPacket(uint32_t sessionID, std::unique_ptr<Data> packet)
+{
+  QMutexLocker locker(&mutex_);
+
+  auto input = inputs_.find(sessionID);
+  if (input != inputs_.end())
+  {
+    input->second.buffer->inputPacket(std::move(packet));
+  }
+}
+
+
+void AudioMixer::setGain(uint32_t sessionID, float gain)
+{
+  QMutexLocker locker(&mutex_);
+
+  auto input = inputs_.find(sessionID);
+  if (input != inputs_.end())
+  {
+    input->second.gain = gain;
+  }
+}
+
+
+void AudioMixer::setMuted(uint32_t sessionID, bool muted)
+{
+  QMutexLocker locker(&mutex_);
+
+  auto input = inputs_.find(sessionID);
+  if (input != inputs_.end())
+  {
+    input->second.muted = muted;
+  }
+}
+
+
+void AudioMixer::mixFrame(int16_t* output)
+{
+  QMutexLocker locker(&mutex_);
+
+  std::fill(sum_.begin(), sum_.end(), 0.0f);
+
+  for (auto& input : inputs_)
+  {
+    // muted streams are read too, so they continue from the present when unmuted
+    if (input.second.buffer->readFrame(frame_.data()) && !input.second.muted)
+    {
+      mix_accumulate(simd_, frame_.data(), input.second.gain, sum_.data(), frameSamples_);
+    }
+  }
+
+  mix_limit(simd_, sum_.data(), output, frameSamples_);
+
+  ++statsFrames_;
+  if (statsFrames_*frameDuration_ >= STATS_INTERVAL)
+  {
+    for (auto& input : inputs_)
+    {
+      stats_->jitterBuffer(input.first, "Audio", input.second.buffer->targetDelay(),
+                           input.second.buffer->latePackets());
+    }
+    statsFrames_ = 0;
+  }
+}
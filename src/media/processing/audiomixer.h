@@ -0,0 +1,76 @@
+#pragma once
+
+#include "optimized/cpufeatures.h"
+
+#include <QAudioFormat>
+#include <QMutex>
+
+#include <map>
+#include <memory>
+#include <vector>
+
+class AudioJitterBuffer;
+class StatisticsInterface;
+struct Data;
+
+// Mixes the received audio streams for playout. Each stream has its own
+// jitter buffer from which one frame is taken for every time slot. A stream
+// with nothing to play in a slot is left out of it, so a late or silent peer
+// never holds back the others. The streams are summed as floats with their
+// own gains and limited back to 16 bits with a soft knee.
+
+class AudioMixer
+{
+public:
+  AudioMixer(StatisticsInterface* stats);
+  ~AudioMixer();
+
+  // Frames are frameDuration ms in format. Changing these drops the
+  // buffered audio, but keeps the inputs and their gains.
+  void init(QAudioFormat format, uint16_t frameDuration);
+
+  // opus tells whether the stream has to be decoded or is raw audio
+  void addInput(uint32_t sessionID, bool opus);
+  void removeInput(uint32_t sessionID);
+
+  void inputPacket(uint32_t sessionID, std::unique_ptr<Data> packet);
+
+  // 1 plays the stream as it was received
+  void setGain(uint32_t sessionID, float gain);
+  void setMuted(uint32_t sessionID, bool muted);
+
+  // mixes the next time slot to output, which must have room for one frame
+  void mixFrame(int16_t* output);
+
+  // number of int16 samples in one frame
+  uint32_t frameSamples() const
+  {
+    return frameSamples_;
+  }
+
+private:
+
+  struct Input
+  {
+    std::unique_ptr<AudioJitterBuffer> buffer;
+    float gain;
+    bool muted;
+  };
+
+  StatisticsInterface* stats_;
+  SIMDLevel simd_;
+
+  QAudioFormat format_;
+  uint16_t frameDuration_;
+  uint32_t frameSamples_;
+
+  QMutex mutex_;
+  std::map<uint32_t, Input> inputs_;
+
+  // the frame of one stream and the sum of all of them
+  std::vector<int16_t> frame_;
+  std::vector<float> sum_;
+
+  // slots mixed since the jitter buffers were last reported
+  uint32_t statsFrames_;
+};
@@ -3,11 +3,15 @@
 #include "audiooutputdevice.h"
 
 AudioMixerFilter::AudioMixerFilter(QString id, StatisticsInterface* stats,
-                 uint32_t sessionID, std::shared_ptr<AudioOutputDevice> output):
-  Filter(id, "Audio Mixer", stats, RAWAUDIO, RAWAUDIO),
+                 uint32_t sessionID, DataType type,
+                 std::shared_ptr<AudioOutputDevice> output):
+  Filter(id, "Audio Mixer", stats, type, type),
   sessionID_(sessionID),
   output_(output)
-{}
+{
+  // each received stream has its own mixer filter
+  enableLockFreeBuffer();
+}
 
 
 void AudioMixerFilter::process()
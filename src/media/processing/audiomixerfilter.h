@@ -7,14 +7,16 @@ class AudioOutputDevice;
 
 // This class is only a passthough class which holds the streams sessionID
 // This sessionID can then be used to identify which stream a samples belongs
-// to in mixing.
+// to in mixing. The type is RAWAUDIO or OPUSAUDIO, the output device decodes
+// the packets after its jitter buffer.
 
 class AudioMixerFilter : public Filter
 {
 public:
 
   AudioMixerFilter(QString id, StatisticsInterface* stats,
-                   uint32_t sessionID, std::shared_ptr<AudioOutputDevice> output);
+                   uint32_t sessionID, DataType type,
+                   std::shared_ptr<AudioOutputDevice> output);
 
 protected:
   void process();
@@ -11,6 +11,12 @@
 
 #include <QDebug>
 
+#include <algorithm>
+#include <cstring>
+
+// how many frames are mixed ahead of playout
+const uint32_t MIXED_FRAMES = 2;
+
 AudioOutputDevice::AudioOutputDevice(StatisticsInterface *stats):
   QIODevice(),
   stats_(stats),
@@ -18,23 +24,26 @@ AudioOutputDevice::AudioOutputDevice(StatisticsInterface *stats):
   audioOutput_(nullptr),
   output_(nullptr),
   format_(),
-  sampleMutex_(),
-  outputSample_(nullptr),
+  frameDuration_(DEFAULT_AUDIO_FRAME_DURATION),
+  mixer_(stats),
+  mixFormat_(),
+  resampler_(nullptr),
+  mixFrame_(),
+  resampled_(),
+  mixedFrames_(nullptr),
+  freeFrames_(nullptr),
   sampleSize_(0),
-  inputs_(0),
-  mixedSample_(false),
-  outputRepeats_(0)
+  playing_(nullptr),
+  playedBytes_(0),
+  mixingThread_(this),
+  mixing_(false),
+  underruns_(0)
 {}
 
 
 AudioOutputDevice::~AudioOutputDevice()
 {
-  if (outputSample_ != nullptr)
-  {
-    delete outputSample_;
-    outputSample_ = nullptr;
-    sampleSize_ = 0;
-  }
+  stopMixing();
 }
 
 
@@ -47,10 +56,14 @@ void AudioOutputDevice::updateSettings()
 }
 
 
-void AudioOutputDevice::init(QAudioFormat format,
+void AudioOutputDevice::init(QAudioFormat format, uint16_t frameDuration,
                              std::shared_ptr<AECProcessor> AEC)
 {
+  // the mixing thread uses the AEC
+  stopMixing();
+
   aec_ = AEC;
+  frameDuration_ = frameDuration;
 
   QAudioDeviceInfo info(device_);
   if (!info.isFormatSupported(format)) {
@@ -63,6 +76,40 @@ void AudioOutputDevice::init(QAudioFormat format,
     format_ = format;
   }
 
+  // only the sample rate is converted for the device
+  if (format_.channelCount() != format.channelCount() ||
+      format_.sampleSize() != format.sampleSize())
+  {
+    printWarning(this, "Audio output device does not support our channels or sample size.");
+    mixFormat_ = format_;
+  }
+  else
+  {
+    mixFormat_ = format;
+  }
+
+  mixer_.init(mixFormat_, frameDuration_);
+  mixFrame_.resize(mixer_.frameSamples());
+  resampled_.clear();
+
+  if (format_.sampleRate() != mixFormat_.sampleRate())
+  {
+    printNormal(this, "Resampling audio output for the device", "Rates",
+                QString::number(mixFormat_.sampleRate()) + " -> " +
+                QString::number(format_.sampleRate()));
+
+    resampler_ = std::make_unique<Resampler>(mixFormat_.sampleRate(), format_.sampleRate(),
+                                             format_.channelCount());
+
+    // one device frame and the output of one mixed frame, with some slack
+    resampled_.reserve(2*(format_.sampleRate() + mixFormat_.sampleRate())*
+                       format_.channelCount()*frameDuration_/1000);
+  }
+  else
+  {
+    resampler_ = nullptr;
+  }
+
   createAudioOutput();
 }
 
@@ -72,26 +119,120 @@ void AudioOutputDevice::createAudioOutput()
   if (!aec_)
   {
     printProgramError(this, "AEC not set");
+    return;
   }
 
+  stopMixing();
+
   if(audioOutput_)
   {
     delete audioOutput_;
   }
   audioOutput_ = new QAudioOutput(device_, format_, this);
 
-  if (outputSample_ != nullptr)
+  sampleSize_ = format_.sampleRate()*format_.bytesPerFrame()*frameDuration_/1000;
+
+  mixedFrames_ = std::make_unique<SPSCQueue<std::vector<int16_t>>>(MIXED_FRAMES);
+  freeFrames_ = std::make_unique<SPSCQueue<std::vector<int16_t>>>(MIXED_FRAMES);
+  playing_ = nullptr;
+  playedBytes_ = 0;
+
+  for (uint32_t i = 0; i < MIXED_FRAMES; ++i)
   {
-    delete outputSample_;
-    sampleSize_ = 0;
+    auto frame = std::make_unique<std::vector<int16_t>>(sampleSize_/sizeof(int16_t));
+    freeFrames_->push(frame);
   }
 
-  sampleSize_ = format_.sampleRate()*format_.bytesPerFrame()/AUDIO_FRAMES_PER_SECOND;
-  outputSample_ = aec_->createEmptyFrame(sampleSize_);
+  startMixing();
 
-  open(QIODevice::ReadOnly);
+  if (!isOpen())
+  {
+    open(QIODevice::ReadOnly);
+  }
   // pull mode
   audioOutput_->start(this);
+
+  // a read may span frames, but only the mixed ones are ready
+  if (audioOutput_->periodSize() > (int)(MIXED_FRAMES*sampleSize_))
+  {
+    printWarning(this, "The audio Frame size is too small. "
+                       "Buffer output underflow.", {"PeriodSize vs frame size"}, {
+                   QString::number(audioOutput_->periodSize()) + " vs " +
+                   QString::number(sampleSize_)});
+  }
+}
+
+
+void AudioOutputDevice::startMixing()
+{
+  mixing_ = true;
+  mixingThread_.start(QThread::HighestPriority);
+}
+
+
+void AudioOutputDevice::stopMixing()
+{
+  mixing_ = false;
+  mixingThread_.wait();
+}
+
+
+void AudioOutputDevice::mixAhead()
+{
+  // checking a few times per frame is enough since we are ahead of playout
+  unsigned long interval = frameDuration_*1000/4; // us
+
+  while (mixing_)
+  {
+    std::unique_ptr<std::vector<int16_t>> frame = freeFrames_->pop();
+    if (frame)
+    {
+      if (resampler_)
+      {
+        mixResampled(*frame);
+      }
+      else
+      {
+        mixer_.mixFrame(frame->data());
+
+        // The echo reaches the AEC a little before it is played, which is
+        // well within its filter length.
+        aec_->processEchoFrame((uint8_t*)frame->data(), sampleSize_);
+      }
+
+      // there are only as many frames as the queue has room for
+      mixedFrames_->push(frame);
+    }
+    else
+    {
+      QThread::usleep(interval);
+    }
+
+    uint32_t underruns = underruns_.exchange(0);
+    if (underruns > 0)
+    {
+      printWarning(this, "Audio output ran out of mixed frames.",
+                   "Silent frames", QString::number(underruns));
+    }
+  }
+}
+
+
+void AudioOutputDevice::mixResampled(std::vector<int16_t>& frame)
+{
+  // the resampler does not give whole frames, so the rest waits for the next
+  while (resampled_.size() < frame.size())
+  {
+    mixer_.mixFrame(mixFrame_.data());
+
+    // the AEC works at the same rate as the microphone
+    aec_->processEchoFrame((uint8_t*)mixFrame_.data(), mixFrame_.size()*sizeof(int16_t));
+
+    resampler_->process(mixFrame_.data(), mixFrame_.size(), resampled_);
+  }
+
+  std::copy(resampled_.begin(), resampled_.begin() + frame.size(), frame.begin());
+  resampled_.erase(resampled_.begin(), resampled_.begin() + frame.size());
 }
 
 
@@ -115,58 +256,37 @@ void AudioOutputDevice::volumeChanged(int value)
 
 qint64 AudioOutputDevice::readData(char *data, qint64 maxlen)
 {
-  uint32_t read = 0;
-  if (maxlen < sampleSize_)
+  qint64 read = 0;
+  while (read < maxlen)
   {
-    printWarning(this, "Read too little audio data.", {"Read vs available"}, {
-                   QString::number(maxlen) + " vs " + QString::number(sampleSize_)});
-  }
-  else
-  {
-    if (audioOutput_->periodSize() > sampleSize_)
+    if (!playing_)
     {
-      printWarning(this, "The audio Frame size is too small. "
-                         "Buffer output underflow.", {"PeriodSize vs frame size"}, {
-                     QString::number(audioOutput_->periodSize()) + " vs " +
-                     QString::number(sampleSize_)});
-    }
+      playing_ = mixedFrames_->pop();
+      playedBytes_ = 0;
 
-    if (!aec_)
-    {
-      printProgramError(this, "AEC not set");
-    }
-
-    // if no new input has arrived, we play the last sample
-    sampleMutex_.lock();
-
-    // we keep track if this is a repeat so we can change it to silence.
-    if (!mixedSample_)
-    {
-      ++outputRepeats_;
-    }
-    else
-    {
-      mixedSample_ = false;
-    }
-
-    // start playing silence if we played last frame three times.
-    if (outputRepeats_ == 3)
-    {
-      if (outputSample_ != nullptr)
+      if (!playing_)
       {
-        delete[] outputSample_;
+        if (read == 0)
+        {
+          // waiting for the mixing would only make the break longer
+          read = std::min<qint64>(maxlen, sampleSize_);
+          memset(data, 0, read);
+          ++underruns_;
+        }
+        return read;
       }
-
-      outputSample_ = aec_->createEmptyFrame(sampleSize_);
     }
 
-    // send sample to AEC
-    aec_->processEchoFrame(outputSample_, sampleSize_);
+    // send sample to speakers, continuing the frame of the previous read
+    uint32_t length = std::min<qint64>(maxlen - read, sampleSize_ - playedBytes_);
+    memcpy(data + read, (char*)playing_->data() + playedBytes_, length);
+    read += length;
+    playedBytes_ += length;
 
-    // send sample to speakers
-    memcpy(data, outputSample_, sampleSize_);
-    read = sampleSize_;
-    sampleMutex_.unlock();
+    if (playedBytes_ == sampleSize_)
+    {
+      freeFrames_->push(playing_);
+    }
   }
   return read;
 }
@@ -190,6 +310,18 @@ qint64 AudioOutputDevice::bytesAvailable() const
 }
 
 
+void AudioOutputDevice::addInput(uint32_t sessionID, bool opus)
+{
+  mixer_.addInput(sessionID, opus);
+}
+
+
+void AudioOutputDevice::removeInput(uint32_t sessionID)
+{
+  mixer_.removeInput(sessionID);
+}
+
+
 void AudioOutputDevice::takeInput(std::unique_ptr<Data> input, uint32_t sessionID)
 {
   if (audioOutput_ && audioOutput_->state() != QAudio::StoppedState)
@@ -199,117 +331,20 @@ void AudioOutputDevice::takeInput(std::unique_ptr<Data> input, uint32_t sessionI
 
     stats_->receiveDelay(sessionID, "Audio", delay);
 
-    int dataLeft = input->data_size;
-
-    // we record one sample to buffer in case there is a packet loss,
-    // just so we don't have any breaks
-    std::unique_ptr<uchar[]> outputFrame;
-
-    if (inputs_ < 2)
-    {
-      outputFrame = std::move(input->data);
-    }
-    else
-    {
-      outputFrame = mixAudio(std::move(input), sessionID);
-
-      // if we are still waiting for other samples to mix
-      if (outputFrame == nullptr)
-      {
-        return;
-      }
-    }
-
-    sampleMutex_.lock();
-    mixedSample_ = true;
-    outputRepeats_ = 0;
-
-    if (sampleSize_ != dataLeft)
-    {
-      outputSample_ = aec_->createEmptyFrame(dataLeft);
-      sampleSize_ = dataLeft;
-    }
-
-    // I don't like this memcpy, but visual studio had problems with smart pointers.
-    memcpy(outputSample_, outputFrame.get(), sampleSize_);
-    sampleMutex_.unlock();
+    mixer_.inputPacket(sessionID, std::move(input));
   }
 }
 
 
-std::unique_ptr<uchar[]> AudioOutputDevice::mixAudio(std::unique_ptr<Data> input,
-                                                     uint32_t sessionID)
+void AudioOutputDevice::setGain(uint32_t sessionID, float gain)
 {
-  std::unique_ptr<uchar[]> outputFrame = nullptr;
-  mixingMutex_.lock();
-  // mix if there is already a sample for this stream in buffer
-  if (mixingBuffer_.find(sessionID) != mixingBuffer_.end())
-  {
-    printWarning(this, "Mixing overflow. Missing samples.");
-    outputFrame = doMixing(input->data_size);
-    mixingBuffer_[sessionID] = std::move(input);
-  }
-  else
-  {
-    uint32_t size = input->data_size;
-    mixingBuffer_[sessionID] = std::move(input);
-
-    // mix if there is a sample for all streams
-    if (mixingBuffer_.size() == inputs_)
-    {
-      outputFrame = doMixing(size);
-    }
-  }
-
-  mixingMutex_.unlock();
-
-  return outputFrame;
+  mixer_.setGain(sessionID, gain);
 }
 
 
-std::unique_ptr<uchar[]> AudioOutputDevice::doMixing(uint32_t frameSize)
+void AudioOutputDevice::setMuted(uint32_t sessionID, bool muted)
 {
-  // don't do mixing if we have only one stream.
-  if (mixingBuffer_.size() == 1)
-  {
-    std::unique_ptr<uchar[]> oneSample = std::move(mixingBuffer_.begin()->second->data);
-    mixingBuffer_.clear();
-    return oneSample;
-  }
-
-  std::unique_ptr<uchar[]> result = std::unique_ptr<uint8_t[]>(new uint8_t[frameSize]);
-  int16_t * output_ptr = (int16_t*)result.get();
-
-  for (unsigned int i = 0; i < frameSize/2; ++i)
-  {
-    int32_t sum = 0;
-
-    // This is in my understanding the correct way to do audio mixing. Just add them up.
-    for (auto& buffer : mixingBuffer_)
-    {
-      sum += *((int16_t*)buffer.second->data.get() + i);
-    }
-
-    // clipping is not desired, but occurs rarely
-    // TODO: Replace this with dynamic range compression
-    if (sum > INT16_MAX)
-    {
-      printWarning(this, "Clipping audio", "Value", QString::number(sum));
-      sum = INT16_MAX;
-    }
-    else if (sum < INT16_MIN)
-    {
-      printWarning(this, "Boosting audio", "Value", QString::number(sum));
-      sum = INT16_MIN;
-    }
-
-    *output_ptr = sum;
-    ++output_ptr;
-  }
-
-  mixingBuffer_.clear();
-
-  return result;
+  mixer_.setMuted(sessionID, muted);
 }
 
 
@@ -3,16 +3,26 @@
 #include <QAudioOutput>
 #include <QObject>
 #include <QMutex>
+#include <QThread>
+
+#include "audiomixer.h"
+#include "resampler.h"
+#include "spscqueue.h"
 
 #include <stdint.h>
+#include <atomic>
 #include <memory>
+#include <vector>
 
 class Filter;
 class StatisticsInterface;
 class AECProcessor;
 struct Data;
 
-// TODO: There should be an audio buffer with minimum and maximum values so we always have data to send.
+// Plays the mixed received streams. A mixing thread keeps a few frames mixed
+// ahead of playout, so readData only copies a ready frame and never waits
+// for a lock or allocates memory. If the device does not support the call
+// sample rate, the mixing thread also resamples the audio for it.
 
 class AudioOutputDevice : public QIODevice
 {
@@ -23,7 +33,8 @@ public:
 
   void updateSettings();
 
-  void init(QAudioFormat format,
+  // frame duration in ms is how much we play at a time
+  void init(QAudioFormat format, uint16_t frameDuration,
             std::shared_ptr<AECProcessor> AEC);
   void start(); // resume audio output
   void stop(); // suspend audio output
@@ -32,49 +43,80 @@ public:
   qint64 writeData(const char *data, qint64 len) override;
   qint64 bytesAvailable() const override;
 
-  void addInput()
-  {
-    ++inputs_;
-  }
-
-  void removeInput()
-  {
-    --inputs_;
-  }
+  // opus tells whether the stream has to be decoded or is raw audio
+  void addInput(uint32_t sessionID, bool opus);
+  void removeInput(uint32_t sessionID);
 
-  // Receives input from filter graph and tells output that there is input available
+  // Receives input from filter graph to the jitter buffer of its stream
   void takeInput(std::unique_ptr<Data> input, uint32_t sessionID);
 
+  void setGain(uint32_t sessionID, float gain);
+  void setMuted(uint32_t sessionID, bool muted);
+
 private:
 
+  class MixingThread : public QThread
+  {
+  public:
+    MixingThread(AudioOutputDevice* device):
+      device_(device)
+    {}
+
+  protected:
+    void run()
+    {
+      device_->mixAhead();
+    }
+
+  private:
+    AudioOutputDevice* device_;
+  };
+
   void createAudioOutput();
 
-  std::unique_ptr<uchar[]> mixAudio(std::unique_ptr<Data> input, uint32_t sessionID);
+  // the loop of mixing thread
+  void mixAhead();
 
-  std::unique_ptr<uchar[]> doMixing(uint32_t frameSize);
+  // fills a device frame with resampled mixed audio
+  void mixResampled(std::vector<int16_t>& frame);
+
+  void startMixing();
+  void stopMixing();
 
   StatisticsInterface* stats_;
 
   QAudioDeviceInfo device_;
   QAudioOutput *audioOutput_;
   QIODevice *output_; // not owned
-  QAudioFormat format_;
+  QAudioFormat format_; // of the device
+  uint16_t frameDuration_;
+
+  AudioMixer mixer_;
 
-  QMutex mixingMutex_;
-  std::map<uint32_t, std::unique_ptr<Data>> mixingBuffer_;
+  // the mixer and AEC run at the call sample rate
+  QAudioFormat mixFormat_;
+  std::unique_ptr<Resampler> resampler_;
+  std::vector<int16_t> mixFrame_;
+  std::vector<int16_t> resampled_; // not yet played
 
-  QMutex sampleMutex_;
-  // this will have the next played output audio. The same frame is played
-  // if no new frame has been received.
-  uint8_t* outputSample_;
+  // The mixed frames waiting for playout and the played frames waiting to be
+  // mixed again. All frames are allocated before the playout starts.
+  std::unique_ptr<SPSCQueue<std::vector<int16_t>>> mixedFrames_;
+  std::unique_ptr<SPSCQueue<std::vector<int16_t>>> freeFrames_;
   uint32_t sampleSize_;
 
-  unsigned int inputs_;
+  // the mixed frame being played and how much of it has been read, since the
+  // device may read less than a frame at a time
+  std::unique_ptr<std::vector<int16_t>> playing_;
+  uint32_t playedBytes_;
 
-  std::shared_ptr<AECProcessor> aec_;
+  MixingThread mixingThread_;
+  std::atomic<bool> mixing_;
+
+  // reads answered with silence because nothing was mixed in time
+  std::atomic<uint32_t> underruns_;
 
-  bool mixedSample_;
-  unsigned int outputRepeats_;
+  std::shared_ptr<AECProcessor> aec_;
 
 private slots:
   void deviceChanged(int index);
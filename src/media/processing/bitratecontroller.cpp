@@ -0,0 +1,94 @@
+#include "bitratecontroller.h"
+
+#include "common.h"
+
+#include <algorithm>
+
+// Loss limits from Google Congestion Control
+const double HIGH_LOSS = 0.10;
+const double LOW_LOSS = 0.02;
+
+// growth per report when there is no congestion
+const double INCREASE = 1.08;
+
+// decrease when a queue is building up
+const double QUEUE_DECREASE = 0.85;
+
+// how much jitter and rtt (ms) may grow over the base before we react
+const double JITTER_MARGIN = 10;
+const double RTT_MARGIN = 100;
+
+// The base values rise slowly so a permanent change of path is accepted
+const double BASE_DRIFT = 1.02;
+
+// at this point our send buffer can no longer absorb bursts
+const double HIGH_QUEUE = 0.5;
+
+// below this the video is useless anyway
+const uint32_t MIN_BITRATE = 50000;
+
+
+BitrateController::BitrateController():
+  maximum_(0),
+  estimate_(0),
+  jitterBase_(-1),
+  rttBase_(-1)
+{}
+
+
+void BitrateController::setMaximum(uint32_t maximum)
+{
+  if (estimate_ == 0 || estimate_ > maximum)
+  {
+    estimate_ = maximum;
+  }
+  maximum_ = maximum;
+}
+
+
+void BitrateController::receiverReport(double fractionLost, uint32_t jitter, int32_t rtt,
+                                       double queueFill)
+{
+  if (maximum_ == 0)
+  {
+    return;
+  }
+
+  jitterBase_ = jitterBase_ < 0 ? jitter : std::min(jitterBase_*BASE_DRIFT, (double)jitter);
+  bool jitterRising = jitter > 2*jitterBase_ + JITTER_MARGIN;
+
+  bool rttRising = false;
+  if (rtt >= 0)
+  {
+    rttBase_ = rttBase_ < 0 ? rtt : std::min(rttBase_*BASE_DRIFT, (double)rtt);
+    rttRising = rtt > rttBase_ + RTT_MARGIN;
+  }
+
+  uint32_t previous = estimate_;
+  double estimate = estimate_;
+
+  if (fractionLost > HIGH_LOSS)
+  {
+    estimate *= 1 - 0.5*fractionLost;
+  }
+  else if (queueFill > HIGH_QUEUE || jitterRising || rttRising)
+  {
+    estimate *= QUEUE_DECREASE;
+  }
+  else if (fractionLost < LOW_LOSS)
+  {
+    estimate *= INCREASE;
+  }
+
+  estimate_ = std::max(std::min((uint32_t)estimate, maximum_), std::min(MIN_BITRATE, maximum_));
+
+  if (estimate_ != previous)
+  {
+    printDebug(DEBUG_NORMAL, "BitrateController", "Bandwidth estimate updated",
+               {"Estimate", "Loss", "Jitter", "RTT", "Send queue"},
+               {QString::number(estimate_/1000) + " kbit/s",
+                QString::number(fractionLost*100, 'f', 1) + " %",
+                QString::number(jitter) + " ms", QString::number(rtt) + " ms",
+                QString::number(queueFill*100, 'f', 0) + " %"});
+  }
+}
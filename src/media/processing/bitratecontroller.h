@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+
+// Estimates how many bits/s of video a peer can receive. The estimate follows
+// the loss based part of Google Congestion Control: heavy loss decreases the
+// estimate in proportion to the loss, light loss holds it and no loss lets it
+// grow slowly. Growing jitter, round-trip time or local send queue mean that
+// a queue is building up somewhere on the path, so they also decrease the
+// estimate before the loss starts.
+
+class BitrateController
+{
+public:
+  BitrateController();
+
+  // The estimate never exceeds maximum. Starts from maximum.
+  void setMaximum(uint32_t maximum);
+
+  // Update the estimate with one RTCP report block. Jitter and round-trip time
+  // are in milliseconds, rtt is negative if unknown. queueFill is how full our
+  // send buffer is from 0 to 1.
+  void receiverReport(double fractionLost, uint32_t jitter, int32_t rtt, double queueFill);
+
+  // bits/s, 0 if there is no maximum yet
+  uint32_t estimate() const
+  {
+    return estimate_;
+  }
+
+private:
+
+  uint32_t maximum_;
+  uint32_t estimate_;
+
+  // the lowest values seen recently are what the path has without queuing
+  double jitterBase_;
+  double rttBase_;
+};
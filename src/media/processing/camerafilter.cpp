@@ -316,7 +316,7 @@ void CameraFilter::process()
     QVideoFrame cloneFrame(frame);
     cloneFrame.map(QAbstractVideoBuffer::ReadOnly);
 
-    newImage->data = std::unique_ptr<uchar[]>(new uchar[cloneFrame.mappedBytes()]);
+    newImage->data = FrameBuffer(cloneFrame.mappedBytes());
     uchar *bits = cloneFrame.bits();
 
     memcpy(newImage->data.get(), bits, cloneFrame.mappedBytes());
@@ -0,0 +1,226 @@
+#include "decodescheduler.h"
+
+#include "common.h"
+
+#include <QSettings>
+
+#include <algorithm>
+#include <vector>
+
+// used for the streams before their first picture
+const QSize DEFAULT_RESOLUTION = QSize(640, 360);
+
+// Small views still count this much of the video so the decoder keeps up with
+// the stream when the view grows again.
+const double MIN_VIEW_WEIGHT = 0.25;
+
+// views smaller than this only show every other picture
+const int THUMBNAIL_PIXELS = 320*180;
+
+
+DecodeScheduler& DecodeScheduler::instance()
+{
+  static DecodeScheduler scheduler;
+  return scheduler;
+}
+
+
+DecodeScheduler::DecodeScheduler():
+  mutex_(),
+  streams_(),
+  views_(),
+  budget_(1)
+{
+  updateSettings();
+}
+
+
+void DecodeScheduler::updateSettings()
+{
+  QSettings settings("kvazzup.ini", QSettings::IniFormat);
+  int budget = std::max(settings.value("video/OPENHEVC_threads").toInt(), 1);
+
+  mutex_.lock();
+  if (budget != budget_)
+  {
+    budget_ = budget;
+    printDebug(DEBUG_NORMAL, "DecodeScheduler", "Decoder thread budget set",
+               {"Threads"}, {QString::number(budget_)});
+    rebalance();
+  }
+  mutex_.unlock();
+}
+
+
+void DecodeScheduler::addStream(const void* decoder, uint32_t sessionID)
+{
+  mutex_.lock();
+  if (streams_.find(decoder) == streams_.end())
+  {
+    streams_[decoder] = {sessionID, QSize(), 1};
+    rebalance();
+  }
+  mutex_.unlock();
+}
+
+
+void DecodeScheduler::removeStream(const void* decoder)
+{
+  mutex_.lock();
+  if (streams_.erase(decoder) != 0)
+  {
+    rebalance();
+  }
+  mutex_.unlock();
+}
+
+
+void DecodeScheduler::setResolution(const void* decoder, QSize resolution)
+{
+  mutex_.lock();
+  auto stream = streams_.find(decoder);
+  if (stream != streams_.end() && stream->second.resolution != resolution)
+  {
+    stream->second.resolution = resolution;
+    rebalance();
+  }
+  mutex_.unlock();
+}
+
+
+void DecodeScheduler::setViewSize(uint32_t sessionID, QSize size)
+{
+  mutex_.lock();
+  auto view = views_.find(sessionID);
+  if (view == views_.end() || view->second != size)
+  {
+    views_[sessionID] = size;
+    rebalance();
+  }
+  mutex_.unlock();
+}
+
+
+void DecodeScheduler::removeView(uint32_t sessionID)
+{
+  mutex_.lock();
+  if (views_.erase(sessionID) != 0)
+  {
+    rebalance();
+  }
+  mutex_.unlock();
+}
+
+
+unsigned int DecodeScheduler::pictureInterval(uint32_t sessionID)
+{
+  unsigned int interval = 1;
+  mutex_.lock();
+  auto view = views_.find(sessionID);
+  if (view != views_.end())
+  {
+    if (view->second.isEmpty())
+    {
+      interval = 0;
+    }
+    else if (view->second.width()*view->second.height() < THUMBNAIL_PIXELS)
+    {
+      interval = 2;
+    }
+  }
+  mutex_.unlock();
+  return interval;
+}
+
+
+int DecodeScheduler::threads(const void* decoder)
+{
+  int threads = 1;
+  mutex_.lock();
+  auto stream = streams_.find(decoder);
+  if (stream != streams_.end())
+  {
+    threads = stream->second.threads;
+  }
+  mutex_.unlock();
+  return threads;
+}
+
+
+double DecodeScheduler::weight(const Stream& stream) const
+{
+  QSize resolution = stream.resolution.isValid() ? stream.resolution : DEFAULT_RESOLUTION;
+  double pixels = resolution.width()*resolution.height();
+
+  auto view = views_.find(stream.sessionID);
+  if (view != views_.end())
+  {
+    double viewPixels = view->second.isEmpty() ? 0 : view->second.width()*view->second.height();
+    pixels = std::min(pixels, std::max(viewPixels, pixels*MIN_VIEW_WEIGHT));
+  }
+
+  return pixels;
+}
+
+
+void DecodeScheduler::rebalance()
+{
+  if (streams_.empty())
+  {
+    return;
+  }
+
+  // everyone needs at least one thread, the rest are divided by weight
+  int extra = std::max(budget_ - (int)streams_.size(), 0);
+
+  double totalWeight = 0;
+  std::vector<int> previous;
+  for (auto& stream : streams_)
+  {
+    totalWeight += weight(stream.second);
+    previous.push_back(stream.second.threads);
+  }
+
+  // largest remainders get the threads left over from rounding down
+  std::vector<std::pair<double, Stream*>> remainders;
+  int given = 0;
+
+  for (auto& stream : streams_)
+  {
+    double share = totalWeight > 0 ? extra*weight(stream.second)/totalWeight : 0;
+    stream.second.threads = 1 + (int)share;
+    given += (int)share;
+    remainders.push_back({share - (int)share, &stream.second});
+  }
+
+  std::sort(remainders.begin(), remainders.end(),
+            [](const std::pair<double, Stream*>& a, const std::pair<double, Stream*>& b)
+  {
+    return a.first > b.first;
+  });
+
+  for (unsigned int i = 0; i < remainders.size() && given < extra; ++i, ++given)
+  {
+    ++remainders.at(i).second->threads;
+  }
+
+  QStringList names;
+  QStringList values;
+  bool changed = false;
+  unsigned int index = 0;
+  for (auto& stream : streams_)
+  {
+    names.push_back("Session " + QString::number(stream.second.sessionID));
+    values.push_back(QString::number(stream.second.threads));
+    changed = changed || previous.at(index) != stream.second.threads;
+    ++index;
+  }
+
+  // views are resized often
+  if (!changed)
+  {
+    return;
+  }
+
+  printDebug(DEBUG_NORMAL, "DecodeScheduler", "Divided decoder threads", names, values);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <QMutex>
+#include <QSize>
+
+#include <cstdint>
+#include <map>
+
+// Divides the decoder threads between all received videos. Each decoder would
+// otherwise start the configured number of threads, so a call with many
+// participants would have many times more decoding threads than cores, leaving
+// nothing for the encoder. Every stream gets at least one thread and the rest
+// of the budget is divided by how many pixels the stream needs decoded.
+// A large video shown in a small view does not need as much. The views also
+// tell the decoders whether their pictures are shown at all.
+
+class DecodeScheduler
+{
+public:
+  // The scheduler shared by all decoders
+  static DecodeScheduler& instance();
+
+  // reads the thread budget from settings
+  void updateSettings();
+
+  // a decoder is identified by its address, one session may have many
+  void addStream(const void* decoder, uint32_t sessionID);
+  void removeStream(const void* decoder);
+
+  // resolution of the decoded pictures
+  void setResolution(const void* decoder, QSize resolution);
+
+  // Size of the view showing the video of this session. Empty if the video
+  // is not visible.
+  void setViewSize(uint32_t sessionID, QSize size);
+
+  // the view has been closed, its size is unknown again
+  void removeView(uint32_t sessionID);
+
+  // How many of the decoded pictures the view needs: 0 for none, 1 for all
+  // and n for every nth. Every picture is needed until we know the view.
+  unsigned int pictureInterval(uint32_t sessionID);
+
+  // How many threads the decoder should use. Changes when the streams or
+  // their sizes change.
+  int threads(const void* decoder);
+
+private:
+  DecodeScheduler();
+
+  // divides the budget again
+  void rebalance();
+
+  struct Stream
+  {
+    uint32_t sessionID;
+    QSize resolution;
+    int threads;
+  };
+
+  // pixels of this stream we actually need
+  double weight(const Stream& stream) const;
+
+  QMutex mutex_;
+
+  std::map<const void*, Stream> streams_;
+
+  // known before the decoder has been created
+  std::map<uint32_t, QSize> views_;
+
+  int budget_;
+};
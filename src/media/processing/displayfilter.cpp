@@ -4,6 +4,7 @@
 #include "statisticsinterface.h"
 
 #include "common.h"
+#include "global.h"
 
 #include <QImage>
 #include <QtDebug>
@@ -16,7 +17,10 @@ DisplayFilter::DisplayFilter(QString id, StatisticsInterface *stats,
   horizontalMirroring_(false),
   verticalMirroring_(false),
   widget_(widget),
-  sessionID_(sessionID)
+  sessionID_(sessionID),
+  rtpTimestampValid_(false),
+  lastRtpTimestamp_(0),
+  extendedRtpTimestamp_(0)
 {
   if (widget != nullptr)
   {
@@ -58,11 +62,32 @@ void DisplayFilter::updateSettings()
 }
 
 
-void DisplayFilter::process()
+int64_t DisplayFilter::mediaTime(const Data* input)
 {
-  // TODO: The display should try to mimic the framerate if possible,
-  // without adding too much latency
+  if (input->source != REMOTE)
+  {
+    return input->presentationTime;
+  }
 
+  if (!rtpTimestampValid_)
+  {
+    extendedRtpTimestamp_ = input->rtpTimestamp;
+    rtpTimestampValid_ = true;
+  }
+  else
+  {
+    // the signed difference survives the wraparound
+    extendedRtpTimestamp_ += (int32_t)(input->rtpTimestamp - lastRtpTimestamp_);
+  }
+  lastRtpTimestamp_ = input->rtpTimestamp;
+
+  return extendedRtpTimestamp_/(VIDEO_CLOCK_RATE/1000);
+}
+
+
+void DisplayFilter::process()
+{
+  // the view paces the frames according to their media time
   std::unique_ptr<Data> input = getInput();
   while(input)
   {
@@ -74,7 +99,8 @@ void DisplayFilter::process()
       format = QImage::Format_RGB32;
       break;
     case YUV420VIDEO:
-      format = QImage::Format_Invalid;
+      // the luma plane, the view finds the chroma planes after it
+      format = QImage::Format_Grayscale8;
       break;
     default:
       printDebug(DEBUG_PROGRAM_ERROR, this, 
@@ -89,16 +115,18 @@ void DisplayFilter::process()
             input->data.get(),
             input->width,
             input->height,
+            input->type == RGB32VIDEO ? input->width*4 : input->width,
             format);
 
-      if(flipEnabled_)
+      // mirroring only works for RGB32, it would lose the chroma of YUV
+      if(flipEnabled_ && input->type == RGB32VIDEO)
       {
         image = image.mirrored(horizontalMirroring_, verticalMirroring_);
       }
 
       int32_t delay = QDateTime::currentMSecsSinceEpoch() - input->presentationTime;
 
-      widget_->inputImage(std::move(input->data),image, input->presentationTime);
+      widget_->inputImage(input->data, image, mediaTime(input.get()));
 
       if( sessionID_ != 1111)
         getStats()->receiveDelay(sessionID_, "Video", delay);
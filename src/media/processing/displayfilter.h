@@ -24,6 +24,11 @@ protected:
 
 private:
 
+  // Milliseconds on the sender's clock when the frame was captured. Received
+  // frames use the RTP timestamp, which tells the source framerate unaffected
+  // by network jitter.
+  int64_t mediaTime(const Data* input);
+
   bool horizontalMirroring_;
   bool verticalMirroring_;
   bool flipEnabled_;
@@ -32,4 +37,9 @@ private:
   VideoInterface* widget_;
 
   uint32_t sessionID_;
+
+  // RTP timestamp extended past its wraparound
+  bool rtpTimestampValid_;
+  uint32_t lastRtpTimestamp_;
+  int64_t extendedRtpTimestamp_;
 };
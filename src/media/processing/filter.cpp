@@ -1,11 +1,20 @@
 #include "filter.h"
 
+#include "filterexecutor.h"
 #include "statisticsinterface.h"
 
 #include "common.h"
 
 #include <QDebug>
 
+#include <algorithm>
+
+// How many times the lock-free consumer checks for input before yielding
+// and finally sleeping. Spinning is cheaper than sleeping when input arrives
+// at a high rate, but wastes CPU otherwise.
+const unsigned int SPIN_ROUNDS = 200;
+const unsigned int YIELD_ROUNDS = 20;
+
 Filter::Filter(QString id, QString name, StatisticsInterface *stats,
                DataType input, DataType output):
   maxBufferSize_(10),
@@ -17,6 +26,15 @@ Filter::Filter(QString id, QString name, StatisticsInterface *stats,
   waitMutex_(new QMutex),
   hasInput_(),
   running_(true),
+  lockFreeBuffer_(nullptr),
+  sleeping_(false),
+  flushBuffer_(false),
+  skipToIntra_(false),
+  executor_(nullptr),
+  scheduled_(false),
+  wakeRequested_(false),
+  traceID_(FrameTracer::instance().addFilter(id == "" ? name : name + " " + id)),
+  sinkTrace_(),
   inputTaken_(0),
   inputDiscarded_(0),
   filterID_(0)
@@ -24,6 +42,11 @@ Filter::Filter(QString id, QString name, StatisticsInterface *stats,
 
 Filter::~Filter()
 {
+  // with executor there is no run() to remove us from statistics
+  if (executor_ && filterID_ != 0)
+  {
+    stats_->removeFilter(filterID_);
+  }
   delete waitMutex_;
 }
 
@@ -43,7 +66,10 @@ bool Filter::init()
 
 void Filter::addOutConnection(std::shared_ptr<Filter> out)
 {
+  // connections may change while we are sending output
+  connectionMutex_.lock();
   outConnections_.push_back(out);
+  connectionMutex_.unlock();
 }
 
 void Filter::removeOutConnection(std::shared_ptr<Filter> out)
@@ -68,8 +94,27 @@ void Filter::removeOutConnection(std::shared_ptr<Filter> out)
   }
 }
 
+void Filter::enableLockFreeBuffer(uint32_t capacity)
+{
+  Q_ASSERT(inBuffer_.empty());
+
+  // the consumer enforces maxBufferSize_, so the producer may get ahead of it
+  if (maxBufferSize_ > 0)
+  {
+    capacity = std::max(capacity, 2*(uint32_t)maxBufferSize_);
+  }
+  lockFreeBuffer_ = std::unique_ptr<SPSCQueue<Data>>(new SPSCQueue<Data>(capacity));
+}
+
+
 void Filter::emptyBuffer()
 {
+  if (lockFreeBuffer_)
+  {
+    flushBuffer_ = true;
+    return;
+  }
+
   bufferMutex_.lock();
   //std::queue<std::unique_ptr<Data>> empty;
   std::deque<std::unique_ptr<Data>> empty;
@@ -77,6 +122,17 @@ void Filter::emptyBuffer()
   bufferMutex_.unlock();
 }
 
+uint32_t Filter::bufferedInputs()
+{
+  if (lockFreeBuffer_)
+  {
+    return lockFreeBuffer_->size();
+  }
+
+  QMutexLocker lock(&bufferMutex_);
+  return inBuffer_.size();
+}
+
 void Filter::putInput(std::unique_ptr<Data> data)
 {
   Q_ASSERT(data);
@@ -89,6 +145,17 @@ void Filter::putInput(std::unique_ptr<Data> data)
     return;
   }
 
+  if (data->trace.frame != 0)
+  {
+    FrameTracer::instance().enqueue(data->trace, traceID_);
+  }
+
+  if (lockFreeBuffer_)
+  {
+    putLockFreeInput(std::move(data));
+    return;
+  }
+
   ++inputTaken_;
 
   bufferMutex_.lock();
@@ -105,11 +172,13 @@ void Filter::putInput(std::unique_ptr<Data> data)
     if(inBuffer_[0]->type == HEVCVIDEO)
     {
       // Search for intra frames and discard everything up to it
+      bool keyframe = false;
       for(uint32_t i = 0; i < inBuffer_.size(); ++i)
       {
         const unsigned char *buff = inBuffer_.at(i)->data.get();
-        if(!isHEVCIntra(buff))
+        if(!isHEVCInter(buff))
         {
+          keyframe = true;
           qDebug() << "Processing," << metaObject()->className() << ": Discarding" << i
                    << "HEVC frames. Found non inter frame from buffer at :" << i;
           for(int j = i; j != 0; --j)
@@ -119,13 +188,16 @@ void Filter::putInput(std::unique_ptr<Data> data)
           break;
         }
       }
+
+      // without a keyframe the frames after the gap refer to the discarded ones
+      if(!keyframe)
+      {
+        emit keyframeNeeded();
+      }
     }
     else
     {
-      if(inBuffer_[0]->type == OPUSAUDIO)
-      {
-        printDebug(DEBUG_WARNING, this,  "Should input Null pointer to decoder.");
-      }
+      // the audio jitter buffer conceals the missing packet
       inBuffer_.pop_front(); // discard the oldest
     }
 
@@ -142,47 +214,270 @@ void Filter::putInput(std::unique_ptr<Data> data)
   bufferMutex_.unlock();
 }
 
+void Filter::putLockFreeInput(std::unique_ptr<Data> data)
+{
+  ++inputTaken_;
+
+  if(inputTaken_%30 == 0)
+  {
+    stats_->updateBufferStatus(filterID_, lockFreeBuffer_->size(), maxBufferSize_);
+  }
+
+  // the frames after a dropped one refer to it
+  if (skipToIntra_)
+  {
+    if (data->type == HEVCVIDEO && isHEVCInter(data->data.get()))
+    {
+      ++inputDiscarded_;
+      stats_->packetDropped(filterID_);
+      return;
+    }
+    skipToIntra_ = false;
+  }
+
+  // The buffer size limit is enforced by the consumer, because only it can
+  // remove items. This only happens if the consumer is not taking input at all.
+  if (!lockFreeBuffer_->push(data))
+  {
+    ++inputDiscarded_;
+    stats_->packetDropped(filterID_);
+    if(inputDiscarded_ == 1 || inputDiscarded_%10 == 0)
+    {
+      qDebug() << "Processing," << name_ << "lock-free buffer full. Discarded input:"
+               << inputDiscarded_  << "Total input:" << inputTaken_;
+    }
+
+    if (data->type == HEVCVIDEO)
+    {
+      skipToIntra_ = true;
+      emit keyframeNeeded();
+    }
+    return;
+  }
+
+  // only bother with the mutex if the consumer is actually sleeping
+  if (executor_ || sleeping_)
+  {
+    wakeUp();
+  }
+}
+
+
+std::unique_ptr<Data> Filter::getLockFreeInput()
+{
+  if (flushBuffer_)
+  {
+    flushBuffer_ = false;
+    while (lockFreeBuffer_->pop());
+  }
+
+  if(maxBufferSize_ != -1 && lockFreeBuffer_->size() > (uint32_t)maxBufferSize_)
+  {
+    discardLockFreeInput();
+  }
+
+  return lockFreeBuffer_->pop();
+}
+
+
+void Filter::discardLockFreeInput()
+{
+  uint32_t discard = 1;
+
+  if (lockFreeBuffer_->peek(0)->type == HEVCVIDEO)
+  {
+    // Skip to the next intra frame so the decoder does not receive
+    // frames it cannot decode. If there is none, discard the oldest.
+    bool keyframe = false;
+    for(uint32_t i = 1; lockFreeBuffer_->peek(i) != nullptr; ++i)
+    {
+      if(!isHEVCInter(lockFreeBuffer_->peek(i)->data.get()))
+      {
+        keyframe = true;
+        discard = i;
+        qDebug() << "Processing," << metaObject()->className() << ": Discarding" << i
+                 << "HEVC frames. Found intra frame from buffer at :" << i;
+        break;
+      }
+    }
+
+    // without a keyframe the frames after the gap refer to the discarded ones
+    if(!keyframe)
+    {
+      emit keyframeNeeded();
+    }
+  }
+
+  for (uint32_t i = 0; i < discard; ++i)
+  {
+    lockFreeBuffer_->pop();
+  }
+
+  ++inputDiscarded_;
+  stats_->packetDropped(filterID_);
+  if(inputDiscarded_ == 1 || inputDiscarded_%10 == 0)
+  {
+    qDebug() << "Processing," << name_ << "buffer full. Discarded input:"
+             << inputDiscarded_  << "Total input:" << inputTaken_;
+  }
+}
+
+
+void Filter::waitForLockFreeInput()
+{
+  for (unsigned int i = 0; i < SPIN_ROUNDS + YIELD_ROUNDS; ++i)
+  {
+    if (!lockFreeBuffer_->empty() || !running_)
+    {
+      return;
+    }
+
+    if (i >= SPIN_ROUNDS)
+    {
+      QThread::yieldCurrentThread();
+    }
+  }
+
+  // The producer checks sleeping_ after pushing and we check the buffer after
+  // setting sleeping_, so either we see the input or the producer wakes us.
+  waitMutex_->lock();
+  sleeping_ = true;
+  if (lockFreeBuffer_->empty() && running_)
+  {
+    hasInput_.wait(waitMutex_);
+  }
+  sleeping_ = false;
+  waitMutex_->unlock();
+}
+
+
 std::unique_ptr<Data> Filter::getInput()
 {
-  bufferMutex_.lock();
+  // a sink is done with the previous frame when it asks for the next one
+  finishTrace();
+
   std::unique_ptr<Data> r;
-  if(!inBuffer_.empty())
+  if (lockFreeBuffer_)
   {
-    r = std::move(inBuffer_.front());
-    inBuffer_.pop_front();
+    r = getLockFreeInput();
+  }
+  else
+  {
+    bufferMutex_.lock();
+    if(!inBuffer_.empty())
+    {
+      r = std::move(inBuffer_.front());
+      inBuffer_.pop_front();
+    }
+    bufferMutex_.unlock();
+  }
+
+  if (r && r->trace.frame != 0)
+  {
+    FrameTracer::instance().dequeue(r->trace, traceID_);
+
+    if (output_ == NONE)
+    {
+      sinkTrace_ = r->trace;
+    }
   }
-  bufferMutex_.unlock();
   return r;
 }
 
+
+void Filter::finishTrace()
+{
+  if (sinkTrace_.frame != 0)
+  {
+    FrameTracer::instance().finish(sinkTrace_, traceID_);
+    FrameTracer::instance().complete(sinkTrace_);
+    sinkTrace_.frame = 0;
+  }
+}
+
+FrameBuffer Filter::allocateInput(uint32_t size, int16_t width, int16_t height)
+{
+  Q_UNUSED(width);
+  Q_UNUSED(height);
+  return FrameBuffer(size);
+}
+
+
+FrameBuffer Filter::allocateOutput(uint32_t size, int16_t width, int16_t height)
+{
+  FrameBuffer buffer;
+  connectionMutex_.lock();
+  if (outConnections_.size() == 1)
+  {
+    buffer = outConnections_.front()->allocateInput(size, width, height);
+  }
+  else
+  {
+    buffer = FrameBuffer(size);
+  }
+  connectionMutex_.unlock();
+  return buffer;
+}
+
+
 void Filter::sendOutput(std::unique_ptr<Data> output)
 {
   Q_ASSERT(output);
 
+  connectionMutex_.lock();
+
   if(outDataCallbacks_.size() == 0 && outConnections_.size() == 0)
   {
+    connectionMutex_.unlock();
     printDebug(DEBUG_WARNING, this, 
                "Trying to send output data without outconnections.");
     return;
   }
 
-  connectionMutex_.lock();
-  // copy data to callbacks expect the last one is moved
+  if (output->trace.frame != 0)
+  {
+    FrameTracer::instance().finish(output->trace, traceID_);
+
+    // callbacks take the frame out of filter graph
+    if (outConnections_.size() == 0)
+    {
+      FrameTracer::instance().complete(output->trace);
+    }
+  }
+  else if (input_ == NONE && FrameTracer::instance().enabled())
+  {
+    FrameTracer::instance().begin(output->trace, traceID_);
+  }
+
+  if (output->planes[0] != nullptr)
+  {
+    for (auto& out : outConnections_)
+    {
+      if (!out->stridedInput())
+      {
+        packPlanes(output.get());
+        break;
+      }
+    }
+  }
+
+  // share data with callbacks expect the last one is moved
   // in either callbacks or outconnections(default).
+  // The frame buffer is reference counted so sharing does not copy the data.
   if(outDataCallbacks_.size() != 0)
   {
     // all expect the last
     for(unsigned int i = 0; i < outDataCallbacks_.size() - 1; ++i)
     {
-      Data* copy = deepDataCopy(output.get());
+      Data* copy = sharedDataCopy(output.get());
       std::unique_ptr<Data> u_copy(copy);
       outDataCallbacks_[i](std::move(u_copy));
     }
 
-    // copy last callback and move last connection
+    // share last callback and move last connection
     if(outConnections_.size() != 0)
     {
-      Data* copy = deepDataCopy(output.get());
+      Data* copy = sharedDataCopy(output.get());
       std::unique_ptr<Data> u_copy(copy);
       outDataCallbacks_.back()(std::move(u_copy));
     }
@@ -198,7 +493,7 @@ void Filter::sendOutput(std::unique_ptr<Data> output)
     // all expect the last
     for(unsigned int i = 0; i < outConnections_.size() - 1; ++i)
     {
-      Data* copy = deepDataCopy(output.get());
+      Data* copy = sharedDataCopy(output.get());
       std::unique_ptr<Data> u_copy(copy);
       outConnections_[i]->putInput(std::move(u_copy));
     }
@@ -211,7 +506,9 @@ void Filter::sendOutput(std::unique_ptr<Data> output)
 void Filter::stop()
 {
   running_ = false;
+  waitMutex_->lock();
   hasInput_.wakeAll();
+  waitMutex_->unlock();
 }
 
 void Filter::run()
@@ -219,10 +516,18 @@ void Filter::run()
   filterID_ = stats_->addFilter(name_, id_, (uint64_t)currentThreadId());
   while(running_)
   {
-    waitForInput();
+    if (lockFreeBuffer_)
+    {
+      waitForLockFreeInput();
+    }
+    else
+    {
+      waitForInput();
+    }
     if(!running_) break;
 
     process();
+    finishTrace();
   }
   if (filterID_ != 0)
   {
@@ -231,6 +536,51 @@ void Filter::run()
   }
 }
 
+void Filter::startScheduled()
+{
+  if (filterID_ == 0)
+  {
+    // the filter does not have a thread of its own
+    filterID_ = stats_->addFilter(name_, id_, 0);
+  }
+
+  // process anything that arrived while we were stopped
+  scheduleProcessing();
+}
+
+
+void Filter::scheduleProcessing()
+{
+  wakeRequested_ = true;
+
+  // only one worker may process this filter at a time
+  if (running_ && !scheduled_.exchange(true))
+  {
+    executor_->schedule(shared_from_this());
+  }
+}
+
+
+void Filter::runScheduled()
+{
+  wakeRequested_ = false;
+
+  if (running_)
+  {
+    process();
+    finishTrace();
+  }
+
+  scheduled_ = false;
+
+  // input may have arrived after process had already emptied the buffer
+  if (wakeRequested_ && running_)
+  {
+    scheduleProcessing();
+  }
+}
+
+
 Data* Filter::shallowDataCopy(Data* original)
 {
   if(original != nullptr)
@@ -241,7 +591,10 @@ Data* Filter::shallowDataCopy(Data* original)
     copy->height = original->height;
     copy->source = original->source;
     copy->presentationTime = original->presentationTime;
+    copy->rtpTimestamp = original->rtpTimestamp;
+    copy->rtpSequence = original->rtpSequence;
     copy->framerate = original->framerate;
+    copy->trace = original->trace;
     copy->data_size = 0; // no data in shallow copy
 
     return copy;
@@ -255,8 +608,15 @@ Data* Filter::deepDataCopy(Data* original)
 {
   if(original != nullptr)
   {
+    if (original->planes[0] != nullptr)
+    {
+      Data* copy = sharedDataCopy(original);
+      packPlanes(copy);
+      return copy;
+    }
+
     Data* copy = shallowDataCopy(original);
-    copy->data = std::unique_ptr<uchar[]>(new uchar[original->data_size]);
+    copy->data = FrameBuffer(original->data_size);
     memcpy(copy->data.get(), original->data.get(), original->data_size);
     copy->data_size = original->data_size;
 
@@ -268,21 +628,76 @@ Data* Filter::deepDataCopy(Data* original)
 }
 
 
+Data* Filter::sharedDataCopy(Data* original)
+{
+  if(original != nullptr)
+  {
+    Data* copy = shallowDataCopy(original);
+    copy->data = original->data;
+    copy->data_size = original->data_size;
+
+    for (int i = 0; i < 3; ++i)
+    {
+      copy->planes[i] = original->planes[i];
+      copy->strides[i] = original->strides[i];
+    }
+
+    return copy;
+  }
+  printDebug(DEBUG_WARNING, this,
+             "Trying to copy nullptr Data pointer.");
+  return nullptr;
+}
+
+
+void Filter::packPlanes(Data* data)
+{
+  if (data->planes[0] == nullptr)
+  {
+    return;
+  }
+
+  uint32_t lumaSize = data->width*data->height;
+  FrameBuffer packed(lumaSize + lumaSize/2);
+  uint8_t* out = packed.get();
+
+  for (int i = 0; i < 3; ++i)
+  {
+    int width = i == 0 ? data->width : data->width/2;
+    int height = i == 0 ? data->height : data->height/2;
+
+    for (int row = 0; row < height; ++row)
+    {
+      memcpy(out, data->planes[i] + row*data->strides[i], width);
+      out += width;
+    }
+
+    data->planes[i] = nullptr;
+    data->strides[i] = 0;
+  }
+
+  data->data = std::move(packed);
+  data->data_size = lumaSize + lumaSize/2;
+}
+
+
 QString Filter::printOutputs()
 {
   QString outs = "";
 
+  connectionMutex_.lock();
   for(auto& out : outConnections_)
   {
     outs += "   \"" + name_ + "\" -> \"" + out->name_ + "\";" + "\r\n";
   }
+  connectionMutex_.unlock();
 
   outs += "plus " + QString::number(outDataCallbacks_.size()) + " callbacks";
   return outs;
 }
 
 
-bool Filter::isHEVCIntra(const unsigned char *buff)
+bool Filter::isHEVCInter(const unsigned char *buff)
 {
   return (buff[0] == 0 &&
       buff[1] == 0 &&
@@ -4,12 +4,17 @@
 #include <QThread>
 #include <QMutex>
 
+#include "framepool.h"
+#include "frametracer.h"
+#include "spscqueue.h"
+
 #ifndef _MSC_VER
 #include <sys/time.h>
 #else
 #include <WinSock2.h>
 #endif
 
+#include <atomic>
 #include <cstdint>
 #include <vector>
 #include <queue>
@@ -28,20 +33,39 @@ enum DataSource {UNKNOWN, LOCAL, REMOTE};
 struct Data
 {
   uint8_t type;
-  std::unique_ptr<uchar[]> data;
+
+  // Shared between filters when the same frame is sent to multiple outputs.
+  // Use makeWritable before modifying the data in place.
+  FrameBuffer data;
   uint32_t data_size;
   int16_t width;
   int16_t height;
   int64_t presentationTime;
 
+  // timestamp and sequence number from the RTP header of received media,
+  // 0 for local media
+  uint32_t rtpTimestamp = 0;
+  uint16_t rtpSequence = 0;
+
+  // YUV420 planes that are not packed one after another in data, for example
+  // a picture lent by the decoder. data still holds the reference to them,
+  // and the lender may not produce its next picture before it is released.
+  // nullptr if data is packed.
+  uint8_t* planes[3] = {};
+  uint32_t strides[3] = {};
+
   uint16_t framerate;
 
   DataSource source;
+
+  // per filter timestamps of this frame, only used if tracing is enabled
+  FrameTrace trace;
 };
 
 class StatisticsInterface;
+class FilterExecutor;
 
-class Filter : public QThread
+class Filter : public QThread, public std::enable_shared_from_this<Filter>
 {
   Q_OBJECT
 
@@ -59,7 +83,7 @@ public:
   void removeOutConnection(std::shared_ptr<Filter> out);
 
   // callback registeration enables other classes besides Filter
-  // to receive output data
+  // to receive output data. Strided planes are not packed for callbacks.
   template <typename Class>
   void addDataOutCallback (Class* o, void (Class::*method) (std::unique_ptr<Data> data))
   {
@@ -74,6 +98,20 @@ public:
 
   void putInput(std::unique_ptr<Data> data);
 
+  // Called by the previous filter to get a buffer for the data it is going to
+  // send to us. Override to have the previous filter write directly to memory
+  // owned by this filter. Must be thread safe.
+  virtual FrameBuffer allocateInput(uint32_t size, int16_t width, int16_t height);
+
+  // Whether this filter can read YUV420 planes with strides. Otherwise the
+  // planes are packed before they are given to this filter. A filter taking
+  // strided planes must release them as soon as it has processed them and
+  // never buffer them, since the decoder waits for the release.
+  virtual bool stridedInput() const
+  {
+    return false;
+  }
+
   // for debugging filter graphs
   virtual DataType inputType() const
   {
@@ -87,22 +125,57 @@ public:
   virtual void start()
   {
     running_ = true;
-    QThread::start();
+    if (executor_)
+    {
+      startScheduled();
+    }
+    else
+    {
+      QThread::start();
+    }
   }
 
   virtual void stop();
 
+  // Process input with the threads of executor instead of a thread of our own.
+  // Must be set before the filter is started. The filter must be owned by
+  // a shared_ptr.
+  void setExecutor(FilterExecutor* executor)
+  {
+    executor_ = executor;
+  }
+
+  // called by the executor when the filter has been scheduled
+  void runScheduled();
+
+  // With executor, whether the filter is queued or being processed.
+  bool isRunning() const
+  {
+    return executor_ ? scheduled_.load() : QThread::isRunning();
+  }
+
   QString printOutputs();
 
   // helper function for copying Data
   Data* shallowDataCopy(Data* original);
   Data* deepDataCopy(Data* original);
 
+  // copies everything except the data, which is shared with original
+  Data* sharedDataCopy(Data* original);
+
+  // copies strided planes to a packed buffer of our own
+  void packPlanes(Data* data);
+
   QString getName()
   {
     return name_;
   }
 
+signals:
+
+  // HEVC frames were lost and decoding can only continue from an intra frame
+  void keyframeNeeded();
+
 protected:
 
   // return: oldest element in buffer, empty if none found
@@ -111,20 +184,48 @@ protected:
   //sends output to out connections
   void sendOutput(std::unique_ptr<Data> output);
 
+  // Buffer for output data. Allocated by the next filter if there is only one,
+  // otherwise from the frame pool.
+  FrameBuffer allocateOutput(uint32_t size, int16_t width, int16_t height);
+
   // QThread function that runs the processing
   void run();
 
   virtual void process() = 0;
 
-  bool isHEVCIntra(const unsigned char *buff);
+  // true for TRAIL_R NAL units, which are the inter frames we send
+  bool isHEVCInter(const unsigned char *buff);
+
+  // number of inputs waiting to be processed
+  uint32_t bufferedInputs();
 
   void wakeUp()
   {
+    if (executor_)
+    {
+      scheduleProcessing();
+      return;
+    }
+
     waitMutex_->lock();
     hasInput_.wakeOne();
     waitMutex_->unlock();
   }
 
+  // Replaces the mutex protected input buffer with a lock-free ring buffer.
+  // Only use this if there is exactly one filter sending input to this filter.
+  // Must be called before the filter receives any input. The capacity is
+  // raised to twice maxBufferSize_ so the limit is reached before the ring
+  // is full.
+  void enableLockFreeBuffer(uint32_t capacity = 256);
+
+  // 0 if the lock-free buffer is not enabled. maxBufferSize_ must stay
+  // below half of this.
+  uint32_t lockFreeCapacity() const
+  {
+    return lockFreeBuffer_ ? lockFreeBuffer_->capacity() : 0;
+  }
+
   void waitForInput()
   {
     waitMutex_->lock();
@@ -154,7 +255,7 @@ private:
   QMutex *waitMutex_;
   QWaitCondition hasInput_;
 
-  bool running_;
+  std::atomic<bool> running_;
 
   std::vector<std::function<void(std::unique_ptr<Data>)> > outDataCallbacks_;
 
@@ -165,6 +266,48 @@ private:
   //std::queue<std::unique_ptr<Data>> inBuffer_;
   std::deque<std::unique_ptr<Data>> inBuffer_;
 
+  // the lock-free input buffer
+  void putLockFreeInput(std::unique_ptr<Data> data);
+  std::unique_ptr<Data> getLockFreeInput();
+
+  // spins for a while and sleeps if there is still no input
+  void waitForLockFreeInput();
+
+  // drops input from lock-free buffer according to same rules as normal buffer
+  void discardLockFreeInput();
+
+  std::unique_ptr<SPSCQueue<Data>> lockFreeBuffer_;
+
+  // the consumer has gone to sleep and needs to be woken up
+  std::atomic<bool> sleeping_;
+
+  // the lock-free buffer can only be emptied by the filter thread
+  std::atomic<bool> flushBuffer_;
+
+  // A full lock-free buffer dropped HEVC input, so the input is dropped until
+  // the next intra frame. Only used by the producer.
+  bool skipToIntra_;
+
+  // executor mode
+  void startScheduled();
+  void scheduleProcessing();
+
+  FilterExecutor* executor_;
+
+  // the filter is in an executor queue or being processed
+  std::atomic<bool> scheduled_;
+
+  // input arrived after the processing was started
+  std::atomic<bool> wakeRequested_;
+
+  // the filter is done with the frame it took last. Sinks only.
+  void finishTrace();
+
+  uint16_t traceID_;
+
+  // trace of the frame a sink filter is processing
+  FrameTrace sinkTrace_;
+
   unsigned int inputTaken_;
   unsigned int inputDiscarded_;
 
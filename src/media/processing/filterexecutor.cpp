@@ -0,0 +1,157 @@
+#include "filterexecutor.h"
+
+#include "filter.h"
+
+#include "common.h"
+
+
+FilterExecutor::FilterExecutor(unsigned int threads):
+  queues_(),
+  workers_(),
+  running_(true),
+  queued_(0),
+  nextQueue_(0),
+  sleepMutex_(),
+  hasWork_()
+{
+  if (threads == 0)
+  {
+    threads = QThread::idealThreadCount() > 0 ? QThread::idealThreadCount() : 1;
+  }
+
+  for (unsigned int i = 0; i < threads; ++i)
+  {
+    queues_.push_back(std::unique_ptr<TaskQueue>(new TaskQueue));
+  }
+
+  for (unsigned int i = 0; i < threads; ++i)
+  {
+    workers_.push_back(std::unique_ptr<Worker>(new Worker(this, i)));
+    workers_.back()->start(QThread::HighPriority);
+  }
+
+  printDebug(DEBUG_NORMAL, "FilterExecutor", "Started filter worker threads",
+             {"Threads"}, {QString::number(threads)});
+}
+
+
+FilterExecutor::~FilterExecutor()
+{
+  running_ = false;
+
+  sleepMutex_.lock();
+  hasWork_.wakeAll();
+  sleepMutex_.unlock();
+
+  for (auto& worker : workers_)
+  {
+    worker->wait();
+  }
+
+  for (auto& queue : queues_)
+  {
+    queue->mutex.lock();
+    queue->tasks.clear();
+    queue->mutex.unlock();
+  }
+}
+
+
+FilterExecutor& FilterExecutor::instance()
+{
+  static FilterExecutor executor;
+  return executor;
+}
+
+
+void FilterExecutor::schedule(std::weak_ptr<Filter> filter)
+{
+  int worker = currentWorker();
+  unsigned int index = worker >= 0 ? worker : nextQueue_++ % queues_.size();
+
+  queues_[index]->mutex.lock();
+  queues_[index]->tasks.push_back(filter);
+  queues_[index]->mutex.unlock();
+
+  ++queued_;
+
+  sleepMutex_.lock();
+  hasWork_.wakeOne();
+  sleepMutex_.unlock();
+}
+
+
+void FilterExecutor::work(unsigned int index)
+{
+  while (running_)
+  {
+    std::weak_ptr<Filter> task;
+
+    if (takeTask(index, task))
+    {
+      --queued_;
+
+      // the filter may have been destroyed while waiting in queue
+      std::shared_ptr<Filter> filter = task.lock();
+      if (filter)
+      {
+        filter->runScheduled();
+      }
+      continue;
+    }
+
+    // checking the queued count with the mutex held makes sure we
+    // don't miss the wake up from schedule
+    sleepMutex_.lock();
+    if (queued_ == 0 && running_)
+    {
+      hasWork_.wait(&sleepMutex_);
+    }
+    sleepMutex_.unlock();
+  }
+}
+
+
+bool FilterExecutor::takeTask(unsigned int index, std::weak_ptr<Filter>& task)
+{
+  bool found = false;
+
+  TaskQueue* own = queues_[index].get();
+  own->mutex.lock();
+  if (!own->tasks.empty())
+  {
+    task = std::move(own->tasks.back());
+    own->tasks.pop_back();
+    found = true;
+  }
+  own->mutex.unlock();
+
+  for (unsigned int i = 1; !found && i < queues_.size(); ++i)
+  {
+    TaskQueue* victim = queues_[(index + i) % queues_.size()].get();
+    victim->mutex.lock();
+    if (!victim->tasks.empty())
+    {
+      task = std::move(victim->tasks.front());
+      victim->tasks.pop_front();
+      found = true;
+    }
+    victim->mutex.unlock();
+  }
+
+  return found;
+}
+
+
+int FilterExecutor::currentWorker() const
+{
+  QThread* current = QThread::currentThread();
+  for (unsigned int i = 0; i < workers_.size(); ++i)
+  {
+    if (workers_[i].get() == current)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
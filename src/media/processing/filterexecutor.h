@@ -0,0 +1,88 @@
+#pragma once
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+
+// Runs filters as tasks on a fixed number of threads instead of each filter
+// having a thread of its own. A filter is scheduled when it receives input and
+// its process() is then called by one of the workers. Each worker has its own
+// queue and idle workers steal work from the others. Filters scheduled by a
+// worker (the next filter in graph usually) go to the same worker so the data
+// is still in the cache of that core.
+
+class Filter;
+
+class FilterExecutor
+{
+public:
+  // 0 threads means one per core
+  FilterExecutor(unsigned int threads = 0);
+  ~FilterExecutor();
+
+  // The executor shared by all filters. Created with one thread per core
+  // the first time it is used, so it outlives the filters using it.
+  static FilterExecutor& instance();
+
+  // adds filter to the queue of current worker or the next worker.
+  // The queue does not keep the filter alive.
+  void schedule(std::weak_ptr<Filter> filter);
+
+  unsigned int threads() const
+  {
+    return workers_.size();
+  }
+
+private:
+
+  class Worker : public QThread
+  {
+  public:
+    Worker(FilterExecutor* executor, unsigned int index):
+      executor_(executor),
+      index_(index)
+    {}
+
+  protected:
+    void run()
+    {
+      executor_->work(index_);
+    }
+
+  private:
+    FilterExecutor* executor_;
+    unsigned int index_;
+  };
+
+  struct TaskQueue
+  {
+    QMutex mutex;
+    std::deque<std::weak_ptr<Filter>> tasks;
+  };
+
+  // the loop of one worker thread
+  void work(unsigned int index);
+
+  // own queue first, newest first. Then the oldest tasks of other workers.
+  bool takeTask(unsigned int index, std::weak_ptr<Filter>& task);
+
+  // returns the index of worker running this thread or -1 if not a worker
+  int currentWorker() const;
+
+  std::vector<std::unique_ptr<TaskQueue>> queues_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  std::atomic<bool> running_;
+
+  // number of tasks in all queues
+  std::atomic<int> queued_;
+  std::atomic<unsigned int> nextQueue_;
+
+  QMutex sleepMutex_;
+  QWaitCondition hasWork_;
+};
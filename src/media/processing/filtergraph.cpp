@@ -13,40 +13,62 @@
 #include "media/processing/audiocapturefilter.h"
 #include "media/processing/audiooutputdevice.h"
 #include "media/processing/opusencoderfilter.h"
-#include "media/processing/opusdecoderfilter.h"
 #include "media/processing/aecinputfilter.h"
 #include "media/processing/audiomixerfilter.h"
+#include "media/processing/resamplefilter.h"
+#include "media/processing/filterexecutor.h"
+#include "media/processing/frametracer.h"
 
 #include "ui/gui/videointerface.h"
 
 #include "global.h"
 #include "common.h"
 
+#include <QDateTime>
 #include <QSettings>
 
+#include <algorithm>
+#include <cmath>
+
+// Chrome trace-event file of frame traces, open in chrome://tracing
+const QString TRACE_FILE = "kvazzup_trace.json";
+
+// The self view is small so the camera frames are scaled down for it. This
+// is twice the size of the view so the preview stays sharp on HiDPI screens.
+const QSize SELF_VIEW_RESOLUTION = QSize(256, 192);
+
+// Simulcast layers as resolution divider and share of the bitrate in settings.
+// A quarter of the pixels needs roughly a third of the bits.
+const std::vector<std::pair<int, double>> SIMULCAST_LAYERS = {{1, 1.0}, {2, 0.3}, {4, 0.1}};
+
+// A better layer must fit the bandwidth estimate this many times over, so an
+// estimate near a threshold does not move the peer back and forth.
+const double LAYER_UP_HEADROOM = 1.25;
+
+// ms a peer stays on a layer before reports may move it again
+const qint64 LAYER_DWELL_TIME = 5000;
+
 FilterGraph::FilterGraph(): QObject(),
   peers_(),
   cameraGraph_(),
   screenShareGraph_(),
   audioProcessing_(),
+  videoLayers_(),
   selfView_(nullptr),
   stats_(nullptr),
   format_(),
+  audioFrameDuration_(DEFAULT_AUDIO_FRAME_DURATION),
   videoFormat_(""),
   quitting_(false),
+  executor_(nullptr),
   audioOutput_(nullptr)
 {
   // TODO negotiate these values with all included filters and SDP
   // TODO move these to settings and manage them automatically
 
-#ifndef __linux__
-  // 48000 should be used with opus, since opus is able to downsample when needed
+  // 48000 should be used with opus, since opus is able to downsample when needed.
+  // Resamplers are added where a device or raw PCM needs another rate.
   format_.setSampleRate(48000);
-#else
-  // Can be removed once uvgRTP supports pcm sample size 48000 or opus works on
-  // linux
-  format_.setSampleRate(16000);
-#endif
   format_.setChannelCount(1);
   format_.setSampleSize(16);
   format_.setSampleType(QAudioFormat::SignedInt);
@@ -62,6 +84,16 @@ void FilterGraph::init(VideoInterface* selfView, StatisticsInterface* stats)
   stats_ = stats;
   selfView_ = selfView;
 
+  // Filters run as tasks on a thread pool sized to the number of cores instead
+  // of one thread per filter. Takes effect on the next start of Kvazzup.
+  if (settingEnabled("media/filterPool"))
+  {
+    executor_ = &FilterExecutor::instance();
+  }
+
+  // traces are written to a file when Kvazzup is closed
+  FrameTracer::instance().setEnabled(settingEnabled("media/trace"));
+
   initSelfView(selfView);
 }
 
@@ -94,7 +126,7 @@ void FilterGraph::updateSettings()
         {
           for (auto& senderFilter : peer.second->videoSenders)
           {
-            cameraGraph_.back()->addOutConnection(senderFilter);
+            layerEncoder(peer.second->videoLayer)->addOutConnection(senderFilter);
           }
         }
       }
@@ -160,6 +192,7 @@ void FilterGraph::initSelfView(VideoInterface *selfView)
   if(cameraGraph_.size() > 0)
   {
     destroyFilters(cameraGraph_);
+    videoLayers_.clear();
   }
 
   // Sending video graph
@@ -184,20 +217,19 @@ void FilterGraph::initSelfView(VideoInterface *selfView)
 
   if(selfView)
   {
-    // connect scaling filter
-    // TODO: not useful if it does not support YUV. Testing needed to verify
-    /*
-    ScaleFilter* scaler = new ScaleFilter("Self", stats_);
-    scaler->setResolution(selfView->size());
-    addToGraph(std::shared_ptr<Filter>(scaler), videoSend_);
-    */
-
-    // connect selfview to camera
+    // scale before any conversion so only the preview pixels are converted
+    std::shared_ptr<ScaleFilter> scaler =
+        std::shared_ptr<ScaleFilter>(new ScaleFilter("Self", stats_, cameraGraph_.at(0)->outputType()));
+    scaler->setResolution(SELF_VIEW_RESOLUTION, true);
+    addToGraph(scaler, cameraGraph_);
+    unsigned int scalerIndex = cameraGraph_.size() - 1;
+
+    // connect selfview to the scaler
     std::shared_ptr<DisplayFilter> selfviewFilter = std::shared_ptr<DisplayFilter>(new DisplayFilter("Self", stats_, selfView, 1111));
     // the self view rotation depends on which conversions are use as some of the optimizations
     // do the mirroring. Note: mirroring is slow with Qt
-    selfviewFilter->setProperties(true, cameraGraph_.at(0)->outputType() == RGB32VIDEO);
-    addToGraph(selfviewFilter, cameraGraph_);
+    selfviewFilter->setProperties(true, scaler->outputType() == RGB32VIDEO);
+    addToGraph(selfviewFilter, cameraGraph_, scalerIndex);
     addToGraph(selfviewFilter, screenShareGraph_);
   }
 }
@@ -212,41 +244,119 @@ void FilterGraph::initVideoSend()
     printProgramWarning(this, "Camera was not iniated for video send");
     initSelfView(selfView_);
   }
-  else if(cameraGraph_.size() > 3)
+  else if(!videoLayers_.empty())
   {
-    printProgramError(this, "Too many filters in videosend");
-    destroyFilters(cameraGraph_);
+    printProgramWarning(this, "Video send has already been initiated");
+    return;
   }
 
+  // a conversion to YUV is added before the encoder if needed
+  unsigned int cameraYUV = cameraGraph_.size();
+  unsigned int screenYUV = screenShareGraph_.size();
+
   std::shared_ptr<Filter> kvazaar = std::shared_ptr<Filter>(new KvazaarFilter("", stats_));
   addToGraph(kvazaar, cameraGraph_, 0);
-  addToGraph(cameraGraph_.back(), screenShareGraph_, 0);
+  addToGraph(kvazaar, screenShareGraph_, 0);
+  videoLayers_.push_back(kvazaar);
+
+  if (settingEnabled("video/simulcast"))
+  {
+    initVideoLayers(cameraGraph_.size() - cameraYUV == 2 ? cameraYUV : 0,
+                    screenShareGraph_.size() - screenYUV == 2 ? screenYUV : 0);
+  }
+}
+
+
+void FilterGraph::initVideoLayers(unsigned int cameraYUV, unsigned int screenYUV)
+{
+  QSize full = std::static_pointer_cast<KvazaarFilter>(videoLayers_.at(0))->resolution();
+
+  for (unsigned int i = 1; i < SIMULCAST_LAYERS.size(); ++i)
+  {
+    int width = full.width()/SIMULCAST_LAYERS.at(i).first;
+    int height = full.height()/SIMULCAST_LAYERS.at(i).first;
+    QSize resolution(width - width%8, height - height%8);
+
+    if (resolution.isEmpty())
+    {
+      break;
+    }
+
+    QString id = "Layer " + QString::number(i);
+
+    // the frames are scaled after the conversion, so it is only done once
+    std::shared_ptr<ScaleFilter> scaler =
+        std::shared_ptr<ScaleFilter>(new ScaleFilter(id, stats_, YUV420VIDEO));
+    scaler->setResolution(resolution);
+    addToGraph(scaler, cameraGraph_, cameraYUV);
+
+    if (screenShareGraph_.size() > screenYUV &&
+        screenShareGraph_.at(screenYUV)->outputType() == YUV420VIDEO)
+    {
+      addToGraph(scaler, screenShareGraph_, screenYUV);
+    }
+
+    std::shared_ptr<KvazaarFilter> kvazaar =
+        std::shared_ptr<KvazaarFilter>(new KvazaarFilter(id, stats_));
+    kvazaar->setLayer(resolution, SIMULCAST_LAYERS.at(i).second);
+    addToGraph(kvazaar, cameraGraph_, cameraGraph_.size() - 1);
+    videoLayers_.push_back(kvazaar);
+
+    printDebug(DEBUG_NORMAL, this, "Added simulcast layer", {"Layer", "Resolution"},
+               {QString::number(i), QString::number(resolution.width()) + "x" +
+                QString::number(resolution.height())});
+  }
 }
 
 
 void FilterGraph::initializeAudio(bool opus)
 {
   // Do this before adding participants, otherwise AEC filter wont get attached
-  addToGraph(std::shared_ptr<Filter>(new AudioCaptureFilter("", format_, stats_)), audioProcessing_);
+  std::shared_ptr<AudioCaptureFilter> capture =
+      std::shared_ptr<AudioCaptureFilter>(new AudioCaptureFilter("", format_, audioFrameDuration_, stats_));
+  addToGraph(capture, audioProcessing_);
+
+  // the microphone may not support our sample rate
+  if (capture->format().sampleRate() != format_.sampleRate())
+  {
+    addToGraph(std::make_shared<ResampleFilter>("", stats_, capture->format(), format_,
+                                                audioFrameDuration_),
+               audioProcessing_, audioProcessing_.size() - 1);
+  }
 
   std::shared_ptr<AECInputFilter> aec = std::shared_ptr<AECInputFilter>(new AECInputFilter("", stats_));
-  aec->initInput(format_);
+  aec->initInput(format_, audioFrameDuration_);
   addToGraph(aec, audioProcessing_, audioProcessing_.size() - 1);
 
   if (audioOutput_ == nullptr)
   {
     audioOutput_ = std::make_shared<AudioOutputDevice>(stats_);
-    audioOutput_->init(format_, aec->getAEC());
   }
 
+  // the echo frames must match the new AEC, which may have another frame duration
+  audioOutput_->init(format_, audioFrameDuration_, aec->getAEC());
+
   if (opus)
   {
-    addToGraph(std::shared_ptr<Filter>(new OpusEncoderFilter("", format_, stats_)), audioProcessing_,
-               audioProcessing_.size() - 1);
+    addToGraph(std::shared_ptr<Filter>(new OpusEncoderFilter("", format_, audioFrameDuration_, stats_)),
+               audioProcessing_, audioProcessing_.size() - 1);
+  }
+  else if (format_.sampleRate() != (int)PCM_SAMPLE_RATE)
+  {
+    addToGraph(std::make_shared<ResampleFilter>("", stats_, format_, pcmFormat()),
+               audioProcessing_, audioProcessing_.size() - 1);
   }
 }
 
 
+QAudioFormat FilterGraph::pcmFormat() const
+{
+  QAudioFormat pcm = format_;
+  pcm.setSampleRate(PCM_SAMPLE_RATE);
+  return pcm;
+}
+
+
 bool FilterGraph::addToGraph(std::shared_ptr<Filter> filter,
                              GraphSegment &graph,
                              unsigned int connectIndex)
@@ -291,7 +401,7 @@ bool FilterGraph::addToGraph(std::shared_ptr<Filter> filter,
   graph.push_back(filter);
   if(filter->init())
   {
-    filter->start();
+    startFilter(filter);
   }
   else
   {
@@ -301,6 +411,16 @@ bool FilterGraph::addToGraph(std::shared_ptr<Filter> filter,
 }
 
 
+void FilterGraph::startFilter(std::shared_ptr<Filter> filter)
+{
+  if (executor_)
+  {
+    filter->setExecutor(executor_);
+  }
+  filter->start();
+}
+
+
 bool FilterGraph::connectFilters(std::shared_ptr<Filter> filter, std::shared_ptr<Filter> previous)
 {
   Q_ASSERT(filter != nullptr && previous != nullptr);
@@ -345,7 +465,8 @@ void FilterGraph::checkParticipant(uint32_t sessionID)
 }
 
 
-void FilterGraph::sendVideoto(uint32_t sessionID, std::shared_ptr<Filter> videoFramedSource)
+void FilterGraph::sendVideoto(uint32_t sessionID, std::shared_ptr<Filter> videoFramedSource,
+                              uint32_t bandwidth)
 {
   Q_ASSERT(sessionID);
   Q_ASSERT(videoFramedSource);
@@ -353,7 +474,7 @@ void FilterGraph::sendVideoto(uint32_t sessionID, std::shared_ptr<Filter> videoF
   printNormal(this, "Adding send video", {"SessionID"}, QString::number(sessionID));
 
   // make sure we are generating video
-  if(cameraGraph_.size() < 4)
+  if(videoLayers_.empty())
   {
     initVideoSend();
   }
@@ -361,10 +482,188 @@ void FilterGraph::sendVideoto(uint32_t sessionID, std::shared_ptr<Filter> videoF
   // add participant if necessary
   checkParticipant(sessionID);
 
-  peers_[sessionID]->videoSenders.push_back(videoFramedSource);
+  Peer* peer = peers_[sessionID];
+  peer->videoSenders.push_back(videoFramedSource);
 
-  cameraGraph_.back()->addOutConnection(videoFramedSource);
-  videoFramedSource->start();
+  // the sender discarded frames the peer needs
+  connect(videoFramedSource.get(), &Filter::keyframeNeeded, this, [this, sessionID]()
+  {
+    sendKeyframe(sessionID);
+  });
+  peer->videoBandwidth = bandwidth;
+  peer->videoLayer = chooseVideoLayer(peer);
+
+  layerEncoder(peer->videoLayer)->addOutConnection(videoFramedSource);
+  startFilter(videoFramedSource);
+
+  // the views of the others got smaller
+  updateVideoLayers();
+}
+
+
+void FilterGraph::setVideoLayer(uint32_t sessionID, unsigned int layer)
+{
+  if (peers_.find(sessionID) == peers_.end() || peers_[sessionID] == nullptr ||
+      videoLayers_.empty())
+  {
+    return;
+  }
+
+  Peer* peer = peers_[sessionID];
+  layer = std::min(layer, (unsigned int)videoLayers_.size() - 1);
+
+  if (peer->videoLayer == layer)
+  {
+    return;
+  }
+
+  printDebug(DEBUG_NORMAL, this, "Changing simulcast layer of peer",
+             {"SessionID", "Previous layer", "New layer"},
+             {QString::number(sessionID), QString::number(peer->videoLayer),
+              QString::number(layer)});
+
+  for (auto& videoSender : peer->videoSenders)
+  {
+    layerEncoder(peer->videoLayer)->removeOutConnection(videoSender);
+    layerEncoder(layer)->addOutConnection(videoSender);
+  }
+  peer->videoLayer = layer;
+  peer->videoLayerTime = QDateTime::currentMSecsSinceEpoch();
+
+  // the peer cannot decode the new layer before its next intra frame
+  std::static_pointer_cast<KvazaarFilter>(layerEncoder(layer))->requestKeyframe();
+}
+
+
+unsigned int FilterGraph::chooseVideoLayer(const Peer* peer) const
+{
+  unsigned int peers = 0;
+  for (auto& other : peers_)
+  {
+    if (other.second != nullptr)
+    {
+      ++peers;
+    }
+  }
+
+  // The others see us in a grid with a tile for each participant. A layer
+  // is small enough if it has at most the resolution of one tile.
+  unsigned int columns = std::ceil(std::sqrt(peers));
+  unsigned int layer = 0;
+  while (layer + 1 < videoLayers_.size() &&
+         SIMULCAST_LAYERS.at(layer + 1).first <= (int)columns)
+  {
+    ++layer;
+  }
+
+  QSettings settings("kvazzup.ini", QSettings::IniFormat);
+  uint32_t bitrate = settings.value("video/bitrate").toUInt();
+
+  // the estimate from reports if we have one, otherwise what the peer announced
+  uint32_t bandwidth = peer->videoRate.estimate();
+  if (bandwidth == 0)
+  {
+    bandwidth = peer->videoBandwidth;
+  }
+
+  // without rate control we don't know the bitrate of layers
+  if (bandwidth != 0 && bitrate != 0)
+  {
+    while (layer + 1 < videoLayers_.size() &&
+           bitrate*SIMULCAST_LAYERS.at(layer).second*
+           (layer < peer->videoLayer ? LAYER_UP_HEADROOM : 1.0) > bandwidth)
+    {
+      ++layer;
+    }
+  }
+
+  return layer;
+}
+
+
+void FilterGraph::updateVideoLayers()
+{
+  for (auto& peer : peers_)
+  {
+    if (peer.second != nullptr && !peer.second->videoSenders.empty())
+    {
+      setVideoLayer(peer.first, chooseVideoLayer(peer.second));
+    }
+  }
+}
+
+
+void FilterGraph::videoReport(uint32_t sessionID, double fractionLost, uint32_t jitter,
+                              int32_t rtt, double queueFill)
+{
+  if (peers_.find(sessionID) == peers_.end() || peers_[sessionID] == nullptr ||
+      videoLayers_.empty())
+  {
+    return;
+  }
+
+  Peer* peer = peers_[sessionID];
+
+  QSettings settings("kvazzup.ini", QSettings::IniFormat);
+  uint32_t bitrate = settings.value("video/bitrate").toUInt();
+
+  // without rate control the estimate is not used
+  if (bitrate != 0 && peer->videoBandwidth != 0)
+  {
+    bitrate = std::min(bitrate, peer->videoBandwidth);
+  }
+
+  peer->videoRate.setMaximum(bitrate);
+  peer->videoRate.receiverReport(fractionLost, jitter, rtt, queueFill);
+
+  // A smaller layer is better than starving the encoder of the peers, but
+  // each switch costs an intra frame.
+  if (QDateTime::currentMSecsSinceEpoch() - peer->videoLayerTime >= LAYER_DWELL_TIME)
+  {
+    setVideoLayer(sessionID, chooseVideoLayer(peer));
+  }
+  retargetVideoLayers();
+}
+
+
+void FilterGraph::sendKeyframe(uint32_t sessionID)
+{
+  if (peers_.find(sessionID) == peers_.end() || peers_[sessionID] == nullptr ||
+      videoLayers_.empty())
+  {
+    return;
+  }
+
+  std::static_pointer_cast<KvazaarFilter>(
+        layerEncoder(peers_[sessionID]->videoLayer))->requestKeyframe();
+}
+
+
+void FilterGraph::retargetVideoLayers()
+{
+  // The encoder of a layer is shared, so it has to fit the slowest peer
+  // receiving it.
+  for (unsigned int layer = 0; layer < videoLayers_.size(); ++layer)
+  {
+    uint32_t target = UINT32_MAX;
+    for (auto& peer : peers_)
+    {
+      if (peer.second != nullptr && peer.second->videoLayer == layer &&
+          peer.second->videoRate.estimate() != 0)
+      {
+        target = std::min(target, peer.second->videoRate.estimate());
+      }
+    }
+
+    std::static_pointer_cast<KvazaarFilter>(videoLayers_.at(layer))->setTargetBitrate(target);
+  }
+}
+
+
+std::shared_ptr<Filter> FilterGraph::layerEncoder(unsigned int layer) const
+{
+  Q_ASSERT(!videoLayers_.empty());
+  return videoLayers_.at(std::min(layer, (unsigned int)videoLayers_.size() - 1));
 }
 
 
@@ -380,14 +679,21 @@ void FilterGraph::receiveVideoFrom(uint32_t sessionID, std::shared_ptr<Filter> v
   peers_[sessionID]->videoReceivers.push_back(graph);
 
   addToGraph(videoSink, *graph);
-  addToGraph(std::shared_ptr<Filter>(new OpenHEVCFilter(sessionID, stats_)), *graph, 0);
+
+  std::shared_ptr<Filter> decoder = std::shared_ptr<Filter>(new OpenHEVCFilter(sessionID, stats_));
+  connect(decoder.get(), &Filter::keyframeNeeded, this, [this, sessionID]()
+  {
+    emit requestKeyframe(sessionID);
+  });
+  addToGraph(decoder, *graph, 0);
 
   addToGraph(std::shared_ptr<Filter>(new DisplayFilter(QString::number(sessionID), stats_,
                                                        view, sessionID)), *graph, 1);
 }
 
 
-void FilterGraph::sendAudioTo(uint32_t sessionID, std::shared_ptr<Filter> audioFramedSource)
+void FilterGraph::sendAudioTo(uint32_t sessionID, std::shared_ptr<Filter> audioFramedSource,
+                              uint16_t frameDuration)
 {
   Q_ASSERT(sessionID);
   Q_ASSERT(audioFramedSource);
@@ -395,8 +701,15 @@ void FilterGraph::sendAudioTo(uint32_t sessionID, std::shared_ptr<Filter> audioF
   // just in case it is wanted later. AEC filter has to be attached
   if(audioProcessing_.size() == 0)
   {
+    audioFrameDuration_ = frameDuration;
     initializeAudio(audioFramedSource->inputType() == OPUSAUDIO);
   }
+  else if (frameDuration != audioFrameDuration_)
+  {
+    printWarning(this, "Audio is already sent with another frame duration to other peers.",
+                 {"Current vs wanted"}, {QString::number(audioFrameDuration_) + " ms vs " +
+                                         QString::number(frameDuration) + " ms"});
+  }
 
   // add participant if necessary
   checkParticipant(sessionID);
@@ -404,7 +717,7 @@ void FilterGraph::sendAudioTo(uint32_t sessionID, std::shared_ptr<Filter> audioF
   peers_[sessionID]->audioSenders.push_back(audioFramedSource);
 
   audioProcessing_.back()->addOutConnection(audioFramedSource);
-  audioFramedSource->start();
+  startFilter(audioFramedSource);
 }
 
 
@@ -421,29 +734,49 @@ void FilterGraph::receiveAudioFrom(uint32_t sessionID, std::shared_ptr<Filter> a
   peers_[sessionID]->audioReceivers.push_back(graph);
 
   addToGraph(audioSink, *graph);
-  if (audioSink->outputType() == OPUSAUDIO)
+
+  if (audioSink->outputType() == RAWAUDIO && format_.sampleRate() != (int)PCM_SAMPLE_RATE)
   {
-    addToGraph(std::shared_ptr<Filter>(new OpusDecoderFilter(sessionID, format_, stats_)),
+    addToGraph(std::make_shared<ResampleFilter>(QString::number(sessionID), stats_,
+                                                pcmFormat(), format_),
                *graph, graph->size() - 1);
   }
 
-  audioOutput_->addInput();
+  // the output device decodes Opus after its jitter buffer so it can conceal losses
+  audioOutput_->addInput(sessionID, audioSink->outputType() == OPUSAUDIO);
 
   addToGraph(std::make_shared<AudioMixerFilter>(QString::number(sessionID),
-                                                stats_, sessionID, audioOutput_),
+                                                stats_, sessionID, audioSink->outputType(),
+                                                audioOutput_),
              *graph, graph->size() - 1);
 
 }
 
 
+void FilterGraph::setAudioGain(uint32_t sessionID, float gain, bool muted)
+{
+  if (audioOutput_ != nullptr)
+  {
+    audioOutput_->setGain(sessionID, gain);
+    audioOutput_->setMuted(sessionID, muted);
+  }
+}
+
+
 void FilterGraph::uninit()
 {
   quitting_ = true;
   removeAllParticipants();
 
   destroyFilters(cameraGraph_);
+  videoLayers_.clear();
   destroyFilters(screenShareGraph_);
   destroyFilters(audioProcessing_);
+
+  if (FrameTracer::instance().enabled())
+  {
+    FrameTracer::instance().exportChromeTrace(TRACE_FILE);
+  }
 }
 
 
@@ -608,7 +941,7 @@ void FilterGraph::destroyFilters(std::vector<std::shared_ptr<Filter> > &filters)
 }
 
 
-void FilterGraph::destroyPeer(Peer* peer)
+void FilterGraph::destroyPeer(uint32_t sessionID, Peer* peer)
 {
   printNormal(this, "Destroying peer from Filter Graph");
 
@@ -621,7 +954,10 @@ void FilterGraph::destroyPeer(Peer* peer)
   }
   for (auto& videoSender : peer->videoSenders)
   {
-    cameraGraph_.back()->removeOutConnection(videoSender);
+    if (!videoLayers_.empty())
+    {
+      layerEncoder(peer->videoLayer)->removeOutConnection(videoSender);
+    }
     changeState(videoSender, false);
     //peer->videoFramedSource is destroyed by RTPStreamer
     videoSender = nullptr;
@@ -629,7 +965,7 @@ void FilterGraph::destroyPeer(Peer* peer)
   for (auto& graph : peer->audioReceivers)
   {
     destroyFilters(*graph);
-    audioOutput_->removeInput();
+    audioOutput_->removeInput(sessionID);
   }
 
   for (auto& graph : peer->videoReceivers)
@@ -650,7 +986,7 @@ void FilterGraph::removeParticipant(uint32_t sessionID)
     printDebug(DEBUG_NORMAL, this, "Removing peer", {"SessionID", "Remaining sessions"},
                {QString::number(sessionID), QString::number(peers_.size())});
 
-    destroyPeer(peers_[sessionID]);
+    destroyPeer(sessionID, peers_[sessionID]);
     peers_[sessionID] = nullptr;
 
     // destroy send graphs if this was the last peer
@@ -666,6 +1002,7 @@ void FilterGraph::removeParticipant(uint32_t sessionID)
     if(!peerPresent)
     {
       destroyFilters(cameraGraph_);
+      videoLayers_.clear();
       if (!quitting_)
       {
         initSelfView(selfView_); // restore the self view.
@@ -673,6 +1010,11 @@ void FilterGraph::removeParticipant(uint32_t sessionID)
 
       destroyFilters(audioProcessing_);
     }
+    else if (!videoLayers_.empty())
+    {
+      // the remaining peers have room for a larger layer
+      updateVideoLayers();
+    }
   }
 }
 
@@ -4,6 +4,8 @@
 #include <QAudioFormat>
 #include <QObject>
 
+#include "media/processing/bitratecontroller.h"
+
 #include <vector>
 #include <memory>
 
@@ -13,6 +15,7 @@ class AudioOutputDevice;
 class Filter;
 class ScreenShareFilter;
 class AECInputFilter;
+class FilterExecutor;
 
 typedef std::vector<std::shared_ptr<Filter>> GraphSegment;
 
@@ -25,15 +28,27 @@ public:
   void init(VideoInterface* selfView, StatisticsInterface *stats);
   void uninit();
 
-  // These functions are used to manipulate filter graphs regarding a peer
-  void sendVideoto(uint32_t sessionID, std::shared_ptr<Filter> videoFramedSource);
+  // These functions are used to manipulate filter graphs regarding a peer.
+  // Bandwidth is what the peer announced for video in bits/s, 0 if unknown.
+  void sendVideoto(uint32_t sessionID, std::shared_ptr<Filter> videoFramedSource,
+                   uint32_t bandwidth = 0);
   void receiveVideoFrom(uint32_t sessionID, std::shared_ptr<Filter> videoSink, VideoInterface *view);
-  void sendAudioTo(uint32_t sessionID, std::shared_ptr<Filter> audioFramedSource);
+  // Frame duration is in ms. All peers get the same audio, so only the
+  // first peer decides it.
+  void sendAudioTo(uint32_t sessionID, std::shared_ptr<Filter> audioFramedSource,
+                   uint16_t frameDuration);
   void receiveAudioFrom(uint32_t sessionID, std::shared_ptr<Filter> audioSink);
 
+  // How loud we play the audio of this peer. Gain 1 plays it as received.
+  void setAudioGain(uint32_t sessionID, float gain, bool muted);
+
   // removes participant and all its associated filter from filter graph.
   void removeParticipant(uint32_t sessionID);
 
+  // Sends the video of this peer from another simulcast layer. Layer 0 has
+  // the best quality.
+  void setVideoLayer(uint32_t sessionID, unsigned int layer);
+
   void mic(bool state);
   void camera(bool state);
   void running(bool state);
@@ -45,6 +60,19 @@ public:
   // Refresh settings of all filters from QSettings.
   void updateSettings();
 
+  // RTCP reception statistics of our video from peer. Adapts the bitrate and
+  // simulcast layer to the bandwidth available.
+  void videoReport(uint32_t sessionID, double fractionLost, uint32_t jitter,
+                   int32_t rtt, double queueFill);
+
+  // Peer has lost our video. Encodes an intra frame as soon as possible.
+  void sendKeyframe(uint32_t sessionID);
+
+signals:
+
+  // we have lost the video of peer and need an intra frame
+  void requestKeyframe(uint32_t sessionID);
+
 private:
 
   // adds fitler to graph and connects it to connectIndex unless this is the first filter in graph.
@@ -53,6 +81,9 @@ private:
                   GraphSegment& graph,
                   unsigned int connectIndex = 0);
 
+  // runs the filter on executor threads if enabled, then starts it
+  void startFilter(std::shared_ptr<Filter> filter);
+
   // connects the two filters and checks for any problems
   bool connectFilters(std::shared_ptr<Filter> filter, std::shared_ptr<Filter> previous);
 
@@ -65,13 +96,28 @@ private:
   // iniates encoder and attaches it
   void initVideoSend();
 
+  // iniates the scaled simulcast layers. The indexes are the filters
+  // providing the YUV frames for the first encoder.
+  void initVideoLayers(unsigned int cameraYUV, unsigned int screenYUV);
+
   // iniates encoder and attaches it
   void initializeAudio(bool opus);
 
+  // the format of raw audio on the wire
+  QAudioFormat pcmFormat() const;
+
   void removeAllParticipants();
 
   struct Peer
   {
+    // the simulcast layer videoSenders are connected to
+    unsigned int videoLayer = 0;
+    qint64 videoLayerTime = 0; // when videoLayer last changed, ms since epoch
+    uint32_t videoBandwidth = 0;
+
+    // estimates the bandwidth to peer from its reports
+    BitrateController videoRate;
+
     // Arrays of filters which send media, but are not connected to each other.
     std::vector<std::shared_ptr<Filter>> audioSenders; // sends audio
     std::vector<std::shared_ptr<Filter>> videoSenders; // sends video
@@ -83,7 +129,19 @@ private:
   };
 
   // destroy all filters associated with this peer.
-  void destroyPeer(Peer* peer);
+  void destroyPeer(uint32_t sessionID, Peer* peer);
+
+  // the layer that fits the bandwidth of peer and the size it shows us in
+  unsigned int chooseVideoLayer(const Peer* peer) const;
+
+  // moves the peers to the layers that currently fit them best
+  void updateVideoLayers();
+
+  // sets the bitrate of each layer to fit the peers receiving it
+  void retargetVideoLayers();
+
+  // the encoder of layer or the closest existing one
+  std::shared_ptr<Filter> layerEncoder(unsigned int layer) const;
 
   void destroyFilters(std::vector<std::shared_ptr<Filter>>& filters);
 
@@ -96,16 +154,24 @@ private:
   GraphSegment screenShareGraph_;
   GraphSegment audioProcessing_;
 
+  // Encoders of the simulcast layers, best quality first. Only the first
+  // one exists if simulcast is disabled.
+  GraphSegment videoLayers_;
+
   VideoInterface *selfView_;
 
   StatisticsInterface* stats_;
 
   // audio configs
   QAudioFormat format_;
+  uint16_t audioFrameDuration_;
 
   QString videoFormat_;
 
   bool quitting_;
 
+  // shared worker threads for filters, nullptr if each filter has its own thread
+  FilterExecutor* executor_;
+
   std::shared_ptr<AudioOutputDevice> audioOutput_;
 };
@@ -0,0 +1,274 @@
+#include "framepool.h"
+
+#include <cstring>
+
+// Buffer sizes are rounded to this so that frames of almost the same size
+// (encoded frames for example) can reuse each others buffers.
+const uint32_t BUCKET_GRANULARITY = 4096;
+
+// How many unused buffers are kept per size. One frame of each is in use in
+// every filter of the graph, so this should be roughly the length of graph
+// plus the filter buffer sizes.
+const uint32_t MAX_FREE_BUFFERS = 16;
+
+
+FramePool::FramePool():
+  poolMutex_(),
+  freeBuffers_(),
+  allocations_(0),
+  reuses_(0)
+{}
+
+
+FramePool::~FramePool()
+{
+  clear();
+}
+
+
+FramePool& FramePool::instance()
+{
+  static FramePool pool;
+  return pool;
+}
+
+
+uchar* FramePool::allocate(uint32_t size, uint32_t& capacity)
+{
+  capacity = ((size + BUCKET_GRANULARITY - 1)/BUCKET_GRANULARITY)*BUCKET_GRANULARITY;
+
+  if (capacity == 0)
+  {
+    capacity = BUCKET_GRANULARITY;
+  }
+
+  poolMutex_.lock();
+  auto bucket = freeBuffers_.find(capacity);
+  if (bucket != freeBuffers_.end() && !bucket->second.empty())
+  {
+    uchar* buffer = bucket->second.back();
+    bucket->second.pop_back();
+    poolMutex_.unlock();
+
+    ++reuses_;
+    return buffer;
+  }
+  poolMutex_.unlock();
+
+  ++allocations_;
+  return new uchar[capacity];
+}
+
+
+void FramePool::recycle(uchar* buffer, uint32_t capacity)
+{
+  if (buffer == nullptr)
+  {
+    return;
+  }
+
+  poolMutex_.lock();
+  std::vector<uchar*>& bucket = freeBuffers_[capacity];
+  if (bucket.size() < MAX_FREE_BUFFERS)
+  {
+    bucket.push_back(buffer);
+    buffer = nullptr;
+  }
+  poolMutex_.unlock();
+
+  // the bucket was full
+  delete[] buffer;
+}
+
+
+void FramePool::clear()
+{
+  poolMutex_.lock();
+  for (auto& bucket : freeBuffers_)
+  {
+    for (uchar* buffer : bucket.second)
+    {
+      delete[] buffer;
+    }
+  }
+  freeBuffers_.clear();
+  poolMutex_.unlock();
+}
+
+
+FrameBuffer::FrameBuffer():
+  block_(nullptr)
+{}
+
+
+FrameBuffer::FrameBuffer(std::nullptr_t):
+  block_(nullptr)
+{}
+
+
+FrameBuffer::FrameBuffer(uint32_t size):
+  block_(new Block)
+{
+  block_->references = 1;
+  block_->data = FramePool::instance().allocate(size, block_->capacity);
+  block_->pooled = true;
+}
+
+
+FrameBuffer::FrameBuffer(std::unique_ptr<uchar[]> data):
+  block_(nullptr)
+{
+  if (data)
+  {
+    block_ = new Block;
+    block_->references = 1;
+    block_->data = data.release();
+    block_->capacity = 0;
+    block_->pooled = false;
+  }
+}
+
+
+FrameBuffer::FrameBuffer(uchar* data, std::function<void()> release):
+  block_(new Block)
+{
+  block_->references = 1;
+  block_->data = data;
+  block_->capacity = 0;
+  block_->pooled = false;
+  block_->release = release;
+}
+
+
+FrameBuffer::FrameBuffer(const FrameBuffer& other):
+  block_(other.block_)
+{
+  if (block_)
+  {
+    ++block_->references;
+  }
+}
+
+
+FrameBuffer::FrameBuffer(FrameBuffer&& other) noexcept:
+  block_(other.block_)
+{
+  other.block_ = nullptr;
+}
+
+
+FrameBuffer::~FrameBuffer()
+{
+  unreference();
+}
+
+
+FrameBuffer& FrameBuffer::operator=(const FrameBuffer& other)
+{
+  if (block_ != other.block_)
+  {
+    unreference();
+    block_ = other.block_;
+    if (block_)
+    {
+      ++block_->references;
+    }
+  }
+  return *this;
+}
+
+
+FrameBuffer& FrameBuffer::operator=(FrameBuffer&& other) noexcept
+{
+  if (this != &other)
+  {
+    unreference();
+    block_ = other.block_;
+    other.block_ = nullptr;
+  }
+  return *this;
+}
+
+
+FrameBuffer& FrameBuffer::operator=(std::unique_ptr<uchar[]> data)
+{
+  *this = FrameBuffer(std::move(data));
+  return *this;
+}
+
+
+FrameBuffer& FrameBuffer::operator=(std::nullptr_t)
+{
+  reset();
+  return *this;
+}
+
+
+bool FrameBuffer::isShared() const
+{
+  return block_ != nullptr && block_->references.load() > 1;
+}
+
+
+void FrameBuffer::makeWritable(uint32_t size)
+{
+  if (isShared())
+  {
+    FrameBuffer copy(size);
+    memcpy(copy.get(), block_->data, size);
+    *this = std::move(copy);
+  }
+}
+
+
+std::unique_ptr<uchar[]> FrameBuffer::release(uint32_t size)
+{
+  if (block_ == nullptr)
+  {
+    return nullptr;
+  }
+
+  // someone else's memory cannot be given away
+  if (isShared() || block_->release)
+  {
+    std::unique_ptr<uchar[]> copy(new uchar[size]);
+    memcpy(copy.get(), block_->data, size);
+    reset();
+    return copy;
+  }
+
+  // pooled buffers are also allocated with new[] so they can be given away
+  std::unique_ptr<uchar[]> data(block_->data);
+  delete block_;
+  block_ = nullptr;
+  return data;
+}
+
+
+void FrameBuffer::reset()
+{
+  unreference();
+  block_ = nullptr;
+}
+
+
+void FrameBuffer::unreference()
+{
+  if (block_ && --block_->references == 0)
+  {
+    if (block_->release)
+    {
+      block_->release();
+    }
+    else if (block_->pooled)
+    {
+      FramePool::instance().recycle(block_->data, block_->capacity);
+    }
+    else
+    {
+      delete[] block_->data;
+    }
+    delete block_;
+  }
+  block_ = nullptr;
+}
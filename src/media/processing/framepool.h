@@ -0,0 +1,146 @@
+#pragma once
+
+#include <QtGlobal>
+#include <QMutex>
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+// The frame pool recycles the large buffers used by filters so that a steady
+// stream of same sized frames does not go through the allocator for every
+// frame. Buffers are bucketed by their capacity, which is the requested size
+// rounded up to the bucket granularity.
+
+class FramePool
+{
+public:
+  FramePool();
+  ~FramePool();
+
+  // The pool shared by the whole filter graph
+  static FramePool& instance();
+
+  // returns a buffer with at least size bytes. Capacity is set to the real size.
+  uchar* allocate(uint32_t size, uint32_t& capacity);
+
+  // gives the buffer back to pool. Buffer must have been allocated with new[].
+  void recycle(uchar* buffer, uint32_t capacity);
+
+  // frees all buffers that are not in use
+  void clear();
+
+  uint64_t allocations() const
+  {
+    return allocations_;
+  }
+
+  uint64_t reuses() const
+  {
+    return reuses_;
+  }
+
+private:
+
+  QMutex poolMutex_;
+
+  // capacity is the key
+  std::map<uint32_t, std::vector<uchar*>> freeBuffers_;
+
+  std::atomic<uint64_t> allocations_;
+  std::atomic<uint64_t> reuses_;
+};
+
+
+// A reference counted frame buffer. Copying a FrameBuffer shares the same
+// memory so one frame can be sent to multiple filters without copying it.
+// Filters that modify the data in place must call makeWritable or release
+// first, which copy the data only if somebody else is also holding it.
+// The buffer is given back to the frame pool when the last reference is gone.
+
+class FrameBuffer
+{
+public:
+  FrameBuffer();
+  FrameBuffer(std::nullptr_t);
+
+  // allocates a buffer of size from the frame pool
+  explicit FrameBuffer(uint32_t size);
+
+  // takes ownership of data that has been allocated with new[]
+  FrameBuffer(std::unique_ptr<uchar[]> data);
+
+  // Memory owned by someone else, for example a filter that wants its input
+  // to be written directly to its own buffers. Release is called when the
+  // last reference is gone.
+  FrameBuffer(uchar* data, std::function<void()> release);
+
+  FrameBuffer(const FrameBuffer& other);
+  FrameBuffer(FrameBuffer&& other) noexcept;
+  ~FrameBuffer();
+
+  FrameBuffer& operator=(const FrameBuffer& other);
+  FrameBuffer& operator=(FrameBuffer&& other) noexcept;
+  FrameBuffer& operator=(std::unique_ptr<uchar[]> data);
+  FrameBuffer& operator=(std::nullptr_t);
+
+  uchar* get() const
+  {
+    return block_ ? block_->data : nullptr;
+  }
+
+  uchar& operator[](size_t index) const
+  {
+    return block_->data[index];
+  }
+
+  explicit operator bool() const
+  {
+    return block_ != nullptr;
+  }
+
+  bool operator==(std::nullptr_t) const
+  {
+    return block_ == nullptr;
+  }
+
+  bool operator!=(std::nullptr_t) const
+  {
+    return block_ != nullptr;
+  }
+
+  // whether some other FrameBuffer is also referencing this data
+  bool isShared() const;
+
+  // makes sure nobody else is referencing this data so it can be modified.
+  // Copies size bytes of data if needed.
+  void makeWritable(uint32_t size);
+
+  // Gives up the ownership of data. Copies size bytes if the data is shared.
+  std::unique_ptr<uchar[]> release(uint32_t size);
+
+  void reset();
+
+private:
+
+  struct Block
+  {
+    std::atomic<uint32_t> references;
+    uchar* data;
+    uint32_t capacity;
+
+    // whether the data should be returned to frame pool.
+    bool pooled;
+
+    // set if the memory is not ours
+    std::function<void()> release;
+  };
+
+  void unreference();
+
+  Block* block_;
+};
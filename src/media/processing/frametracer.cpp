@@ -0,0 +1,212 @@
+#include "frametracer.h"
+
+#include "common.h"
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <chrono>
+
+// only the newest traces are kept so tracing can be left on for long calls
+const unsigned int MAX_COMPLETED_TRACES = 20000;
+
+
+FrameTracer::FrameTracer():
+  enabled_(false),
+  nextFrame_(1),
+  mutex_(),
+  filters_({"Unknown"}),
+  completed_()
+{}
+
+
+FrameTracer& FrameTracer::instance()
+{
+  static FrameTracer tracer;
+  return tracer;
+}
+
+
+void FrameTracer::setEnabled(bool enabled)
+{
+  if (enabled != enabled_)
+  {
+    printDebug(DEBUG_NORMAL, "FrameTracer", enabled ? "Frame tracing enabled" :
+                                                      "Frame tracing disabled");
+  }
+  enabled_ = enabled;
+}
+
+
+uint16_t FrameTracer::addFilter(QString name)
+{
+  mutex_.lock();
+  uint16_t id = filters_.size();
+  filters_.push_back(name);
+  mutex_.unlock();
+  return id;
+}
+
+
+void FrameTracer::begin(FrameTrace& trace, uint16_t filter)
+{
+  trace.frame = nextFrame_++;
+
+  // zero is reserved for untraced frames
+  if (trace.frame == 0)
+  {
+    trace.frame = nextFrame_++;
+  }
+
+  trace.start = now();
+  trace.stages = 1;
+  trace.stage[0] = {filter, 0, 0, 0};
+}
+
+
+void FrameTracer::enqueue(FrameTrace& trace, uint16_t filter)
+{
+  if (trace.stages < MAX_TRACE_STAGES)
+  {
+    uint32_t time = now() - trace.start;
+    trace.stage[trace.stages] = {filter, time, 0, 0};
+    ++trace.stages;
+  }
+}
+
+
+void FrameTracer::dequeue(FrameTrace& trace, uint16_t filter)
+{
+  TraceStage* stage = lastStage(trace, filter);
+  if (stage)
+  {
+    stage->dequeue = now() - trace.start;
+  }
+}
+
+
+void FrameTracer::finish(FrameTrace& trace, uint16_t filter)
+{
+  TraceStage* stage = lastStage(trace, filter);
+  if (stage)
+  {
+    stage->finish = now() - trace.start;
+  }
+}
+
+
+void FrameTracer::complete(const FrameTrace& trace)
+{
+  mutex_.lock();
+  completed_.push_back(trace);
+  if (completed_.size() > MAX_COMPLETED_TRACES)
+  {
+    completed_.pop_front();
+  }
+  mutex_.unlock();
+}
+
+
+bool FrameTracer::exportChromeTrace(QString filename)
+{
+  QJsonArray events;
+
+  mutex_.lock();
+
+  // each filter is shown as its own thread
+  for (unsigned int i = 0; i < filters_.size(); ++i)
+  {
+    events.append(QJsonObject{{"name", "thread_name"}, {"ph", "M"}, {"pid", 1},
+                              {"tid", (int)i}, {"args", QJsonObject{{"name", filters_[i]}}}});
+  }
+
+  for (const FrameTrace& trace : completed_)
+  {
+    QJsonObject args{{"frame", (qint64)trace.frame}};
+
+    for (uint8_t i = 0; i < trace.stages; ++i)
+    {
+      const TraceStage& stage = trace.stage[i];
+      qint64 enqueue = trace.start + stage.enqueue;
+      qint64 dequeue = trace.start + stage.dequeue;
+      qint64 finish = trace.start + stage.finish;
+
+      if (i == 0)
+      {
+        events.append(QJsonObject{{"name", "capture"}, {"cat", "frame"}, {"ph", "i"},
+                                  {"s", "t"}, {"pid", 1}, {"tid", stage.filter},
+                                  {"ts", enqueue}, {"args", args}});
+      }
+      else if (stage.dequeue != 0)
+      {
+        events.append(QJsonObject{{"name", "queue"}, {"cat", "frame"}, {"ph", "X"},
+                                  {"pid", 1}, {"tid", stage.filter}, {"ts", enqueue},
+                                  {"dur", dequeue - enqueue}, {"args", args}});
+
+        if (stage.finish >= stage.dequeue)
+        {
+          events.append(QJsonObject{{"name", "process"}, {"cat", "frame"}, {"ph", "X"},
+                                    {"pid", 1}, {"tid", stage.filter}, {"ts", dequeue},
+                                    {"dur", finish - dequeue}, {"args", args}});
+        }
+      }
+
+      // arrows following the frame from filter to filter
+      QString flow = i == 0 ? "s" : (i == trace.stages - 1 ? "f" : "t");
+      QJsonObject flowEvent{{"name", "frame"}, {"cat", "frame"}, {"ph", flow},
+                            {"id", (qint64)trace.frame}, {"pid", 1},
+                            {"tid", stage.filter}, {"ts", enqueue}};
+      if (flow == "f")
+      {
+        flowEvent.insert("bp", "e");
+      }
+      events.append(flowEvent);
+    }
+  }
+
+  unsigned int traces = completed_.size();
+  mutex_.unlock();
+
+  QFile file(filename);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+  {
+    printDebug(DEBUG_ERROR, "FrameTracer", "Could not open trace file",
+               {"File"}, {filename});
+    return false;
+  }
+
+  QJsonObject root{{"traceEvents", events}, {"displayTimeUnit", "ms"}};
+  file.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+  file.close();
+
+  printDebug(DEBUG_NORMAL, "FrameTracer", "Exported frame traces",
+             {"File", "Frames"}, {filename, QString::number(traces)});
+  return true;
+}
+
+
+void FrameTracer::clear()
+{
+  mutex_.lock();
+  completed_.clear();
+  mutex_.unlock();
+}
+
+
+int64_t FrameTracer::now()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+TraceStage* FrameTracer::lastStage(FrameTrace& trace, uint16_t filter)
+{
+  if (trace.stages != 0 && trace.stage[trace.stages - 1].filter == filter)
+  {
+    return &trace.stage[trace.stages - 1];
+  }
+  return nullptr;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <QMutex>
+#include <QString>
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// Per frame latency tracing. When tracing is enabled, every frame created by
+// a source filter carries a FrameTrace which the filters stamp when the frame
+// is put to their buffer (enqueue), taken from it (dequeue) and when they are
+// done with it (finish). Once the frame leaves the graph, its trace is stored
+// to the tracer and can be exported as Chrome trace-event JSON
+// (chrome://tracing or ui.perfetto.dev).
+
+const uint8_t MAX_TRACE_STAGES = 12;
+
+// Times are microseconds from the start of the trace.
+struct TraceStage
+{
+  uint16_t filter;
+  uint32_t enqueue;
+  uint32_t dequeue;
+  uint32_t finish;
+};
+
+struct FrameTrace
+{
+  // 0 means the frame is not being traced
+  uint32_t frame = 0;
+  uint8_t stages = 0;
+
+  // microseconds of tracer clock when the source created the frame
+  int64_t start = 0;
+
+  TraceStage stage[MAX_TRACE_STAGES];
+};
+
+
+class FrameTracer
+{
+public:
+  FrameTracer();
+
+  static FrameTracer& instance();
+
+  void setEnabled(bool enabled);
+
+  bool enabled() const
+  {
+    return enabled_;
+  }
+
+  // returns the ID the filter uses in traces
+  uint16_t addFilter(QString name);
+
+  // the source filter has created the frame
+  void begin(FrameTrace& trace, uint16_t filter);
+
+  void enqueue(FrameTrace& trace, uint16_t filter);
+  void dequeue(FrameTrace& trace, uint16_t filter);
+  void finish(FrameTrace& trace, uint16_t filter);
+
+  // the frame has left the filter graph
+  void complete(const FrameTrace& trace);
+
+  // writes all completed traces to file
+  bool exportChromeTrace(QString filename);
+
+  void clear();
+
+  // monotonic clock in microseconds
+  static int64_t now();
+
+private:
+
+  // last stage of the trace if it belongs to filter, otherwise nullptr
+  TraceStage* lastStage(FrameTrace& trace, uint16_t filter);
+
+  std::atomic<bool> enabled_;
+  std::atomic<uint32_t> nextFrame_;
+
+  QMutex mutex_;
+
+  // index is filter ID
+  std::vector<QString> filters_;
+
+  std::deque<FrameTrace> completed_;
+};
@@ -7,17 +7,187 @@
 
 #include <QtDebug>
 #include <QTime>
+#include <QDateTime>
 #include <QSize>
+#include <QMutex>
+#include <QtConcurrent>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <vector>
 
 enum RETURN_STATUS {C_SUCCESS = 0, C_FAILURE = -1};
 
+// Kvazaar keeps a reference to the pictures it is encoding, so the ring grows
+// until there is a free picture. This limits it if the encoder falls behind.
+const unsigned int MAX_INPUT_PICTURES = 16;
+
+// How many frames a reconfigured encoder waits for an intra frame of the
+// current encoder before it is taken into use anyway.
+const unsigned int MAX_SWAP_DELAY = 30;
+
+// The same for a lower bitrate. Forcing an intra frame would add to the
+// congestion the lower bitrate is meant to relieve.
+const unsigned int MAX_DECREASE_SWAP_DELAY = 300;
+
+// Intra frames are forced at most this often (ms) when peers lose video.
+const int64_t MIN_KEYFRAME_INTERVAL = 1000;
+
+// Below this the framerate is halved to leave more bits for each frame.
+const double MIN_BITS_PER_PIXEL = 0.02;
+
+// relative change of bitrate worth reopening the encoder
+const double MIN_BITRATE_CHANGE = 0.15;
+
+// settings the encoder is opened with, see encoderSettings()
+const QStringList ENCODER_SETTINGS = {"video/Preset", "video/ResolutionWidth",
+                                      "video/ResolutionHeight", "video/Framerate",
+                                      "video/kvzThreads", "video/OWF", "video/lowLatency", "video/WPP",
+                                      "video/Slices", "video/Tiles", "video/tileDimensions", "video/QP",
+                                      "video/Intra", "video/VPS", "video/bitrate",
+                                      "video/rcAlgorithm", "video/obaClipNeighbours",
+                                      "video/scalingList", "video/lossless",
+                                      "video/mvConstraint", "video/qpInCU", "video/vaq"};
+
+
+class KvazaarFilter::InputPictures
+{
+public:
+  InputPictures(const kvz_api* api, int32_t width, int32_t height):
+    api_(api),
+    width_(width),
+    height_(height),
+    contiguous_(true),
+    mutex_(),
+    pictures_()
+  {}
+
+  ~InputPictures()
+  {
+    for (auto& picture : pictures_)
+    {
+      api_->picture_free(picture.first);
+    }
+  }
+
+  // whether frames of this size can be written directly to our pictures
+  bool shareable(int32_t width, int32_t height) const
+  {
+    return contiguous_ && width == width_ && height == height_;
+  }
+
+  // a picture that neither the graph nor Kvazaar is using, nullptr if none
+  kvz_picture* acquire()
+  {
+    QMutexLocker lock(&mutex_);
+
+    for (auto& picture : pictures_)
+    {
+      // Kvazaar holds a reference while the picture is being encoded.
+      // We only read the count here, it is modified atomically by Kvazaar.
+      if (!picture.second && picture.first->refcount == 1)
+      {
+        picture.second = true;
+        return picture.first;
+      }
+    }
+
+    if (pictures_.size() >= MAX_INPUT_PICTURES)
+    {
+      return nullptr;
+    }
+
+    kvz_picture* picture = api_->picture_alloc(width_, height_);
+    if (picture == nullptr)
+    {
+      return nullptr;
+    }
+
+    // our frames have the planes one after another without padding
+    if (contiguous_ &&
+        (picture->stride != width_ ||
+         picture->u != picture->y + width_*height_ ||
+         picture->v != picture->u + width_*height_/4))
+    {
+      printDebug(DEBUG_WARNING, "Kvazaar", "Kvazaar picture layout differs from "
+                                           "our frames. Input will be copied.");
+      contiguous_ = false;
+    }
+
+    pictures_.push_back({picture, true});
+    return picture;
+  }
+
+  // the frame buffer pointing to picture is gone
+  void release(kvz_picture* picture)
+  {
+    QMutexLocker lock(&mutex_);
+    for (auto& slot : pictures_)
+    {
+      if (slot.first == picture)
+      {
+        slot.second = false;
+      }
+    }
+  }
+
+  // the picture where data is located, nullptr if not our picture
+  kvz_picture* find(const uchar* data)
+  {
+    QMutexLocker lock(&mutex_);
+    for (auto& picture : pictures_)
+    {
+      if (picture.first->y == data)
+      {
+        return picture.first;
+      }
+    }
+    return nullptr;
+  }
+
+private:
+
+  const kvz_api* api_;
+  int32_t width_;
+  int32_t height_;
+
+  // false if the pictures can't be used as our frames
+  std::atomic<bool> contiguous_;
+
+  QMutex mutex_;
+
+  // picture and whether a frame buffer is pointing to it
+  std::vector<std::pair<kvz_picture*, bool>> pictures_;
+};
+
+
 KvazaarFilter::KvazaarFilter(QString id, StatisticsInterface *stats):
   Filter(id, "Kvazaar", stats, YUV420VIDEO, HEVCVIDEO),
   api_(nullptr),
   config_(nullptr),
   enc_(nullptr),
   pts_(0),
-  input_pic_(nullptr),
+  inputPictures_(nullptr),
+  settingValues_(),
+  pendingMutex_(),
+  pendingConfig_(nullptr),
+  pendingEnc_(nullptr),
+  pendingPictures_(nullptr),
+  pendingFrames_(0),
+  pendingMaxFrames_(MAX_SWAP_DELAY),
+  pendingImmediate_(false),
+  opener_(),
+  opening_(false),
+  reopenAgain_(false),
+  openImmediate_(false),
+  openWaitForIntra_(false),
+  lastKeyframe_(0),
+  layerResolution_(),
+  bitrateShare_(1.0),
+  targetBitrate_(0),
+  framerateDivider_(1),
+  inputFrames_(0),
   framerate_num_(30),
   framerate_denom_(1),
   encodingFrames_()
@@ -29,37 +199,215 @@ void KvazaarFilter::updateSettings()
 {
   qDebug() << "Updating kvazaar settings";
 
-  stop();
+  QSettings settings("kvazzup.ini", QSettings::IniFormat);
 
-  while(isRunning())
+  if(!encoderOpen())
   {
-    sleep(1);
+    // the previous initialization failed, try again
+    close();
+    init();
   }
+  else
+  {
+    pendingMutex_.lock();
+    bool changed = encoderSettings(settings) != settingValues_;
+    if(changed)
+    {
+      // the rate controller adapts to the new bitrate setting
+      targetBitrate_ = 0;
+      framerateDivider_ = 1;
+    }
+    pendingMutex_.unlock();
 
+    if(changed)
+    {
+      reopen();
+    }
+  }
 
-  close();
-  encodingFrames_.clear();
+  Filter::updateSettings();
+}
+
+
+void KvazaarFilter::setTargetBitrate(uint32_t bitrate)
+{
+  QSettings settings("kvazzup.ini", QSettings::IniFormat);
+  uint32_t maximum = settings.value("video/bitrate").toUInt()*bitrateShare_;
 
-  if(init())
+  // without rate control there is no bitrate to adapt
+  if(!encoderOpen() || maximum == 0)
   {
-    qDebug() << getName() << "Kvazaar resolution change successful";
+    return;
   }
-  else
+
+  bitrate = std::min(bitrate, maximum);
+  uint32_t current = targetBitrate_ != 0 ? targetBitrate_ : maximum;
+
+  // When there are too few bits per pixel, a lower framerate looks better
+  // than blurred frames.
+  pendingMutex_.lock();
+  double pixelRate = (double)config_->width*config_->height*
+      config_->framerate_num/framerate_denom_;
+  pendingMutex_.unlock();
+  unsigned int divider = bitrate < pixelRate*MIN_BITS_PER_PIXEL ? 2 : 1;
+
+  // Every change costs an intra frame, so small changes are not worth it.
+  if(divider == framerateDivider_ &&
+     std::abs((double)bitrate - current) < current*MIN_BITRATE_CHANGE)
   {
-    qDebug() << "Failed to change resolution";
+    return;
   }
 
-  start();
+  printDebug(DEBUG_NORMAL, this, "Changing target bitrate",
+             {"Previous", "New", "Framerate divider"},
+             {QString::number(current), QString::number(bitrate),
+              QString::number(divider)});
 
-  Filter::updateSettings();
+  // A congested peer is moved to a lower layer before this, so a lower
+  // bitrate can wait for the next intra frame.
+  bool decrease = bitrate < current || divider > framerateDivider_;
+
+  pendingMutex_.lock();
+  targetBitrate_ = bitrate;
+  framerateDivider_ = divider;
+  pendingMutex_.unlock();
+
+  reopen(false, decrease);
+}
+
+
+void KvazaarFilter::requestKeyframe()
+{
+  if(!encoderOpen())
+  {
+    return;
+  }
+
+  // one intra frame answers all the requests sent before it arrives
+  int64_t now = QDateTime::currentMSecsSinceEpoch();
+  if(now - lastKeyframe_ < MIN_KEYFRAME_INTERVAL)
+  {
+    return;
+  }
+  lastKeyframe_ = now;
+
+  // a new encoder starts with an intra frame
+  pendingMutex_.lock();
+  bool pending = pendingEnc_ != nullptr || opening_;
+  pendingImmediate_ = true;
+  openImmediate_ = openImmediate_ || opening_;
+  pendingMutex_.unlock();
+
+  if(!pending)
+  {
+    reopen(true);
+  }
+
+  printNormal(this, "Forcing an intra frame");
 }
 
+
+void KvazaarFilter::reopen(bool immediate, bool waitForIntra)
+{
+  // Kvazaar has no way to change the parameters of an open encoder. A new
+  // encoder is opened in a worker thread while the current one keeps
+  // encoding and process() switches to it. Opening takes long enough to stall
+  // the calling thread.
+  QMutexLocker lock(&pendingMutex_);
+  openImmediate_ = openImmediate_ || immediate;
+  openWaitForIntra_ = waitForIntra;
+
+  if(opening_)
+  {
+    // the encoder being opened may have the old settings
+    reopenAgain_ = true;
+    return;
+  }
+
+  opening_ = true;
+  opener_ = QtConcurrent::run(this, &KvazaarFilter::openPending);
+}
+
+
+void KvazaarFilter::openPending()
+{
+  bool again = true;
+  while(again)
+  {
+    QSettings settings("kvazzup.ini", QSettings::IniFormat);
+
+    // the configuration uses members changed by the other threads
+    pendingMutex_.lock();
+    reopenAgain_ = false;
+    kvz_config* config = api_->config_alloc();
+    QStringList values;
+    if(config)
+    {
+      configure(config, settings);
+      values = encoderSettings(settings);
+    }
+    pendingMutex_.unlock();
+
+    kvz_encoder* encoder = nullptr;
+    std::shared_ptr<InputPictures> pictures;
+
+    if(!config)
+    {
+      printDebug(DEBUG_PROGRAM_ERROR, this, "Failed to allocate Kvazaar config.");
+    }
+    else if(!(encoder = api_->encoder_open(config)))
+    {
+      printDebug(DEBUG_PROGRAM_ERROR, this, "Failed to open Kvazaar encoder. "
+                                            "Keeping the previous settings.");
+      api_->config_destroy(config);
+    }
+    else
+    {
+      pictures = std::make_shared<InputPictures>(api_, config->width, config->height);
+    }
+
+    pendingMutex_.lock();
+    if(encoder)
+    {
+      // replaces an encoder that was never taken into use, keeping its urgency
+      bool immediate = openImmediate_ || (pendingEnc_ != nullptr && pendingImmediate_);
+      // and the time it has already waited
+      pendingFrames_ = pendingEnc_ != nullptr ? pendingFrames_ : 0;
+      closePending();
+      pendingConfig_ = config;
+      pendingEnc_ = encoder;
+      pendingPictures_ = pictures;
+      pendingImmediate_ = immediate;
+      pendingMaxFrames_ = openWaitForIntra_ ? MAX_DECREASE_SWAP_DELAY : MAX_SWAP_DELAY;
+      settingValues_ = values;
+    }
+    openImmediate_ = false;
+
+    again = reopenAgain_;
+    opening_ = again;
+    pendingMutex_.unlock();
+
+    if(encoder)
+    {
+      printNormal(this, "New Kvazaar encoder opened. Switching at the next intra frame.");
+    }
+  }
+}
+
+
+bool KvazaarFilter::encoderOpen()
+{
+  QMutexLocker lock(&pendingMutex_);
+  return enc_ != nullptr;
+}
+
+
 bool KvazaarFilter::init()
 {
   qDebug() << getName() << "iniating";
 
-  // input picture should not exist at this point
-  if(!input_pic_ && !api_)
+  // input pictures should not exist at this point
+  if(!inputPictures_ && !api_)
   {
 
     api_ = kvz_api_get(8);
@@ -78,180 +426,352 @@ bool KvazaarFilter::init()
     }
     QSettings settings("kvazzup.ini", QSettings::IniFormat);
 
-    api_->config_init(config_);
-    api_->config_parse(config_, "preset", settings.value("video/Preset").toString().toUtf8());
-
-    // input
+    configure(config_, settings);
+    settingValues_ = encoderSettings(settings);
 
-#ifdef __linux__
-    // On Linux the Camerafilter seems to have a Qt bug that causes not being able to set resolution
-    config_->width = 640;
-    config_->height = 480;
-    config_->framerate_num = 30;
-#else
-    config_->width = settings.value("video/ResolutionWidth").toInt();
-    config_->height = settings.value("video/ResolutionHeight").toInt();
-    framerate_num_ = settings.value("video/Framerate").toFloat();
-    config_->framerate_num = framerate_num_;
-#endif
-    config_->framerate_denom = framerate_denom_;
-
-    // parallelization
+    enc_ = api_->encoder_open(config_);
 
-    if (settings.value("video/kvzThreads") == "auto")
-    {
-      config_->threads = QThread::idealThreadCount();
-    }
-    else if (settings.value("video/kvzThreads") == "Main")
-    {
-      config_->threads = 0;
-    }
-    else
+    if(!enc_)
     {
-      config_->threads = settings.value("video/kvzThreads").toInt();
+      printDebug(DEBUG_PROGRAM_ERROR, this, "Failed to open Kvazaar encoder.");
+      return false;
     }
 
-    config_->owf = settings.value("video/OWF").toInt();
-    config_->wpp = settings.value("video/WPP").toInt();
+    std::atomic_store(&inputPictures_, std::make_shared<InputPictures>(api_, config_->width,
+                                                                      config_->height));
 
-    bool tiles = false; //settings.value("video/WPP").toBool();
+    qDebug() << getName() << "iniation succeeded.";
+  }
+  return true;
+}
 
-    if (tiles)
-    {
-      std::string dimensions = settings.value("video/tileDimensions").toString().toStdString();
-      api_->config_parse(config_, "tiles", dimensions.c_str());
-    }
+void KvazaarFilter::close()
+{
+  if(api_)
+  {
+    // the worker thread uses api_
+    opener_.waitForFinished();
 
-    // this does not work with uvgRTP at the moment. Avoid using slices.
-    if(settings.value("video/Slices").toInt() == 1)
-    {
-      if(config_->wpp)
-      {
-        config_->slices = KVZ_SLICES_WPP;
-      }
-      else if (tiles)
-      {
-        config_->slices = KVZ_SLICES_TILES;
-      }
-    }
+    pendingMutex_.lock();
+    closePending();
+    api_->encoder_close(enc_);
+    api_->config_destroy(config_);
+    enc_ = nullptr;
+    config_ = nullptr;
+    pendingMutex_.unlock();
 
-    // Structure
+    // pictures still in the graph are freed when their frames are gone
+    std::atomic_store(&inputPictures_, std::shared_ptr<InputPictures>());
+    api_ = nullptr;
+  }
+  qDebug() << getName() << "Kvazaar closed";
 
-    config_->qp = settings.value("video/QP").toInt();
-    config_->intra_period = settings.value("video/Intra").toInt();
-    config_->vps_period = settings.value("video/VPS").toInt();
+  pts_ = 0;
+}
 
-    config_->target_bitrate = settings.value("video/bitrate").toInt();
+void KvazaarFilter::configure(kvz_config* config, QSettings& settings)
+{
+  api_->config_init(config);
+  api_->config_parse(config, "preset", settings.value("video/Preset").toString().toUtf8());
 
-    if (config_->target_bitrate != 0)
-    {
-      QString rcAlgo = settings.value("video/rcAlgorithm").toString();
+  // input
 
-      if (rcAlgo == "lambda")
-      {
-        config_->rc_algorithm = KVZ_LAMBDA;
-      }
-      else if (rcAlgo == "oba")
-      {
-        config_->rc_algorithm = KVZ_OBA;
-        config_->clip_neighbour = settings.value("video/obaClipNeighbours").toInt();
-      }
-      else
-      {
-        printWarning(this, "Some carbage in rc algorithm setting");
-        config_->rc_algorithm = KVZ_NO_RC;
-      }
-    }
-    else
-    {
-      config_->rc_algorithm = KVZ_NO_RC;
-    }
+#ifdef __linux__
+  // On Linux the Camerafilter seems to have a Qt bug that causes not being able to set resolution
+  config->width = 640;
+  config->height = 480;
+  config->framerate_num = 30;
+#else
+  config->width = settings.value("video/ResolutionWidth").toInt();
+  config->height = settings.value("video/ResolutionHeight").toInt();
+  framerate_num_ = settings.value("video/Framerate").toFloat();
+  config->framerate_num = framerate_num_;
+#endif
+  // every framerateDivider_ frame is encoded
+  config->framerate_denom = framerate_denom_*framerateDivider_;
 
-    config_->gop_lowdelay = 1;
+  if(layerResolution_.isValid())
+  {
+    config->width = layerResolution_.width();
+    config->height = layerResolution_.height();
+  }
 
-    if (settings.value("video/scalingList").toInt() == 0)
-    {
-      config_->scaling_list = KVZ_SCALING_LIST_OFF;
-    }
-    else
-    {
-      config_->scaling_list = KVZ_SCALING_LIST_DEFAULT;
-    }
+  // parallelization
 
-    config_->lossless = settings.value("video/lossless").toInt();
+  if (settings.value("video/kvzThreads") == "auto")
+  {
+    config->threads = QThread::idealThreadCount();
+  }
+  else if (settings.value("video/kvzThreads") == "Main")
+  {
+    config->threads = 0;
+  }
+  else
+  {
+    config->threads = settings.value("video/kvzThreads").toInt();
+  }
+
+  config->owf = settings.value("video/OWF").toInt();
+
+  // Overlapping frames delay the output by as many frames
+  if(settings.value("video/lowLatency").toInt() == 1)
+  {
+    config->owf = 0;
+  }
+  config->wpp = settings.value("video/WPP").toInt();
 
-    QString constraint = settings.value("video/mvConstraint").toString();
+  bool tiles = settings.value("video/Tiles").toInt() == 1;
 
-    if (constraint == "frame")
+  if (tiles)
+  {
+    std::string dimensions = settings.value("video/tileDimensions").toString().toStdString();
+    api_->config_parse(config, "tiles", dimensions.c_str());
+  }
+
+  // Each WPP row or tile is its own slice, so they can be packetized and
+  // decoded separately.
+  if(settings.value("video/Slices").toInt() == 1)
+  {
+    config->slices = KVZ_SLICES_NONE;
+    if(config->wpp)
     {
-      config_->mv_constraint = KVZ_MV_CONSTRAIN_FRAME;
+      config->slices |= KVZ_SLICES_WPP;
     }
-    else if (constraint == "tile")
+    if (tiles)
     {
-      config_->mv_constraint = KVZ_MV_CONSTRAIN_TILE;
+      config->slices |= KVZ_SLICES_TILES;
     }
-    else if (constraint == "frametile")
+  }
+
+  // Structure
+
+  config->qp = settings.value("video/QP").toInt();
+  config->intra_period = settings.value("video/Intra").toInt();
+  config->vps_period = settings.value("video/VPS").toInt();
+
+  config->target_bitrate = settings.value("video/bitrate").toInt()*bitrateShare_;
+
+  // the bitrate the network currently allows
+  if (targetBitrate_ != 0 && config->target_bitrate != 0)
+  {
+    config->target_bitrate = targetBitrate_;
+  }
+
+  if (config->target_bitrate != 0)
+  {
+    QString rcAlgo = settings.value("video/rcAlgorithm").toString();
+
+    if (rcAlgo == "lambda")
     {
-      config_->mv_constraint = KVZ_MV_CONSTRAIN_FRAME_AND_TILE;
+      config->rc_algorithm = KVZ_LAMBDA;
     }
-    else if (constraint == "frametilemargin")
+    else if (rcAlgo == "oba")
     {
-      config_->mv_constraint = KVZ_MV_CONSTRAIN_FRAME_AND_TILE_MARGIN;
+      config->rc_algorithm = KVZ_OBA;
+      config->clip_neighbour = settings.value("video/obaClipNeighbours").toInt();
     }
     else
     {
-      config_->mv_constraint = KVZ_MV_CONSTRAIN_NONE;
+      printWarning(this, "Some carbage in rc algorithm setting");
+      config->rc_algorithm = KVZ_NO_RC;
     }
+  }
+  else
+  {
+    config->rc_algorithm = KVZ_NO_RC;
+  }
 
-    config_->set_qp_in_cu = settings.value("video/qpInCU").toInt();
+  config->gop_lowdelay = 1;
 
-    config_->vaq = settings.value("video/vaq").toInt();
+  if (settings.value("video/scalingList").toInt() == 0)
+  {
+    config->scaling_list = KVZ_SCALING_LIST_OFF;
+  }
+  else
+  {
+    config->scaling_list = KVZ_SCALING_LIST_DEFAULT;
+  }
 
+  config->lossless = settings.value("video/lossless").toInt();
 
-    // compression-tab
-    customParameters(settings);
+  QString constraint = settings.value("video/mvConstraint").toString();
 
-    config_->hash = KVZ_HASH_NONE;
+  if (constraint == "frame")
+  {
+    config->mv_constraint = KVZ_MV_CONSTRAIN_FRAME;
+  }
+  else if (constraint == "tile")
+  {
+    config->mv_constraint = KVZ_MV_CONSTRAIN_TILE;
+  }
+  else if (constraint == "frametile")
+  {
+    config->mv_constraint = KVZ_MV_CONSTRAIN_FRAME_AND_TILE;
+  }
+  else if (constraint == "frametilemargin")
+  {
+    config->mv_constraint = KVZ_MV_CONSTRAIN_FRAME_AND_TILE_MARGIN;
+  }
+  else
+  {
+    config->mv_constraint = KVZ_MV_CONSTRAIN_NONE;
+  }
 
-    enc_ = api_->encoder_open(config_);
+  config->set_qp_in_cu = settings.value("video/qpInCU").toInt();
 
-    if(!enc_)
-    {
-      printDebug(DEBUG_PROGRAM_ERROR, this, "Failed to open Kvazaar encoder.");
-      return false;
-    }
+  config->vaq = settings.value("video/vaq").toInt();
+
+
+  // compression-tab
+  customParameters(config, settings);
+
+  config->hash = KVZ_HASH_NONE;
+}
+
+
+QStringList KvazaarFilter::encoderSettings(QSettings& settings)
+{
+  QStringList values;
+  for (auto& key : ENCODER_SETTINGS)
+  {
+    values.push_back(settings.value(key).toString());
+  }
+
+  int size = settings.beginReadArray("parameters");
+  for(int i = 0; i < size; ++i)
+  {
+    settings.setArrayIndex(i);
+    values.push_back(settings.value("Name").toString() + "=" +
+                     settings.value("Value").toString());
+  }
+  settings.endArray();
+
+  return values;
+}
+
+
+void KvazaarFilter::swapEncoder(const Data* input)
+{
+  pendingMutex_.lock();
+
+  if(!pendingEnc_)
+  {
+    pendingMutex_.unlock();
+    return;
+  }
+
+  // The new encoder starts with an intra frame, so switching when the current
+  // one would send an intra frame anyway costs nothing. Frames in the new
+  // resolution can only be encoded by the new encoder.
+  bool intraFrame = config_->intra_period > 0 && pts_ % config_->intra_period == 0;
+  bool newResolution = input->width == pendingConfig_->width &&
+      input->height == pendingConfig_->height &&
+      (input->width != config_->width || input->height != config_->height);
 
-    input_pic_ = api_->picture_alloc(config_->width, config_->height);
+  if(!pendingImmediate_ && !intraFrame && !newResolution && pendingFrames_ < pendingMaxFrames_)
+  {
+    ++pendingFrames_;
+    pendingMutex_.unlock();
+    return;
+  }
+
+  kvz_config* config = pendingConfig_;
+  kvz_encoder* encoder = pendingEnc_;
+  std::shared_ptr<InputPictures> pictures = pendingPictures_;
+  pendingConfig_ = nullptr;
+  pendingEnc_ = nullptr;
+  pendingPictures_ = nullptr;
+  pendingMutex_.unlock();
+
+  // send the frames the previous encoder is still working on
+  kvz_picture *recon_pic = nullptr;
+  kvz_frame_info frame_info;
+  kvz_data_chunk *data_out = nullptr;
+  uint32_t len_out = 0;
 
-    if(!input_pic_)
+  do
+  {
+    api_->encoder_encode(enc_, nullptr,
+                         &data_out, &len_out,
+                         &recon_pic, nullptr,
+                         &frame_info );
+    if(data_out != nullptr)
     {
-      printDebug(DEBUG_PROGRAM_ERROR, this, "Could not allocate input picture.");
-      return false;
+      parseEncodedFrame(data_out, len_out, recon_pic);
     }
+  } while(data_out != nullptr);
 
-    qDebug() << getName() << "iniation succeeded.";
+  encodingFrames_.clear();
+
+  api_->encoder_close(enc_);
+
+  // other threads read the config with the lock
+  pendingMutex_.lock();
+  api_->config_destroy(config_);
+  enc_ = encoder;
+  config_ = config;
+  pendingMutex_.unlock();
+
+  std::atomic_store(&inputPictures_, pictures);
+  pts_ = 0;
+
+  printDebug(DEBUG_NORMAL, this, "Switched to the new Kvazaar encoder.",
+             {"Resolution", "Target bitrate", "QP", "Intra period"},
+             {QString::number(config_->width) + "x" + QString::number(config_->height),
+              QString::number(config_->target_bitrate), QString::number(config_->qp),
+              QString::number(config_->intra_period)});
+}
+
+
+void KvazaarFilter::closePending()
+{
+  if(pendingEnc_)
+  {
+    api_->encoder_close(pendingEnc_);
+    api_->config_destroy(pendingConfig_);
+    pendingEnc_ = nullptr;
+    pendingConfig_ = nullptr;
+    pendingPictures_ = nullptr;
   }
-  return true;
 }
 
-void KvazaarFilter::close()
+
+void KvazaarFilter::setLayer(QSize resolution, double bitrateShare)
 {
-  if(api_)
+  layerResolution_ = resolution;
+  bitrateShare_ = bitrateShare;
+}
+
+QSize KvazaarFilter::resolution()
+{
+  QMutexLocker lock(&pendingMutex_);
+  if(!config_)
   {
-    api_->encoder_close(enc_);
-    api_->config_destroy(config_);
-    enc_ = nullptr;
-    config_ = nullptr;
+    return QSize();
+  }
+  return QSize(config_->width, config_->height);
+}
 
-    api_->picture_free(input_pic_);
-    input_pic_ = nullptr;
-    api_ = nullptr;
+FrameBuffer KvazaarFilter::allocateInput(uint32_t size, int16_t width, int16_t height)
+{
+  std::shared_ptr<InputPictures> pictures = std::atomic_load(&inputPictures_);
+
+  if (pictures && pictures->shareable(width, height) && size == (uint32_t)width*height*3/2)
+  {
+    kvz_picture* picture = pictures->acquire();
+    if (picture != nullptr)
+    {
+      return FrameBuffer(picture->y, [pictures, picture]()
+      {
+        pictures->release(picture);
+      });
+    }
   }
-  qDebug() << getName() << "Kvazaar closed";
 
-  pts_ = 0;
+  return Filter::allocateInput(size, width, height);
 }
 
+
 void KvazaarFilter::process()
 {
   Q_ASSERT(enc_);
@@ -261,9 +781,9 @@ void KvazaarFilter::process()
 
   while(input)
   {
-    if(!input_pic_)
+    if(!inputPictures_)
     {
-      printDebug(DEBUG_PROGRAM_ERROR, this,  "Input picture was not allocated correctly.");
+      printDebug(DEBUG_PROGRAM_ERROR, this,  "Input pictures were not allocated correctly.");
       break;
     }
 
@@ -273,7 +793,7 @@ void KvazaarFilter::process()
   }
 }
 
-void KvazaarFilter::customParameters(QSettings& settings)
+void KvazaarFilter::customParameters(kvz_config* config, QSettings& settings)
 {
   int size = settings.beginReadArray("parameters");
 
@@ -285,7 +805,7 @@ void KvazaarFilter::customParameters(QSettings& settings)
     settings.setArrayIndex(i);
     QString name = settings.value("Name").toString();
     QString value = settings.value("Value").toString();
-    if (api_->config_parse(config_, name.toStdString().c_str(),
+    if (api_->config_parse(config, name.toStdString().c_str(),
                            value.toStdString().c_str()) != 1)
     {
       qDebug() << "Initialization," << metaObject()->className()
@@ -303,6 +823,15 @@ void KvazaarFilter::feedInput(std::unique_ptr<Data> input)
   kvz_data_chunk *data_out = nullptr;
   uint32_t len_out = 0;
 
+  swapEncoder(input.get());
+
+  // the encoder is configured for a lower framerate
+  unsigned int divider = config_->framerate_denom/framerate_denom_;
+  if(divider > 1 && inputFrames_++ % divider != 0)
+  {
+    return;
+  }
+
   if(config_->width != input->width
      || config_->height != input->height
      || config_->framerate_num != input->framerate)
@@ -317,27 +846,54 @@ void KvazaarFilter::feedInput(std::unique_ptr<Data> input)
     return;
   }
 
-  // copy input to kvazaar picture
-  memcpy(input_pic_->y,
-         input->data.get(),
-         input->width*input->height);
-  memcpy(input_pic_->u,
-         &(input->data.get()[input->width*input->height]),
-         input->width*input->height/4);
-  memcpy(input_pic_->v,
-         &(input->data.get()[input->width*input->height + input->width*input->height/4]),
-         input->width*input->height/4);
+  std::shared_ptr<InputPictures> pictures = std::atomic_load(&inputPictures_);
 
-  input_pic_->pts = pts_;
+  // usually the previous filter has written the frame directly to our picture
+  kvz_picture* input_pic = pictures->find(input->data.get());
+  bool copied = false;
+
+  if (input_pic == nullptr)
+  {
+    input_pic = pictures->acquire();
+
+    if (input_pic == nullptr)
+    {
+      printWarning(this, "No free input picture for Kvazaar. Dropping frame.");
+      return;
+    }
+
+    // copy input to kvazaar picture
+    memcpy(input_pic->y,
+           input->data.get(),
+           input->width*input->height);
+    memcpy(input_pic->u,
+           &(input->data.get()[input->width*input->height]),
+           input->width*input->height/4);
+    memcpy(input_pic->v,
+           &(input->data.get()[input->width*input->height + input->width*input->height/4]),
+           input->width*input->height/4);
+    copied = true;
+  }
+
+  input_pic->pts = pts_;
   ++pts_;
 
+  // the frame data is not needed after Kvazaar has the picture
+  FrameBuffer frame = std::move(input->data);
   encodingFrames_.push_front(std::move(input));
 
-  api_->encoder_encode(enc_, input_pic_,
+  api_->encoder_encode(enc_, input_pic,
                        &data_out, &len_out,
                        &recon_pic, nullptr,
                        &frame_info );
 
+  // Kvazaar now references the picture, so it is not reused until encoded
+  frame = nullptr;
+  if (copied)
+  {
+    pictures->release(input_pic);
+  }
+
   while(data_out != nullptr)
   {
     parseEncodedFrame(data_out, len_out, recon_pic);
@@ -357,44 +913,121 @@ void KvazaarFilter::parseEncodedFrame(kvz_data_chunk *data_out,
   std::unique_ptr<Data> encodedFrame = std::move(encodingFrames_.back());
   encodingFrames_.pop_back();
 
-  std::unique_ptr<uchar[]> hevc_frame(new uchar[len_out]);
-  uint8_t* writer = hevc_frame.get();
-  uint32_t dataWritten = 0;
+  api_->picture_free(recon_pic);
 
-  for (kvz_data_chunk *chunk = data_out; chunk != nullptr; chunk = chunk->next)
+  uint32_t delay = QDateTime::currentMSecsSinceEpoch() - encodedFrame->presentationTime;
+  getStats()->sendDelay("video", delay);
+  getStats()->addEncodedPacket("video", len_out);
+
+  // The chunks are freed once the last NAL unit pointing to them has been sent.
+  const kvz_api* api = api_;
+  std::shared_ptr<kvz_data_chunk> chunks(data_out, [api](kvz_data_chunk* chunk)
+  {
+    api->chunk_free(chunk);
+  });
+
+  // With slices every NAL unit is sent separately as soon as it has been
+  // found, otherwise the whole frame is sent at once.
+  std::vector<uint32_t> nalStarts = {0};
+  if(config_->slices != KVZ_SLICES_NONE)
+  {
+    findNALUnits(data_out, nalStarts);
+  }
+  nalStarts.push_back(len_out);
+
+  kvz_data_chunk* chunk = data_out;
+  uint32_t chunkStart = 0; // offset of chunk in frame
+
+  for(unsigned int nal = 0; nal + 1 < nalStarts.size(); ++nal)
   {
-    if(chunk->len > 3 && chunk->data[0] == 0 && chunk->data[1] == 0
-       && ( chunk->data[2] == 1 || (chunk->data[2] == 0 && chunk->data[3] == 1 ))
-       && dataWritten != 0 && config_->slices != KVZ_SLICES_NONE)
+    uint32_t start = nalStarts.at(nal);
+    uint32_t size = nalStarts.at(nal + 1) - start;
+
+    while(chunk != nullptr && start >= chunkStart + chunk->len)
     {
-      // send previous packet if this is not the first
-      std::unique_ptr<Data> slice(shallowDataCopy(encodedFrame.get()));
+      chunkStart += chunk->len;
+      chunk = chunk->next;
+    }
+
+    if(chunk == nullptr)
+    {
+      printProgramError(this, "Kvazaar output is shorter than reported");
+      break;
+    }
 
-      sendEncodedFrame(std::move(slice), std::move(hevc_frame), dataWritten);
+    FrameBuffer nalData;
+    if(start + size <= chunkStart + chunk->len)
+    {
+      // the NAL unit is sent straight from the chunk Kvazaar wrote it to
+      nalData = FrameBuffer(chunk->data + start - chunkStart, [chunks](){});
+    }
+    else
+    {
+      // spans several chunks, so it has to be copied to be contiguous
+      nalData = FrameBuffer(size);
+      copyChunks(chunk, chunkStart, start, size, nalData.get());
+    }
 
-      hevc_frame = std::unique_ptr<uchar[]>(new uchar[len_out - dataWritten]);
-      writer = hevc_frame.get();
-      dataWritten = 0;
+    if(nal + 2 < nalStarts.size())
+    {
+      std::unique_ptr<Data> slice(shallowDataCopy(encodedFrame.get()));
+      sendEncodedFrame(std::move(slice), std::move(nalData), size);
+    }
+    else
+    {
+      // send last packet reusing input structure
+      sendEncodedFrame(std::move(encodedFrame), std::move(nalData), size);
     }
+  }
+}
 
-    memcpy(writer, chunk->data, chunk->len);
-    writer += chunk->len;
-    dataWritten += chunk->len;
+
+void KvazaarFilter::copyChunks(kvz_data_chunk *chunk, uint32_t chunkStart,
+                               uint32_t start, uint32_t size, uint8_t* destination)
+{
+  uint32_t written = 0;
+  while(chunk != nullptr && written < size)
+  {
+    uint32_t from = start + written - chunkStart;
+    uint32_t copy = std::min(chunk->len - from, size - written);
+    memcpy(destination + written, chunk->data + from, copy);
+    written += copy;
+
+    chunkStart += chunk->len;
+    chunk = chunk->next;
   }
-  api_->chunk_free(data_out);
-  api_->picture_free(recon_pic);
+}
 
-  uint32_t delay = QDateTime::currentMSecsSinceEpoch() - encodedFrame->presentationTime;
-  getStats()->sendDelay("video", delay);
-  getStats()->addEncodedPacket("video", len_out);
 
-  // send last packet reusing input structure
-  sendEncodedFrame(std::move(encodedFrame), std::move(hevc_frame), dataWritten);
+void KvazaarFilter::findNALUnits(kvz_data_chunk *data_out, std::vector<uint32_t>& nalStarts)
+{
+  // Emulation prevention guarantees that 0x000001 only appears in start codes.
+  // The start code may continue to the next chunk.
+  uint32_t offset = 0;
+  uint32_t zeros = 0;
+
+  for (kvz_data_chunk *chunk = data_out; chunk != nullptr; chunk = chunk->next)
+  {
+    for(uint32_t i = 0; i < chunk->len; ++i)
+    {
+      if(chunk->data[i] == 1 && zeros >= 2)
+      {
+        // the start code includes at most three zeros
+        uint32_t start = offset + i - std::min(zeros, (uint32_t)3);
+        if(start != 0)
+        {
+          nalStarts.push_back(start);
+        }
+      }
+      zeros = chunk->data[i] == 0 ? zeros + 1 : 0;
+    }
+    offset += chunk->len;
+  }
 }
 
 
 void KvazaarFilter::sendEncodedFrame(std::unique_ptr<Data> input,
-                                     std::unique_ptr<uchar[]> hevc_frame,
+                                     FrameBuffer hevc_frame,
                                      uint32_t dataWritten)
 {
   input->type = HEVCVIDEO;
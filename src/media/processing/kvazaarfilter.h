@@ -3,6 +3,13 @@
 
 #include <QSize>
 #include <QSettings>
+#include <QStringList>
+#include <QMutex>
+#include <QFuture>
+
+#include <memory>
+#include <vector>
+
 struct kvz_api;
 struct kvz_config;
 struct kvz_encoder;
@@ -14,18 +21,63 @@ class KvazaarFilter : public Filter
 public:
   KvazaarFilter(QString id, StatisticsInterface* stats);
 
-  virtual void updateSettings();
-
   virtual bool init();
 
   void close();
 
+  // Changed settings take effect without stopping the filter. A new encoder
+  // is opened in a worker thread and the filter switches to it at the next
+  // intra frame, so the stream continues during the change.
+  virtual void updateSettings();
+
+  // Encode a simulcast layer with this resolution and share of the bitrate
+  // in settings instead. Call before init.
+  void setLayer(QSize resolution, double bitrateShare);
+
+  // Adapt the bitrate to what the network allows, at most the bitrate in
+  // settings. Halves the framerate if the bitrate is very low.
+  void setTargetBitrate(uint32_t bitrate);
+
+  // Encode the next frame as an intra frame so peers can recover from loss.
+  // Kvazaar cannot do this for an open encoder, so a new one is opened.
+  void requestKeyframe();
+
+  // the resolution the encoder was opened with
+  QSize resolution();
+
+  // The previous filter writes the frame directly to one of our input pictures.
+  virtual FrameBuffer allocateInput(uint32_t size, int16_t width, int16_t height);
+
 protected:
   virtual void process();
 
 private:
 
-  void customParameters(QSettings& settings);
+  // set config according to settings
+  void configure(kvz_config* config, QSettings& settings);
+
+  void customParameters(kvz_config* config, QSettings& settings);
+
+  // values of the settings affecting the encoder, used to detect changes
+  QStringList encoderSettings(QSettings& settings);
+
+  // Open a new encoder with current settings in a worker thread to replace
+  // the current one. If immediate, it replaces the current one at the next
+  // frame. If waitForIntra, it waits longer for an intra frame of the current
+  // one.
+  void reopen(bool immediate = false, bool waitForIntra = false);
+
+  // run by the worker thread, opens encoders until no reopen is requested
+  void openPending();
+
+  // whether an encoder is open, locks pendingMutex_
+  bool encoderOpen();
+
+  // take the reconfigured encoder into use if it is time
+  void swapEncoder(const Data* input);
+
+  // pendingMutex_ must be locked
+  void closePending();
 
   // copy the frame data to kvazaar input in suitable format.
   void feedInput(std::unique_ptr<Data> input);
@@ -34,8 +86,15 @@ private:
   void parseEncodedFrame(kvz_data_chunk *data_out, uint32_t len_out,
                          kvz_picture *recon_pic);
 
+  // copies size bytes starting from frame offset start, chunk begins at chunkStart
+  void copyChunks(kvz_data_chunk *chunk, uint32_t chunkStart,
+                  uint32_t start, uint32_t size, uint8_t* destination);
+
+  // adds the offsets where a NAL unit starts, excluding the first one
+  void findNALUnits(kvz_data_chunk *data_out, std::vector<uint32_t>& nalStarts);
+
   void sendEncodedFrame(std::unique_ptr<Data> input,
-                        std::unique_ptr<uchar[]> hevc_frame,
+                        FrameBuffer hevc_frame,
                         uint32_t dataWritten);
 
 
@@ -45,7 +104,42 @@ private:
 
   int64_t pts_;
 
-  kvz_picture *input_pic_;
+  // Ring of Kvazaar input pictures. Shared with the frame buffers pointing to
+  // them so the pictures stay valid if the encoder is reinitialized.
+  class InputPictures;
+  std::shared_ptr<InputPictures> inputPictures_;
+
+  // settings the current encoder was opened with
+  QStringList settingValues_;
+
+  // Reconfigured encoder waiting to replace the current one. The mutex also
+  // protects replacing enc_ and config_ and the opening state below.
+  QMutex pendingMutex_;
+  kvz_config *pendingConfig_;
+  kvz_encoder *pendingEnc_;
+  std::shared_ptr<InputPictures> pendingPictures_;
+  unsigned int pendingFrames_;
+  unsigned int pendingMaxFrames_;
+  bool pendingImmediate_;
+
+  // the worker thread opening the next encoder
+  QFuture<void> opener_;
+  bool opening_;
+  // settings changed while opening, open again
+  bool reopenAgain_;
+  bool openImmediate_;
+  bool openWaitForIntra_;
+
+  // when the last intra frame was forced
+  int64_t lastKeyframe_;
+
+  QSize layerResolution_;
+  double bitrateShare_;
+
+  // set by rate control, 0 uses settings
+  uint32_t targetBitrate_;
+  unsigned int framerateDivider_;
+  unsigned int inputFrames_;
 
   int32_t framerate_num_;
   int32_t framerate_denom_;
@@ -2,30 +2,186 @@
 
 #include "common.h"
 
+#include "decodescheduler.h"
 #include "statisticsinterface.h"
 
-#include <QSettings>
-
 enum OHThreadType {OH_THREAD_FRAME  = 1, OH_THREAD_SLICE  = 2, OH_THREAD_FRAMESLICE  = 3};
 
+const uint8_t VPS_NAL = 32;
+const uint8_t PPS_NAL = 34;
+
+// How long we wait for the next filters to release our picture before closing
+// the decoder
+const unsigned long MAX_RELEASE_WAIT_MS = 500;
+
+// The frames have piled up because the next filters are not keeping up
+const unsigned int MAX_DECODE_BUFFER = 10;
+
+// Frames waiting in the input buffer. Anything more is late anyway and would
+// only delay the frames after it.
+const unsigned int MAX_BUFFERED_FRAMES = 5;
+
+
+// Reads the bits of a NAL unit payload skipping emulation prevention bytes.
+class NALBitReader
+{
+public:
+  NALBitReader(const unsigned char* data, uint32_t size):
+    data_(data), size_(size), byte_(0), bit_(0), zeros_(0)
+  {}
+
+  bool atEnd() const
+  {
+    return byte_ >= size_;
+  }
+
+  uint32_t bit()
+  {
+    if (atEnd())
+    {
+      return 0;
+    }
+
+    // 0x000003 is followed by the real data
+    if (bit_ == 0 && zeros_ >= 2 && data_[byte_] == 3)
+    {
+      zeros_ = 0;
+      ++byte_;
+      if (atEnd())
+      {
+        return 0;
+      }
+    }
+
+    uint32_t value = (data_[byte_] >> (7 - bit_)) & 1;
+    if (++bit_ == 8)
+    {
+      zeros_ = data_[byte_] == 0 ? zeros_ + 1 : 0;
+      bit_ = 0;
+      ++byte_;
+    }
+    return value;
+  }
+
+  uint32_t bits(unsigned int count)
+  {
+    uint32_t value = 0;
+    for (unsigned int i = 0; i < count; ++i)
+    {
+      value = (value << 1) | bit();
+    }
+    return value;
+  }
+
+  // exp-Golomb, signed values have the same length
+  uint32_t ue()
+  {
+    unsigned int leadingZeros = 0;
+    while (!atEnd() && bit() == 0 && leadingZeros < 32)
+    {
+      ++leadingZeros;
+    }
+    return (1u << leadingZeros) - 1 + bits(leadingZeros);
+  }
+
+private:
+  const unsigned char* data_;
+  uint32_t size_;
+  uint32_t byte_;
+  unsigned int bit_;
+  unsigned int zeros_;
+};
+
+
+// Whether the picture parameter set enables tiles or WPP, which the decoder
+// can decode in parallel within a frame. Data starts after the NAL header.
+bool parallelPPS(const unsigned char* data, uint32_t size)
+{
+  NALBitReader reader(data, size);
+
+  reader.ue();      // pps_pic_parameter_set_id
+  reader.ue();      // pps_seq_parameter_set_id
+  reader.bits(7);   // dependent slices ... cabac_init_present_flag
+  reader.ue();      // num_ref_idx_l0_default_active_minus1
+  reader.ue();      // num_ref_idx_l1_default_active_minus1
+  reader.ue();      // init_qp_minus26
+  reader.bits(2);   // constrained_intra_pred_flag, transform_skip_enabled_flag
+
+  if (reader.bit()) // cu_qp_delta_enabled_flag
+  {
+    reader.ue();    // diff_cu_qp_delta_depth
+  }
+
+  reader.ue();      // pps_cb_qp_offset
+  reader.ue();      // pps_cr_qp_offset
+  reader.bits(4);   // chroma qp offsets ... transquant_bypass_enabled_flag
+
+  bool tiles = reader.bit();
+  bool wpp = reader.bit();
+
+  return !reader.atEnd() && (tiles || wpp);
+}
+
+
+// Whether the first picture in buffer is used as a reference by other pictures.
+// Sub-layer non-reference pictures have even NAL types below 16.
+bool referencePicture(const unsigned char* buff, uint32_t size)
+{
+  for (uint32_t i = 0; i + 3 < size; ++i)
+  {
+    if (buff[i] == 0 && buff[i + 1] == 0 && buff[i + 2] == 1)
+    {
+      uint8_t nalType = (buff[i + 3] >> 1) & 0x3f;
+
+      // skip parameter sets and other non-VCL NAL units
+      if (nalType < VPS_NAL)
+      {
+        return nalType >= 16 || nalType % 2 == 1;
+      }
+      i += 3;
+    }
+  }
+  return true;
+}
+
+
 OpenHEVCFilter::OpenHEVCFilter(uint32_t sessionID, StatisticsInterface *stats):
   Filter(QString::number(sessionID), "OpenHEVC", stats, HEVCVIDEO, YUV420VIDEO),
   handle_(),
+  picture_(std::make_shared<LentPicture>()),
+  decodeBuffer_(),
+  copyPictures_(false),
   parameterSets_(false),
   waitFrames_(0),
-  slices_(true),
+  nalsPerFrame_(0),
+  pictures_(0),
+  threadType_(OH_THREAD_FRAME),
   sessionID_(sessionID),
   threads_(-1)
-{}
+{
+  picture_->filter = this;
+}
+
+
+OpenHEVCFilter::~OpenHEVCFilter()
+{
+  // the picture may outlive us
+  picture_->mutex.lock();
+  picture_->filter = nullptr;
+  picture_->mutex.unlock();
+
+  DecodeScheduler::instance().removeStream(this);
+}
 
 
 bool OpenHEVCFilter::init()
 {
   printNormal(this, "Starting to initiate OpenHEVC");
-  QSettings settings("kvazzup.ini", QSettings::IniFormat);
 
-  threads_ = settings.value("video/OPENHEVC_threads").toInt();
-  handle_ = libOpenHevcInit(threads_, OH_THREAD_FRAME);
+  // the threads are shared with the decoders of other participants
+  DecodeScheduler::instance().addStream(this, sessionID_);
+  threads_ = DecodeScheduler::instance().threads(this);
+  handle_ = libOpenHevcInit(threads_, threadType_);
 
   libOpenHevcSetDebugMode(handle_, 0);
   if(libOpenHevcStartDecoder(handle_) == -1)
@@ -36,10 +192,14 @@ bool OpenHEVCFilter::init()
   libOpenHevcSetTemporalLayer_id(handle_, 0);
   libOpenHevcSetActiveDecoders(handle_, 0);
   libOpenHevcSetViewLayers(handle_, 0);
-  printNormal(this, "OpenHEVC initiation successful.", {"Version"}, {libOpenHevcVersion(handle_)});
+  printNormal(this, "OpenHEVC initiation successful.", {"Version"},
+              {libOpenHevcVersion(handle_)});
 
-  // This is because we don't know anything about the incoming stream
-  maxBufferSize_ = -1; // no buffer limit
+  // The buffer is limited once we know how many NAL units the frames have
+  if (nalsPerFrame_ == 0)
+  {
+    maxBufferSize_ = -1;
+  }
 
   return true;
 }
@@ -48,8 +208,39 @@ bool OpenHEVCFilter::init()
 void OpenHEVCFilter::uninit()
 {
   printNormal(this, "Uniniating.");
-  libOpenHevcFlush(handle_);
-  libOpenHevcClose(handle_);
+
+  // finish the frames of the old decoder
+  while (!decodeBuffer_.empty() && waitPictureRelease())
+  {
+    decodeFrames();
+  }
+  decodeBuffer_.clear();
+
+  waitPictureRelease();
+
+  picture_->mutex.lock();
+  picture_->filter = nullptr;
+  bool released = !picture_->inUse;
+  if (!released)
+  {
+    // closing would free the memory that is still being read
+    picture_->orphan = handle_;
+  }
+  picture_->mutex.unlock();
+
+  if (released)
+  {
+    libOpenHevcFlush(handle_);
+    libOpenHevcClose(handle_);
+  }
+  else
+  {
+    printWarning(this, "Picture was not released, closing the old decoder once it is.");
+  }
+
+  picture_ = std::make_shared<LentPicture>();
+  picture_->filter = this;
+  copyPictures_ = false;
 }
 
 
@@ -66,12 +257,8 @@ void OpenHEVCFilter::run()
 
 void OpenHEVCFilter::updateSettings()
 {
-  QSettings settings("kvazzup.ini", QSettings::IniFormat);
-  if (settings.value("video/OPENHEVC_threads").toInt() != threads_)
-  {
-    uninit();
-    init();
-  }
+  // our share of the budget is taken into use at the next intra frame
+  DecodeScheduler::instance().updateSettings();
   Filter::updateSettings();
 }
 
@@ -84,6 +271,15 @@ void OpenHEVCFilter::combineFrame(std::unique_ptr<Data>& combinedFrame)
     return;
   }
 
+  // a frame of one slice can be decoded as it is
+  if (sliceBuffer_.size() == 1)
+  {
+    combinedFrame = std::move(sliceBuffer_.front());
+    sliceBuffer_.clear();
+    return;
+  }
+
+  // OpenHEVC needs the whole frame in one buffer
   combinedFrame = std::unique_ptr<Data>(shallowDataCopy(sliceBuffer_.at(0).get()));
   combinedFrame->data_size = 0;
 
@@ -92,7 +288,7 @@ void OpenHEVCFilter::combineFrame(std::unique_ptr<Data>& combinedFrame)
     combinedFrame->data_size += sliceBuffer_.at(i)->data_size;
   }
 
-  combinedFrame->data = std::unique_ptr<uchar[]>(new uchar[combinedFrame->data_size]);
+  combinedFrame->data = FrameBuffer(combinedFrame->data_size);
 
   uint32_t dataWritten = 0;
   for(unsigned int i = 0; i < sliceBuffer_.size(); ++i)
@@ -102,19 +298,160 @@ void OpenHEVCFilter::combineFrame(std::unique_ptr<Data>& combinedFrame)
     dataWritten += sliceBuffer_.at(i)->data_size;
   }
 
-  if(slices_ && sliceBuffer_.size() == 1)
+  sliceBuffer_.clear();
+
+  return;
+}
+
+void OpenHEVCFilter::decodeFrames()
+{
+  while (!decodeBuffer_.empty())
+  {
+    if (pictureInUse())
+    {
+      // one frame may wait while the picture is being converted
+      if (!copyPictures_ && decodeBuffer_.size() > 1)
+      {
+        printWarning(this, "Decoded picture is held too long, copying the next ones.");
+        copyPictures_ = true;
+      }
+      return;
+    }
+
+    std::unique_ptr<Data> frame = std::move(decodeBuffer_.front());
+    decodeBuffer_.pop_front();
+    decodeFrame(std::move(frame));
+  }
+}
+
+
+void OpenHEVCFilter::decodeFrame(std::unique_ptr<Data> frame)
+{
+  unsigned int interval = DecodeScheduler::instance().pictureInterval(sessionID_);
+
+  // Hidden and small views do not need all pictures, and the ones no other
+  // picture refers to do not have to be decoded at all.
+  if (interval != 1 && !referencePicture(frame->data.get(), frame->data_size))
   {
-    slices_ = false;
-    printPeerError(this, "Detected no slices in incoming stream.");
-    uninit();
-    init();
+    return;
   }
 
-  sliceBuffer_.clear();
+  int gotPicture = libOpenHevcDecode(handle_, frame->data.get(), frame->data_size, frame->presentationTime);
 
-  return;
+  OpenHevc_Frame openHevcFrame;
+  if( gotPicture == -1)
+  {
+    printDebug(DEBUG_ERROR, this,  "Error while decoding.");
+
+    // the following frames are likely broken too until an intra frame
+    emit keyframeNeeded();
+  }
+  else if(!gotPicture && frame->data_size >= 2)
+  {
+    // TODO: Fix SPS and PPS input to OpenHEVC and enable this debug print.
+    /*
+    const unsigned char *buff2 = frame->data.get();
+    printDebug(DEBUG_WARNING, getName(),  "Could not decode video frame.",
+               {"NAL type"}, {QString() + QString::number(buff2[0]) + QString::number(buff2[1])
+               + QString::number(buff2[2]) + QString::number(buff2[3]) + QString::number(buff2[4] >> 1) });
+     */
+  }
+  else if( libOpenHevcGetOutput(handle_, gotPicture, &openHevcFrame) == -1 )
+  {
+    printDebug(DEBUG_ERROR, this,  "Failed to get output.");
+  }
+  else
+  {
+    libOpenHevcGetPictureInfo(handle_, &openHevcFrame.frameInfo);
+
+    frame->width = openHevcFrame.frameInfo.nWidth;
+    frame->height = openHevcFrame.frameInfo.nHeight;
+    DecodeScheduler::instance().setResolution(this, QSize(frame->width, frame->height));
+
+    // no need to convert and draw pictures nobody sees
+    ++pictures_;
+    if (interval == 0 || pictures_ % interval != 0)
+    {
+      return;
+    }
+
+    frame->planes[0] = (uint8_t*)openHevcFrame.pvY;
+    frame->planes[1] = (uint8_t*)openHevcFrame.pvU;
+    frame->planes[2] = (uint8_t*)openHevcFrame.pvV;
+    frame->strides[0] = openHevcFrame.frameInfo.nYPitch;
+    frame->strides[1] = openHevcFrame.frameInfo.nUPitch;
+    frame->strides[2] = openHevcFrame.frameInfo.nVPitch;
+
+    // TODO: put delay into deque, and set timestamp accordingly to get more accurate latency.
+
+    frame->type = YUV420VIDEO;
+    frame->framerate = openHevcFrame.frameInfo.frameRate.num/openHevcFrame.frameInfo.frameRate.den;
+    frame->data_size = frame->width*frame->height + frame->width*frame->height/2;
+
+    outputPicture(std::move(frame));
+  }
 }
 
+
+void OpenHEVCFilter::outputPicture(std::unique_ptr<Data> frame)
+{
+  if (copyPictures_)
+  {
+    // the copy is ours, so the next frame can be decoded right away
+    packPlanes(frame.get());
+    sendOutput(std::move(frame));
+    return;
+  }
+
+  std::shared_ptr<LentPicture> picture = picture_;
+  picture->mutex.lock();
+  picture->inUse = true;
+  picture->mutex.unlock();
+
+  frame->data = FrameBuffer(frame->planes[0], [picture]()
+  {
+    picture->mutex.lock();
+    picture->inUse = false;
+    picture->released.wakeAll();
+    if (picture->filter)
+    {
+      picture->filter->wakeUp();
+    }
+    if (picture->orphan)
+    {
+      libOpenHevcFlush(picture->orphan);
+      libOpenHevcClose(picture->orphan);
+      picture->orphan = nullptr;
+    }
+    picture->mutex.unlock();
+  });
+
+  sendOutput(std::move(frame));
+}
+
+
+bool OpenHEVCFilter::waitPictureRelease()
+{
+  picture_->mutex.lock();
+  if (picture_->inUse)
+  {
+    picture_->released.wait(&picture_->mutex, MAX_RELEASE_WAIT_MS);
+  }
+  bool released = !picture_->inUse;
+  picture_->mutex.unlock();
+  return released;
+}
+
+
+bool OpenHEVCFilter::pictureInUse()
+{
+  picture_->mutex.lock();
+  bool inUse = picture_->inUse;
+  picture_->mutex.unlock();
+  return inUse;
+}
+
+
 void OpenHEVCFilter::process()
 {
   std::unique_ptr<Data> input = getInput();
@@ -124,21 +461,33 @@ void OpenHEVCFilter::process()
 
     const unsigned char *buff = input->data.get();
 
+    // a long start code begins a new frame, the rest of its NAL units have short ones
     bool nextSlice = buff[0] == 0
         && buff[1] == 0
         && buff[2] == 0;
 
-    if(!slices_ && buff[0] == 0
-       && buff[1] == 0
-       && buff[2] == 1)
+    uint32_t startCode = nextSlice ? 4 : 3;
+    uint8_t nalType = (buff[startCode] >> 1) & 0x3f;
+
+    if (nalType == PPS_NAL && input->data_size > startCode + 2)
     {
-      slices_ = true;
-      printNormal(this, "Detected slices in incoming stream");
-      uninit();
-      init();
+      // Within a frame, tiles and WPP rows can be decoded in parallel without
+      // the delay of frame threads. The new parameters take effect from the
+      // intra frame following them, so the decoder can be restarted here.
+      int threadType = parallelPPS(buff + startCode + 2, input->data_size - startCode - 2) ?
+            OH_THREAD_SLICE : OH_THREAD_FRAME;
+
+      if (threadType != threadType_)
+      {
+        threadType_ = threadType;
+        printNormal(this, "Changing decoder threading", {"Type"},
+                    {threadType_ == OH_THREAD_SLICE ? "Slice" : "Frame"});
+        uninit();
+        init();
+      }
     }
 
-    if(!parameterSets_ && (buff[4] >> 1) == 32)
+    if(!parameterSets_ && nalType == VPS_NAL)
     {
       parameterSets_ = true;
       printNormal(this, "Parameter set found", {"Frame received before"}, {QString::number(waitFrames_)});
@@ -148,6 +497,12 @@ void OpenHEVCFilter::process()
     {
       if(nextSlice && sliceBuffer_.size() != 0)
       {
+        if (sliceBuffer_.size() > nalsPerFrame_)
+        {
+          nalsPerFrame_ = sliceBuffer_.size();
+          maxBufferSize_ = MAX_BUFFERED_FRAMES*nalsPerFrame_;
+        }
+
         std::unique_ptr<Data> frame;
         combineFrame(frame);
 
@@ -156,76 +511,44 @@ void OpenHEVCFilter::process()
           break;
         }
 
-        int gotPicture = libOpenHevcDecode(handle_, frame->data.get(), frame->data_size, frame->presentationTime);
+        decodeBuffer_.push_back(std::move(frame));
 
-        OpenHevc_Frame openHevcFrame;
-        if( gotPicture == -1)
-        {
-          printDebug(DEBUG_ERROR, this,  "Error while decoding.");
-        }
-        else if(!gotPicture && frame->data_size >= 2)
-        {
-          // TODO: Fix SPS and PPS input to OpenHEVC and enable this debug print.
-          /*
-          const unsigned char *buff2 = frame->data.get();
-          printDebug(DEBUG_WARNING, getName(),  "Could not decode video frame.",
-                     {"NAL type"}, {QString() + QString::number(buff2[0]) + QString::number(buff2[1])
-                     + QString::number(buff2[2]) + QString::number(buff2[3]) + QString::number(buff2[4] >> 1) });
-           */
-        }
-        else if( libOpenHevcGetOutput(handle_, gotPicture, &openHevcFrame) == -1 )
+        if (decodeBuffer_.size() > MAX_DECODE_BUFFER)
         {
-          printDebug(DEBUG_ERROR, this,  "Failed to get output.");
+          printWarning(this, "Picture is not being released, discarding frames.",
+                       {"Frames"}, {QString::number(decodeBuffer_.size())});
+          decodeBuffer_.clear();
+          emit keyframeNeeded();
         }
-        else
-        {
-          libOpenHevcGetPictureInfo(handle_, &openHevcFrame.frameInfo);
-
-          frame->width = openHevcFrame.frameInfo.nWidth;
-          frame->height = openHevcFrame.frameInfo.nHeight;
-          uint32_t finalDataSize = frame->width*frame->height + frame->width*frame->height/2;
-          std::unique_ptr<uchar[]> yuv_frame(new uchar[finalDataSize]);
-
-          uint8_t* pY = (uint8_t*)yuv_frame.get();
-          uint8_t* pU = (uint8_t*)&(yuv_frame.get()[frame->width*frame->height]);
-          uint8_t* pV = (uint8_t*)&(yuv_frame.get()[frame->width*frame->height + frame->width*frame->height/4]);
-
-          uint32_t s_stride = openHevcFrame.frameInfo.nYPitch;
-          uint32_t qs_stride = openHevcFrame.frameInfo.nUPitch/2;
-
-          uint32_t d_stride = frame->width/2;
-          uint32_t dd_stride = frame->width;
 
-          for (int i=0; i<frame->height; i++) {
-            memcpy(pY,  (uint8_t *) openHevcFrame.pvY + i*s_stride, dd_stride);
-            pY += dd_stride;
-
-            if (! (i%2) ) {
-              memcpy(pU,  (uint8_t *) openHevcFrame.pvU + i*qs_stride, d_stride);
-              pU += d_stride;
-
-              memcpy(pV,  (uint8_t *) openHevcFrame.pvV + i*qs_stride, d_stride);
-              pV += d_stride;
-            }
-          }
-
-          // TODO: put delay into deque, and set timestamp accordingly to get more accurate latency.
-
-          frame->type = YUV420VIDEO;
-          frame->framerate = openHevcFrame.frameInfo.frameRate.num/openHevcFrame.frameInfo.frameRate.den;
-          frame->data_size = finalDataSize;
-          frame->data = std::move(yuv_frame);
+        decodeFrames();
+      }
 
-          sendOutput(std::move(frame));
-        }
+      // The thread count can only be changed at an intra frame without
+      // breaking the decoding
+      if (nalType == VPS_NAL && DecodeScheduler::instance().threads(this) != threads_)
+      {
+        printNormal(this, "Changing decoder thread count", {"Threads"},
+                    {QString::number(DecodeScheduler::instance().threads(this))});
+        uninit();
+        init();
       }
+
       sliceBuffer_.push_back(std::move(input));
     }
     else
     {
+      // we joined in the middle of the stream, no reason to wait for the intra period
+      if (waitFrames_ == 0)
+      {
+        emit keyframeNeeded();
+      }
       ++waitFrames_;
     }
 
     input = getInput();
   }
+
+  // we may have been woken up by the release of the picture
+  decodeFrames();
 }
@@ -3,10 +3,16 @@
 
 #include "openHevcWrapper.h"
 
+#include <QWaitCondition>
+#include <QMutex>
+
+#include <deque>
+
 class OpenHEVCFilter : public Filter
 {
 public:
   OpenHEVCFilter(uint32_t sessionID, StatisticsInterface* stats);
+  ~OpenHEVCFilter();
 
   virtual bool init();
   void uninit();
@@ -22,17 +28,61 @@ private:
   // combine the slices to a frame.
   void combineFrame(std::unique_ptr<Data> &combinedFrame);
 
+  // decodes the buffered frames as long as the next filters are not reading
+  // our previous picture
+  void decodeFrames();
+  void decodeFrame(std::unique_ptr<Data> frame);
+
+  // The output picture is memory of OpenHEVC which it reuses when the next
+  // frame is decoded. It is given to the next filters without copying, and
+  // they tell us when they are done with it.
+  struct LentPicture
+  {
+    QMutex mutex;
+    QWaitCondition released;
+    bool inUse = false;
+    OpenHEVCFilter* filter = nullptr; // woken up when released
+
+    // a decoder replaced while its picture was in use, closed on release
+    OpenHevc_Handle orphan = nullptr;
+  };
+
+  // gives a picture to the next filters either lent or copied
+  void outputPicture(std::unique_ptr<Data> frame);
+
+  bool pictureInUse();
+
+  // returns false if the picture was not released in time
+  bool waitPictureRelease();
+
   OpenHevc_Handle handle_;
 
+  std::shared_ptr<LentPicture> picture_;
+
+  // complete frames waiting for the picture to be released
+  std::deque<std::unique_ptr<Data>> decodeBuffer_;
+
+  // The next filters have held a picture while frames were waiting, so the
+  // pictures are copied instead of lent until the decoder is restarted.
+  bool copyPictures_;
+
   bool parameterSets_;
 
   uint32_t waitFrames_;
 
-  bool slices_;
+  // most NAL units in a frame so far, the input buffer is sized by it
+  uint32_t nalsPerFrame_;
+
+  // decoded pictures, used to show only some of them in small views
+  uint64_t pictures_;
+
+  // OpenHEVC threading suitable for the incoming stream
+  int threadType_;
 
   std::vector<std::unique_ptr<Data>> sliceBuffer_;
 
   uint32_t sessionID_;
 
+  // our share of the decoding threads
   int threads_;
 };
@@ -0,0 +1,116 @@
+#include "cpufeatures.h"
+
+#include "common.h"
+
+#include <stdint.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+
+static void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4])
+{
+#ifdef _MSC_VER
+  __cpuidex((int*)regs, leaf, subleaf);
+#else
+  __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+
+// which register states the OS saves on context switch
+static uint64_t xgetbv()
+{
+#ifdef _MSC_VER
+  return _xgetbv(0);
+#else
+  uint32_t eax = 0;
+  uint32_t edx = 0;
+  __asm__ volatile ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return (uint64_t)edx << 32 | eax;
+#endif
+}
+
+
+static CPUFeatures detectFeatures()
+{
+  CPUFeatures features = {false, false, false};
+
+  uint32_t regs[4] = {0, 0, 0, 0};
+  cpuid(0, 0, regs);
+  uint32_t maxLeaf = regs[0];
+
+  if (maxLeaf < 1)
+  {
+    return features;
+  }
+
+  cpuid(1, 0, regs);
+  features.sse41 = regs[2] & (1 << 19);
+
+  // AVX registers are only usable if the OS saves them
+  bool osxsave = regs[2] & (1 << 27);
+  uint64_t xcr0 = osxsave ? xgetbv() : 0;
+  bool avxState = (xcr0 & 0x6) == 0x6;
+  bool avx512State = (xcr0 & 0xe6) == 0xe6;
+
+  if (maxLeaf >= 7)
+  {
+    cpuid(7, 0, regs);
+    features.avx2 = avxState && (regs[1] & (1 << 5));
+    features.avx512bw = avx512State && (regs[1] & (1 << 16)) && (regs[1] & (1 << 30));
+  }
+
+  printDebug(DEBUG_NORMAL, "CPUFeatures", "Detected instruction sets",
+             {"SSE4.1", "AVX2", "AVX-512BW"},
+             {features.sse41 ? "yes" : "no", features.avx2 ? "yes" : "no",
+              features.avx512bw ? "yes" : "no"});
+
+  return features;
+}
+
+
+const CPUFeatures& cpuFeatures()
+{
+  static const CPUFeatures features = detectFeatures();
+  return features;
+}
+
+
+SIMDLevel bestSIMD(SIMDLevel kernelMax)
+{
+  const CPUFeatures& features = cpuFeatures();
+
+  if (kernelMax >= SIMD_AVX512 && features.avx512bw)
+  {
+    return SIMD_AVX512;
+  }
+  else if (kernelMax >= SIMD_AVX2 && features.avx2)
+  {
+    return SIMD_AVX2;
+  }
+  else if (kernelMax >= SIMD_SSE41 && features.sse41)
+  {
+    return SIMD_SSE41;
+  }
+  return SIMD_NONE;
+}
+
+
+QString simdName(SIMDLevel level)
+{
+  switch (level)
+  {
+    case SIMD_SSE41:
+      return "SSE4.1";
+    case SIMD_AVX2:
+      return "AVX2";
+    case SIMD_AVX512:
+      return "AVX-512";
+    default:
+      return "Scalar";
+  }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <QString>
+
+// Instruction sets of the CPU we are running on. Detected once with cpuid so
+// the optimized kernels can be selected at runtime and the same binary works
+// on older CPUs.
+
+struct CPUFeatures
+{
+  bool sse41;
+  bool avx2;
+  bool avx512bw;
+};
+
+const CPUFeatures& cpuFeatures();
+
+// The instruction sets kernels are written for, from slowest to fastest.
+enum SIMDLevel {SIMD_NONE = 0, SIMD_SSE41, SIMD_AVX2, SIMD_AVX512};
+
+// the best level supported by both this CPU and the kernel
+SIMDLevel bestSIMD(SIMDLevel kernelMax);
+
+QString simdName(SIMDLevel level);
+
+// The kernels are compiled for their instruction set function by function,
+// so the rest of the program can be built for any x86-64 CPU. MSVC allows
+// intrinsics without flags.
+#if defined(__GNUC__)
+#define TARGET_SSE41  __attribute__((target("sse4.1")))
+#define TARGET_AVX2   __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx2,avx512f,avx512bw")))
+#else
+#define TARGET_SSE41
+#define TARGET_AVX2
+#define TARGET_AVX512
+#endif
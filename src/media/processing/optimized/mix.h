@@ -0,0 +1,179 @@
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <immintrin.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "cpufeatures.h"
+
+// Mixing of 16-bit audio. The streams are accumulated as floats with their
+// gains, and the sum is limited back to 16 bits with a soft knee so that
+// many loud talkers are compressed instead of clipped.
+
+// the limiter leaves the samples below this as they are
+const float MIX_KNEE = 24576.0f;
+
+// the limited samples approach this but never reach it
+const float MIX_CEILING = 32767.0f;
+
+
+// acc += in*gain
+void mix_accumulate_scalar(const int16_t* in, float gain, float* acc, int samples)
+{
+  for (int i = 0; i < samples; ++i)
+  {
+    acc[i] += in[i]*gain;
+  }
+}
+
+
+TARGET_SSE41 void mix_accumulate_sse41(const int16_t* in, float gain, float* acc, int samples)
+{
+  const __m128 g = _mm_set1_ps(gain);
+
+  int i = 0;
+  for (; i + 8 <= samples; i += 8)
+  {
+    __m128i pcm = _mm_loadu_si128((__m128i const*)&in[i]);
+    __m128 low = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(pcm));
+    __m128 high = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(_mm_srli_si128(pcm, 8)));
+
+    _mm_storeu_ps(&acc[i], _mm_add_ps(_mm_loadu_ps(&acc[i]), _mm_mul_ps(low, g)));
+    _mm_storeu_ps(&acc[i + 4], _mm_add_ps(_mm_loadu_ps(&acc[i + 4]), _mm_mul_ps(high, g)));
+  }
+  mix_accumulate_scalar(in + i, gain, acc + i, samples - i);
+}
+
+
+TARGET_AVX2 void mix_accumulate_avx2(const int16_t* in, float gain, float* acc, int samples)
+{
+  const __m256 g = _mm256_set1_ps(gain);
+
+  int i = 0;
+  for (; i + 16 <= samples; i += 16)
+  {
+    __m128i low = _mm_loadu_si128((__m128i const*)&in[i]);
+    __m128i high = _mm_loadu_si128((__m128i const*)&in[i + 8]);
+    __m256 a = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(low));
+    __m256 b = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(high));
+
+    _mm256_storeu_ps(&acc[i], _mm256_add_ps(_mm256_loadu_ps(&acc[i]), _mm256_mul_ps(a, g)));
+    _mm256_storeu_ps(&acc[i + 8], _mm256_add_ps(_mm256_loadu_ps(&acc[i + 8]),
+                                                _mm256_mul_ps(b, g)));
+  }
+  mix_accumulate_scalar(in + i, gain, acc + i, samples - i);
+}
+
+
+// Above the knee the magnitude becomes knee + over/(1 + over/(ceiling - knee)),
+// which continues the signal smoothly and stays below the ceiling.
+void mix_limit_scalar(const float* acc, int16_t* out, int samples)
+{
+  for (int i = 0; i < samples; ++i)
+  {
+    float magnitude = std::fabs(acc[i]);
+    float over = std::max(magnitude - MIX_KNEE, 0.0f);
+    magnitude = std::min(magnitude, MIX_KNEE) + over/(1.0f + over/(MIX_CEILING - MIX_KNEE));
+
+    out[i] = (int16_t)std::lrint(std::copysign(magnitude, acc[i]));
+  }
+}
+
+
+TARGET_SSE41 static inline __m128i mix_limit4_sse41(__m128 x)
+{
+  const __m128 sign_bit = _mm_set1_ps(-0.0f);
+  const __m128 knee = _mm_set1_ps(MIX_KNEE);
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 range = _mm_set1_ps(1.0f/(MIX_CEILING - MIX_KNEE));
+
+  __m128 sign = _mm_and_ps(x, sign_bit);
+  __m128 magnitude = _mm_andnot_ps(sign_bit, x);
+  __m128 over = _mm_max_ps(_mm_sub_ps(magnitude, knee), _mm_setzero_ps());
+
+  magnitude = _mm_add_ps(_mm_min_ps(magnitude, knee),
+                         _mm_div_ps(over, _mm_add_ps(one, _mm_mul_ps(over, range))));
+  return _mm_cvtps_epi32(_mm_or_ps(magnitude, sign));
+}
+
+
+TARGET_SSE41 void mix_limit_sse41(const float* acc, int16_t* out, int samples)
+{
+  int i = 0;
+  for (; i + 8 <= samples; i += 8)
+  {
+    __m128i low = mix_limit4_sse41(_mm_loadu_ps(&acc[i]));
+    __m128i high = mix_limit4_sse41(_mm_loadu_ps(&acc[i + 4]));
+    _mm_storeu_si128((__m128i*)&out[i], _mm_packs_epi32(low, high));
+  }
+  mix_limit_scalar(acc + i, out + i, samples - i);
+}
+
+
+TARGET_AVX2 static inline __m256i mix_limit8_avx2(__m256 x)
+{
+  const __m256 sign_bit = _mm256_set1_ps(-0.0f);
+  const __m256 knee = _mm256_set1_ps(MIX_KNEE);
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 range = _mm256_set1_ps(1.0f/(MIX_CEILING - MIX_KNEE));
+
+  __m256 sign = _mm256_and_ps(x, sign_bit);
+  __m256 magnitude = _mm256_andnot_ps(sign_bit, x);
+  __m256 over = _mm256_max_ps(_mm256_sub_ps(magnitude, knee), _mm256_setzero_ps());
+
+  __m256 compressed = _mm256_div_ps(over, _mm256_add_ps(one, _mm256_mul_ps(over, range)));
+  magnitude = _mm256_add_ps(_mm256_min_ps(magnitude, knee), compressed);
+  return _mm256_cvtps_epi32(_mm256_or_ps(magnitude, sign));
+}
+
+
+TARGET_AVX2 void mix_limit_avx2(const float* acc, int16_t* out, int samples)
+{
+  int i = 0;
+  for (; i + 16 <= samples; i += 16)
+  {
+    __m256i low = mix_limit8_avx2(_mm256_loadu_ps(&acc[i]));
+    __m256i high = mix_limit8_avx2(_mm256_loadu_ps(&acc[i + 8]));
+
+    // packing works within 128-bit lanes, so the quarters have to be reordered
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xd8);
+    _mm256_storeu_si256((__m256i*)&out[i], packed);
+  }
+  mix_limit_scalar(acc + i, out + i, samples - i);
+}
+
+
+void mix_accumulate(SIMDLevel level, const int16_t* in, float gain, float* acc, int samples)
+{
+  if (level >= SIMD_AVX2)
+  {
+    mix_accumulate_avx2(in, gain, acc, samples);
+  }
+  else if (level >= SIMD_SSE41)
+  {
+    mix_accumulate_sse41(in, gain, acc, samples);
+  }
+  else
+  {
+    mix_accumulate_scalar(in, gain, acc, samples);
+  }
+}
+
+
+void mix_limit(SIMDLevel level, const float* acc, int16_t* out, int samples)
+{
+  if (level >= SIMD_AVX2)
+  {
+    mix_limit_avx2(acc, out, samples);
+  }
+  else if (level >= SIMD_SSE41)
+  {
+    mix_limit_sse41(acc, out, samples);
+  }
+  else
+  {
+    mix_limit_scalar(acc, out, samples);
+  }
+}
@@ -0,0 +1,75 @@
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <immintrin.h>
+#include <stdint.h>
+
+#include "cpufeatures.h"
+
+// The inner product of polyphase resampling. Each output sample is one phase
+// of the filter multiplied with the input samples before it. The phases are
+// padded with zeros to a multiple of 8 taps so the vector loops have no tail.
+
+const int RESAMPLE_TAP_ALIGNMENT = 8;
+
+typedef float (*resample_dot)(const float* coeffs, const float* samples, int taps);
+
+
+float resample_dot_scalar(const float* coeffs, const float* samples, int taps)
+{
+  float sum = 0.0f;
+  for (int k = 0; k < taps; ++k)
+  {
+    sum += coeffs[k]*samples[k];
+  }
+  return sum;
+}
+
+
+TARGET_SSE41 float resample_dot_sse41(const float* coeffs, const float* samples, int taps)
+{
+  __m128 sum0 = _mm_setzero_ps();
+  __m128 sum1 = _mm_setzero_ps();
+
+  for (int k = 0; k < taps; k += 8)
+  {
+    sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(&coeffs[k]), _mm_loadu_ps(&samples[k])));
+    sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(&coeffs[k + 4]),
+                                       _mm_loadu_ps(&samples[k + 4])));
+  }
+
+  __m128 sum = _mm_add_ps(sum0, sum1);
+  sum = _mm_hadd_ps(sum, sum);
+  sum = _mm_hadd_ps(sum, sum);
+  return _mm_cvtss_f32(sum);
+}
+
+
+TARGET_AVX2 float resample_dot_avx2(const float* coeffs, const float* samples, int taps)
+{
+  __m256 sum = _mm256_setzero_ps();
+
+  for (int k = 0; k < taps; k += 8)
+  {
+    sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(&coeffs[k]),
+                                           _mm256_loadu_ps(&samples[k])));
+  }
+
+  __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+  half = _mm_hadd_ps(half, half);
+  half = _mm_hadd_ps(half, half);
+  return _mm_cvtss_f32(half);
+}
+
+
+resample_dot resample_kernel(SIMDLevel level)
+{
+  if (level >= SIMD_AVX2)
+  {
+    return resample_dot_avx2;
+  }
+  else if (level >= SIMD_SSE41)
+  {
+    return resample_dot_sse41;
+  }
+  return resample_dot_scalar;
+}
@@ -1,278 +1,360 @@
 #include <emmintrin.h>
-#include <xmmintrin.h>
-#include <pmmintrin.h>
 #include <smmintrin.h>
-#include <stdio.h>
+#include <immintrin.h>
 #include <stdint.h>
-#include <math.h>
 #include <cstring>
 
-#include <QDebug>
+#include "cpufeatures.h"
+#include "rowbands.h"
 
-#include <omp.h>
+// RGB32 to YUV420 conversion. The RGB32 frames are bottom-up so the rows are
+// flipped while converting. Each chroma value is the average of a 2x2 block.
+// Width and height must be even.
+//
+// The kernels convert a band of row pairs [firstPair, lastPair) so the frame
+// can be split between threads. Widths that are not a multiple of the vector
+// width are handled by converting the last vector of the row again from an
+// overlapping position.
 
-int rgb2yuv_i_sse41_single(uint8_t* input, uint8_t* output, int width, int height)
-{
-  const int r_mul_y[4] = { 76, 76, 76, 76 };
-  const int r_mul_u[4] = { -43, -43, -43, -43 };
-  const int r_mul_v[4] = { 127, 127, 127, 127 };
-
-  const int g_mul_y[4] = { 150, 150, 150, 150 };
-  const int g_mul_u[4] = { -84, -84, -84, -84 };
-  const int g_mul_v[4] = { -106, -106, -106, -106 };
+const int RGB2YUV_CHROMA_OFFSET = 255 * 255;
 
-  const int b_mul_y[4] = { 29, 29, 29, 29 };
-  const int b_mul_u[4] = { 127, 127, 127, 127 };
-  const int b_mul_v[4] = { -21, -21, -21, -21 };
+typedef void (*rgb2yuv_band)(const uint8_t* input, uint8_t* output,
+                             int width, int height, int firstPair, int lastPair);
 
-  const __m128i r_y = _mm_loadu_si128((__m128i const*)r_mul_y);
-  const __m128i r_u = _mm_loadu_si128((__m128i const*)r_mul_u);
-  const __m128i r_v = _mm_loadu_si128((__m128i const*)r_mul_v);
 
-  const __m128i g_y = _mm_loadu_si128((__m128i const*)g_mul_y);
-  const __m128i g_u = _mm_loadu_si128((__m128i const*)g_mul_u);
-  const __m128i g_v = _mm_loadu_si128((__m128i const*)g_mul_v);
+void rgb2yuv_band_scalar(const uint8_t* input, uint8_t* output,
+                         int width, int height, int firstPair, int lastPair)
+{
+  uint8_t* out_u = &output[width*height];
+  uint8_t* out_v = &out_u[width*height >> 2];
 
-  const __m128i b_y = _mm_loadu_si128((__m128i const*)b_mul_y);
-  const __m128i b_u = _mm_loadu_si128((__m128i const*)b_mul_u);
-  const __m128i b_v = _mm_loadu_si128((__m128i const*)b_mul_v);
+  for (int pair = firstPair; pair < lastPair; ++pair)
+  {
+    const uint8_t* top = &input[2*pair*width*4];
+    const uint8_t* bottom = top + width*4;
 
-  const int mini[4] = { 0,0,0,0 };
-  const int maxi[4] = { 255, 255, 255, 255 };
+    uint8_t* y_top = &output[(height - 1 - 2*pair)*width];
+    uint8_t* y_bottom = y_top - width;
 
-  const int chroma_offset[4] = { 255 * 255, 255 * 255, 255 * 255, 255 * 255 };
+    for (int x = 0; x < width; ++x)
+    {
+      const uint8_t* t = &top[x*4];
+      const uint8_t* b = &bottom[x*4];
+      y_top[x]    = (76*t[2] + 150*t[1] + 29*t[0]) >> 8;
+      y_bottom[x] = (76*b[2] + 150*b[1] + 29*b[0]) >> 8;
+    }
 
-  uint8_t *in = input;
+    int chromaRow = (height/2 - 1 - pair)*(width/2);
 
-  const __m128i min_val = _mm_loadu_si128((__m128i const*)mini);
-  const __m128i max_val = _mm_loadu_si128((__m128i const*)maxi);
-  const __m128i cr_offset = _mm_loadu_si128((__m128i const*)chroma_offset);
+    for (int x = 0; x < width/2; ++x)
+    {
+      int u[2];
+      int v[2];
+      for (int i = 0; i < 2; ++i)
+      {
+        const uint8_t* t = &top[(2*x + i)*4];
+        const uint8_t* b = &bottom[(2*x + i)*4];
+        int bs = t[0] + b[0];
+        int gs = t[1] + b[1];
+        int rs = t[2] + b[2];
+
+        u[i] = (-43*rs -  84*gs + 127*bs + RGB2YUV_CHROMA_OFFSET) >> 9;
+        v[i] = (127*rs - 106*gs -  21*bs + RGB2YUV_CHROMA_OFFSET) >> 9;
+      }
+      out_u[chromaRow + x] = (u[0] + u[1]) >> 1;
+      out_v[chromaRow + x] = (v[0] + v[1]) >> 1;
+    }
+  }
+}
 
-  //*output = (uint8_t *)malloc(width*height + width*height);
-  uint8_t *out_y = &output[width*height-width];
 
-  int32_t pix = 0;
+// coefficients for B, G, R and alpha of one pixel as 16-bit values
+inline int64_t rgb2yuv_coeffs(int16_t r, int16_t g, int16_t b)
+{
+  return (int64_t)((uint64_t)(uint16_t)r << 32 | (uint64_t)(uint16_t)g << 16 | (uint16_t)b);
+}
 
-  __m128i shufflemask = _mm_set_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 12, 8, 4, 0);
-  __m128i shufflemask_chroma = _mm_set_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 8, 0);
 
-  __m128i shufflemask_b = _mm_set_epi8(-1, -1, -1, 12, -1, -1, -1, 8, -1, -1, -1, 4, -1, -1, -1, 0);
-  __m128i shufflemask_g = _mm_set_epi8(-1, -1, -1, 13, -1, -1, -1, 9, -1, -1, -1, 5, -1, -1, -1, 1);
-  __m128i shufflemask_r = _mm_set_epi8(-1, -1, -1, 14, -1, -1, -1, 10, -1, -1, -1, 6, -1, -1, -1, 2);
+// sum of coefficients times colors for 4 pixels in 16-bit pixel pairs lo and hi
+TARGET_SSE41 inline __m128i rgb2yuv_sse41_sum(__m128i lo, __m128i hi, __m128i coeffs)
+{
+  return _mm_hadd_epi32(_mm_madd_epi16(lo, coeffs), _mm_madd_epi16(hi, coeffs));
+}
 
-  for (int32_t i = 0; i < width*height << 2; i += 16) {
 
-    // Load 16 bytes (4 pixels)
-    const __m128i a = _mm_loadu_si128((__m128i const*) in);
-    in += 16;
+TARGET_SSE41 void rgb2yuv_band_sse41(const uint8_t* input, uint8_t* output,
+                                     int width, int height, int firstPair, int lastPair)
+{
+  if (width < 4)
+  {
+    rgb2yuv_band_scalar(input, output, width, height, firstPair, lastPair);
+    return;
+  }
 
-    __m128i b = _mm_shuffle_epi8(a, shufflemask_b);
-    __m128i g = _mm_shuffle_epi8(a, shufflemask_g);
-    __m128i r = _mm_shuffle_epi8(a, shufflemask_r);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i max_val = _mm_set1_epi32(255);
+  const __m128i cr_offset = _mm_set1_epi32(RGB2YUV_CHROMA_OFFSET);
 
-    __m128i res_y = _mm_max_epi32(min_val, _mm_min_epi32(
-                                    max_val, _mm_srai_epi32(
-                                      _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(r, r_y), _mm_mullo_epi32(g, g_y)),
-                                                    _mm_mullo_epi32(b, b_y)), 8)));
+  const __m128i coeff_y = _mm_set1_epi64x(rgb2yuv_coeffs(76, 150, 29));
+  const __m128i coeff_u = _mm_set1_epi64x(rgb2yuv_coeffs(-43, -84, 127));
+  const __m128i coeff_v = _mm_set1_epi64x(rgb2yuv_coeffs(127, -106, -21));
 
-    __m128i temp_y = _mm_shuffle_epi8(res_y, shufflemask);
+  uint8_t* out_u = &output[width*height];
+  uint8_t* out_v = &out_u[width*height >> 2];
 
-    memcpy(out_y, &temp_y, 4);
-    out_y += 4;
+  for (int pair = firstPair; pair < lastPair; ++pair)
+  {
+    const uint8_t* rows[2] = {&input[2*pair*width*4], &input[(2*pair + 1)*width*4]};
+    uint8_t* out_rows[2] = {&output[(height - 1 - 2*pair)*width],
+                            &output[(height - 2 - 2*pair)*width]};
 
-    pix+=4;
-    if(pix == width) {
-      pix = 0;
-      out_y -= 2 * width;
+    for (int row = 0; row < 2; ++row)
+    {
+      for (int x = 0; x < width; x += 4)
+      {
+        // the last pixels are converted again with the previous ones
+        x = std::min(x, width - 4);
+
+        __m128i a = _mm_loadu_si128((__m128i const*)&rows[row][x*4]);
+        __m128i y = _mm_srli_epi32(rgb2yuv_sse41_sum(_mm_unpacklo_epi8(a, zero),
+                                                     _mm_unpackhi_epi8(a, zero), coeff_y), 8);
+        y = _mm_packus_epi16(_mm_packus_epi32(y, y), zero);
+
+        int32_t temp_y = _mm_cvtsi128_si32(y);
+        memcpy(&out_rows[row][x], &temp_y, 4);
+      }
     }
-  }
 
-  pix = 0;
-  uint8_t *out_u = &output[width*height + (width*height>>2) - (width>>1)];
-  uint8_t *out_v = &out_u[width*height >> 2];
+    uint8_t* u_row = &out_u[(height/2 - 1 - pair)*(width/2)];
+    uint8_t* v_row = &out_v[(height/2 - 1 - pair)*(width/2)];
 
-  for (int i = 0; i < width*height * 4; i += 2 * width * 4)
-  {
-    for (int j = i; j < i + width * 4; j += 4 * 4)
+    for (int x = 0; x < width; x += 4)
     {
-      const __m128i a = _mm_loadu_si128((__m128i const*)&input[j]);
-      const __m128i a2 = _mm_loadu_si128((__m128i const*)&input[j+ width * 4]);
-
-      __m128i b = _mm_shuffle_epi8(a, shufflemask_b);
-      __m128i g = _mm_shuffle_epi8(a, shufflemask_g);
-      __m128i r = _mm_shuffle_epi8(a, shufflemask_r);
-
-      __m128i b2 = _mm_shuffle_epi8(a2, shufflemask_b);
-      __m128i g2 = _mm_shuffle_epi8(a2, shufflemask_g);
-      __m128i r2 = _mm_shuffle_epi8(a2, shufflemask_r);
-
-      __m128i r_sum = _mm_add_epi32(r, r2);
-      __m128i g_sum = _mm_add_epi32(g, g2);
-      __m128i b_sum = _mm_add_epi32(b, b2);
-
-      __m128i res_u_b = _mm_add_epi32(_mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(r_sum, r_u),
-                                                                  _mm_mullo_epi32(g_sum, g_u)),
-                                                    _mm_mullo_epi32(b_sum, b_u)), cr_offset);
-      __m128i res_u_tmp = _mm_max_epi32(min_val, _mm_min_epi32(max_val, _mm_srai_epi32(res_u_b, 9)));
-
-      __m128i res_u = _mm_srai_epi32(_mm_add_epi32(_mm_shuffle_epi32(res_u_tmp, 0xb1), res_u_tmp), 1);
-      __m128i temp_u = _mm_shuffle_epi8(res_u, shufflemask_chroma);
-      memcpy(out_u, &temp_u, 2);
-      out_u += 2;
-
-      __m128i res_v_b = _mm_add_epi32(_mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(r_sum, r_v), _mm_mullo_epi32(g_sum, g_v)),
-                                                    _mm_mullo_epi32(b_sum, b_v)), cr_offset);
-
-      __m128i res_v_tmp = _mm_max_epi32(min_val, _mm_min_epi32(max_val, _mm_srai_epi32(res_v_b, 9)));
-
-      __m128i res_v = _mm_srai_epi32(_mm_add_epi32(_mm_shuffle_epi32(res_v_tmp, 0xb1), res_v_tmp), 1);
-      __m128i temp_v = _mm_shuffle_epi8(res_v, shufflemask_chroma);
-      memcpy(out_v, &temp_v, 2);
-      out_v += 2;
-
-      pix += 4;
-      if (pix == width) {
-        pix = 0;
-        out_u -= width;
-        out_v -= width;
-      }
+      x = std::min(x, width - 4);
+
+      __m128i a = _mm_loadu_si128((__m128i const*)&rows[0][x*4]);
+      __m128i a2 = _mm_loadu_si128((__m128i const*)&rows[1][x*4]);
+
+      // top and bottom pixel summed, fits to 16 bits
+      __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(a2, zero));
+      __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(a2, zero));
+
+      __m128i u = _mm_srai_epi32(_mm_add_epi32(rgb2yuv_sse41_sum(lo, hi, coeff_u), cr_offset), 9);
+      __m128i v = _mm_srai_epi32(_mm_add_epi32(rgb2yuv_sse41_sum(lo, hi, coeff_v), cr_offset), 9);
+      u = _mm_max_epi32(zero, _mm_min_epi32(max_val, u));
+      v = _mm_max_epi32(zero, _mm_min_epi32(max_val, v));
+
+      // average of horizontal neighbours: u01, u23, v01, v23
+      __m128i uv = _mm_srli_epi32(_mm_hadd_epi32(u, v), 1);
+      uv = _mm_packus_epi16(_mm_packus_epi32(uv, uv), zero);
+
+      int32_t temp_uv = _mm_cvtsi128_si32(uv);
+      memcpy(&u_row[x/2], &temp_uv, 2);
+      memcpy(&v_row[x/2], (uint8_t*)&temp_uv + 2, 2);
     }
   }
+}
+
 
-  //_mm_empty();
-  return 1;
+// Same as above for 8 pixels. The 128-bit lanes hold pixels 0-3 and 4-7
+TARGET_AVX2 inline __m256i rgb2yuv_avx2_sum(__m256i lo, __m256i hi, __m256i coeffs)
+{
+  return _mm256_hadd_epi32(_mm256_madd_epi16(lo, coeffs), _mm256_madd_epi16(hi, coeffs));
 }
 
 
-int rgb2yuv_i_sse41(uint8_t* input, uint8_t* output, int width, int height, int threads)
+TARGET_AVX2 void rgb2yuv_band_avx2(const uint8_t* input, uint8_t* output,
+                                   int width, int height, int firstPair, int lastPair)
 {
-  const int r_mul_y[4] = { 76, 76, 76, 76 };
-  const int r_mul_u[4] = { -43, -43, -43, -43 };
-  const int r_mul_v[4] = { 127, 127, 127, 127 };
+  if (width < 8)
+  {
+    rgb2yuv_band_sse41(input, output, width, height, firstPair, lastPair);
+    return;
+  }
 
-  const int g_mul_y[4] = { 150, 150, 150, 150 };
-  const int g_mul_u[4] = { -84, -84, -84, -84 };
-  const int g_mul_v[4] = { -106, -106, -106, -106 };
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i max_val = _mm256_set1_epi32(255);
+  const __m256i cr_offset = _mm256_set1_epi32(RGB2YUV_CHROMA_OFFSET);
 
-  const int b_mul_y[4] = { 29, 29, 29, 29 };
-  const int b_mul_u[4] = { 127, 127, 127, 127 };
-  const int b_mul_v[4] = { -21, -21, -21, -21 };
+  const __m256i coeff_y = _mm256_set1_epi64x(rgb2yuv_coeffs(76, 150, 29));
+  const __m256i coeff_u = _mm256_set1_epi64x(rgb2yuv_coeffs(-43, -84, 127));
+  const __m256i coeff_v = _mm256_set1_epi64x(rgb2yuv_coeffs(127, -106, -21));
 
-  const __m128i r_y = _mm_loadu_si128((__m128i const*)r_mul_y);
-  const __m128i r_u = _mm_loadu_si128((__m128i const*)r_mul_u);
-  const __m128i r_v = _mm_loadu_si128((__m128i const*)r_mul_v);
+  // gathers the first 32 bits of both lanes to the bottom
+  const __m256i lanes = _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0);
+  // u01 u23 v01 v23 u45 u67 v45 v67 -> u01 u23 u45 u67 v01 v23 v45 v67
+  const __m128i chroma_order = _mm_setr_epi8(0, 1, 4, 5, 2, 3, 6, 7,
+                                             -1, -1, -1, -1, -1, -1, -1, -1);
 
-  const __m128i g_y = _mm_loadu_si128((__m128i const*)g_mul_y);
-  const __m128i g_u = _mm_loadu_si128((__m128i const*)g_mul_u);
-  const __m128i g_v = _mm_loadu_si128((__m128i const*)g_mul_v);
+  uint8_t* out_u = &output[width*height];
+  uint8_t* out_v = &out_u[width*height >> 2];
 
-  const __m128i b_y = _mm_loadu_si128((__m128i const*)b_mul_y);
-  const __m128i b_u = _mm_loadu_si128((__m128i const*)b_mul_u);
-  const __m128i b_v = _mm_loadu_si128((__m128i const*)b_mul_v);
+  for (int pair = firstPair; pair < lastPair; ++pair)
+  {
+    const uint8_t* rows[2] = {&input[2*pair*width*4], &input[(2*pair + 1)*width*4]};
+    uint8_t* out_rows[2] = {&output[(height - 1 - 2*pair)*width],
+                            &output[(height - 2 - 2*pair)*width]};
 
-  const int mini[4] = { 0,0,0,0 };
-  const int maxi[4] = { 255, 255, 255, 255 };
+    for (int row = 0; row < 2; ++row)
+    {
+      for (int x = 0; x < width; x += 8)
+      {
+        x = std::min(x, width - 8);
 
-  const int chroma_offset[4] = { 255 * 255, 255 * 255, 255 * 255, 255 * 255 };
+        __m256i a = _mm256_loadu_si256((__m256i const*)&rows[row][x*4]);
+        __m256i y = _mm256_srli_epi32(rgb2yuv_avx2_sum(_mm256_unpacklo_epi8(a, zero),
+                                                       _mm256_unpackhi_epi8(a, zero), coeff_y), 8);
+        y = _mm256_packus_epi16(_mm256_packus_epi32(y, y), zero);
+        y = _mm256_permutevar8x32_epi32(y, lanes);
 
-  const __m128i min_val = _mm_loadu_si128((__m128i const*)mini);
-  const __m128i max_val = _mm_loadu_si128((__m128i const*)maxi);
-  const __m128i cr_offset = _mm_loadu_si128((__m128i const*)chroma_offset);
+        _mm_storel_epi64((__m128i*)&out_rows[row][x], _mm256_castsi256_si128(y));
+      }
+    }
 
-  //*output = (uint8_t *)malloc(width*height + width*height);
-  uint8_t *out_y = &output[width*height-width];
+    uint8_t* u_row = &out_u[(height/2 - 1 - pair)*(width/2)];
+    uint8_t* v_row = &out_v[(height/2 - 1 - pair)*(width/2)];
 
-  __m128i shufflemask = _mm_set_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 12, 8, 4, 0);
-  __m128i shufflemask_chroma = _mm_set_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 8, 0);
+    for (int x = 0; x < width; x += 8)
+    {
+      x = std::min(x, width - 8);
 
-  __m128i shufflemask_b = _mm_set_epi8(-1, -1, -1, 12, -1, -1, -1, 8, -1, -1, -1, 4, -1, -1, -1, 0);
-  __m128i shufflemask_g = _mm_set_epi8(-1, -1, -1, 13, -1, -1, -1, 9, -1, -1, -1, 5, -1, -1, -1, 1);
-  __m128i shufflemask_r = _mm_set_epi8(-1, -1, -1, 14, -1, -1, -1, 10, -1, -1, -1, 6, -1, -1, -1, 2);
+      __m256i a = _mm256_loadu_si256((__m256i const*)&rows[0][x*4]);
+      __m256i a2 = _mm256_loadu_si256((__m256i const*)&rows[1][x*4]);
 
-  // It seems the number of threads needs to be adjusted just before calling omp parrallel
-  omp_set_num_threads(threads);
-  #pragma omp parallel for
-  for (int32_t i = 0; i < width*height << 2; i += 16) {
+      __m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(a2, zero));
+      __m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(a2, zero));
 
-    uint8_t *in = input + i;
+      __m256i u = _mm256_srai_epi32(_mm256_add_epi32(rgb2yuv_avx2_sum(lo, hi, coeff_u), cr_offset), 9);
+      __m256i v = _mm256_srai_epi32(_mm256_add_epi32(rgb2yuv_avx2_sum(lo, hi, coeff_v), cr_offset), 9);
+      u = _mm256_max_epi32(zero, _mm256_min_epi32(max_val, u));
+      v = _mm256_max_epi32(zero, _mm256_min_epi32(max_val, v));
 
-    // Load 16 bytes (4 pixels)
-    const __m128i a = _mm_loadu_si128((__m128i const*) in);
+      __m256i uv = _mm256_srli_epi32(_mm256_hadd_epi32(u, v), 1);
+      uv = _mm256_packus_epi16(_mm256_packus_epi32(uv, uv), zero);
+      uv = _mm256_permutevar8x32_epi32(uv, lanes);
 
-    __m128i b = _mm_shuffle_epi8(a, shufflemask_b);
-    __m128i g = _mm_shuffle_epi8(a, shufflemask_g);
-    __m128i r = _mm_shuffle_epi8(a, shufflemask_r);
+      __m128i ordered = _mm_shuffle_epi8(_mm256_castsi256_si128(uv), chroma_order);
 
-    __m128i res_y = _mm_max_epi32(min_val, _mm_min_epi32(
-                                    max_val, _mm_srai_epi32(
-                                      _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(r, r_y), _mm_mullo_epi32(g, g_y)),
-                                                    _mm_mullo_epi32(b, b_y)), 8)));
+      int32_t temp_u = _mm_cvtsi128_si32(ordered);
+      int32_t temp_v = _mm_extract_epi32(ordered, 1);
+      memcpy(&u_row[x/2], &temp_u, 4);
+      memcpy(&v_row[x/2], &temp_v, 4);
+    }
+  }
+}
 
-    __m128i temp_y = _mm_shuffle_epi8(res_y, shufflemask);
 
-    // this takes advantage of losing the remainder when dividing with width.
-    uint8_t *y_place = out_y + 4*i/16 - (((i/16 - 1)*4)/width)*2*width;
+// 16 pixels at a time. AVX-512 has no horizontal add, so the two halves of
+// each pixel sum are added with a shift and the sums are gathered with a permute.
+TARGET_AVX512 inline __m512i rgb2yuv_avx512_sum(__m512i lo, __m512i hi, __m512i coeffs,
+                                                __m512i gather)
+{
+  __m512i sum_lo = _mm512_madd_epi16(lo, coeffs);
+  __m512i sum_hi = _mm512_madd_epi16(hi, coeffs);
+  sum_lo = _mm512_add_epi32(sum_lo, _mm512_srli_epi64(sum_lo, 32));
+  sum_hi = _mm512_add_epi32(sum_hi, _mm512_srli_epi64(sum_hi, 32));
+  return _mm512_permutex2var_epi32(sum_lo, gather, sum_hi);
+}
 
-    if (i == 0)
-    {
-      y_place = out_y;
-    }
 
-    memcpy(y_place, &temp_y, 4);
+TARGET_AVX512 void rgb2yuv_band_avx512(const uint8_t* input, uint8_t* output,
+                                       int width, int height, int firstPair, int lastPair)
+{
+  if (width < 16)
+  {
+    rgb2yuv_band_avx2(input, output, width, height, firstPair, lastPair);
+    return;
   }
 
-  uint8_t *out_u = &output[width*height + (width*height>>2) - (width>>1)];
-  uint8_t *out_v = &out_u[width*height >> 2];
+  const __m512i zero = _mm512_setzero_si512();
+  const __m512i max_val = _mm512_set1_epi32(255);
+  const __m512i cr_offset = _mm512_set1_epi32(RGB2YUV_CHROMA_OFFSET);
 
-  omp_set_num_threads(threads);
-  #pragma omp parallel for
-  for (int i = 0; i < width*height * 4; i += 2 * width * 4)
-  {
-    for (int j = i; j < i + width * 4; j += 4 * 4)
-    {
-      const __m128i a = _mm_loadu_si128((__m128i const*)&input[j]);
-      const __m128i a2 = _mm_loadu_si128((__m128i const*)&input[j+ width * 4]);
+  const __m512i coeff_y = _mm512_set1_epi64(rgb2yuv_coeffs(76, 150, 29));
+  const __m512i coeff_u = _mm512_set1_epi64(rgb2yuv_coeffs(-43, -84, 127));
+  const __m512i coeff_v = _mm512_set1_epi64(rgb2yuv_coeffs(127, -106, -21));
 
-      __m128i b = _mm_shuffle_epi8(a, shufflemask_b);
-      __m128i g = _mm_shuffle_epi8(a, shufflemask_g);
-      __m128i r = _mm_shuffle_epi8(a, shufflemask_r);
+  // lane k of lo has the sums of pixels 4k and 4k+1, hi has 4k+2 and 4k+3
+  const __m512i gather = _mm512_setr_epi32(0, 2, 16, 18, 4, 6, 20, 22,
+                                           8, 10, 24, 26, 12, 14, 28, 30);
 
-      __m128i b2 = _mm_shuffle_epi8(a2, shufflemask_b);
-      __m128i g2 = _mm_shuffle_epi8(a2, shufflemask_g);
-      __m128i r2 = _mm_shuffle_epi8(a2, shufflemask_r);
+  uint8_t* out_u = &output[width*height];
+  uint8_t* out_v = &out_u[width*height >> 2];
 
-      __m128i r_sum = _mm_add_epi32(r, r2);
-      __m128i g_sum = _mm_add_epi32(g, g2);
-      __m128i b_sum = _mm_add_epi32(b, b2);
+  for (int pair = firstPair; pair < lastPair; ++pair)
+  {
+    const uint8_t* rows[2] = {&input[2*pair*width*4], &input[(2*pair + 1)*width*4]};
+    uint8_t* out_rows[2] = {&output[(height - 1 - 2*pair)*width],
+                            &output[(height - 2 - 2*pair)*width]};
+
+    for (int row = 0; row < 2; ++row)
+    {
+      for (int x = 0; x < width; x += 16)
+      {
+        x = std::min(x, width - 16);
 
-      __m128i res_u_b = _mm_add_epi32(_mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(r_sum, r_u),
-                                                                  _mm_mullo_epi32(g_sum, g_u)),
-                                                    _mm_mullo_epi32(b_sum, b_u)), cr_offset);
-      __m128i res_u_tmp = _mm_max_epi32(min_val, _mm_min_epi32(max_val, _mm_srai_epi32(res_u_b, 9)));
+        __m512i a = _mm512_loadu_si512((void const*)&rows[row][x*4]);
+        __m512i y = _mm512_srli_epi32(rgb2yuv_avx512_sum(_mm512_unpacklo_epi8(a, zero),
+                                                         _mm512_unpackhi_epi8(a, zero),
+                                                         coeff_y, gather), 8);
 
-      __m128i res_u = _mm_srai_epi32(_mm_add_epi32(_mm_shuffle_epi32(res_u_tmp, 0xb1), res_u_tmp), 1);
-      __m128i temp_u = _mm_shuffle_epi8(res_u, shufflemask_chroma);
+        _mm_storeu_si128((__m128i*)&out_rows[row][x], _mm512_cvtepi32_epi8(y));
+      }
+    }
 
+    uint8_t* u_row = &out_u[(height/2 - 1 - pair)*(width/2)];
+    uint8_t* v_row = &out_v[(height/2 - 1 - pair)*(width/2)];
 
-      uint32_t i_laps = i/(2 * width * 4);
-      uint32_t j_laps_per_i = 4*width/16;
-      uint32_t j_laps = (j - i)/16;
+    for (int x = 0; x < width; x += 16)
+    {
+      x = std::min(x, width - 16);
 
-      int32_t loopPlace = 2*(i_laps*j_laps_per_i + j_laps) - ((i_laps*j_laps_per_i + j_laps)/(width/4))*width;
-      memcpy(out_u + loopPlace, &temp_u, 2);
+      __m512i a = _mm512_loadu_si512((void const*)&rows[0][x*4]);
+      __m512i a2 = _mm512_loadu_si512((void const*)&rows[1][x*4]);
 
-      __m128i res_v_b = _mm_add_epi32(_mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(r_sum, r_v), _mm_mullo_epi32(g_sum, g_v)),
-                                                    _mm_mullo_epi32(b_sum, b_v)), cr_offset);
+      __m512i lo = _mm512_add_epi16(_mm512_unpacklo_epi8(a, zero), _mm512_unpacklo_epi8(a2, zero));
+      __m512i hi = _mm512_add_epi16(_mm512_unpackhi_epi8(a, zero), _mm512_unpackhi_epi8(a2, zero));
 
-      __m128i res_v_tmp = _mm_max_epi32(min_val, _mm_min_epi32(max_val, _mm_srai_epi32(res_v_b, 9)));
+      __m512i u = _mm512_srai_epi32(_mm512_add_epi32(rgb2yuv_avx512_sum(lo, hi, coeff_u, gather),
+                                                     cr_offset), 9);
+      __m512i v = _mm512_srai_epi32(_mm512_add_epi32(rgb2yuv_avx512_sum(lo, hi, coeff_v, gather),
+                                                     cr_offset), 9);
+      u = _mm512_max_epi32(zero, _mm512_min_epi32(max_val, u));
+      v = _mm512_max_epi32(zero, _mm512_min_epi32(max_val, v));
 
-      __m128i res_v = _mm_srai_epi32(_mm_add_epi32(_mm_shuffle_epi32(res_v_tmp, 0xb1), res_v_tmp), 1);
-      __m128i temp_v = _mm_shuffle_epi8(res_v, shufflemask_chroma);
+      // neighbours summed to the low half of each 64 bits
+      u = _mm512_srli_epi64(_mm512_add_epi32(u, _mm512_srli_epi64(u, 32)), 1);
+      v = _mm512_srli_epi64(_mm512_add_epi32(v, _mm512_srli_epi64(v, 32)), 1);
 
-      memcpy(out_v + loopPlace, &temp_v, 2);
+      _mm_storel_epi64((__m128i*)&u_row[x/2], _mm512_cvtepi64_epi8(u));
+      _mm_storel_epi64((__m128i*)&v_row[x/2], _mm512_cvtepi64_epi8(v));
     }
   }
+}
+
+
+rgb2yuv_band rgb2yuv_kernel(SIMDLevel level)
+{
+  switch (level)
+  {
+    case SIMD_AVX512:
+      return rgb2yuv_band_avx512;
+    case SIMD_AVX2:
+      return rgb2yuv_band_avx2;
+    case SIMD_SSE41:
+      return rgb2yuv_band_sse41;
+    default:
+      return rgb2yuv_band_scalar;
+  }
+}
+
 
-  //_mm_empty();
-  return 1;
+// Converts the whole frame with kernel. 0 threads means one per core.
+void rgb2yuv(rgb2yuv_band kernel, const uint8_t* input, uint8_t* output,
+             int width, int height, int threads)
+{
+  parallelRows(height/2, threads, [=](int firstPair, int lastPair)
+  {
+    kernel(input, output, width, height, firstPair, lastPair);
+  });
 }
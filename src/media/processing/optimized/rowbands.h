@@ -0,0 +1,43 @@
+#pragma once
+
+#include <QThread>
+#include <QtConcurrent/QtConcurrentMap>
+
+#include <algorithm>
+#include <vector>
+
+// Splits rows of a frame into bands and calls kernel(firstRow, lastRow) for
+// each band on the global thread pool. The pool is shared by all conversions
+// so they don't each start their own threads. The calling thread converts one
+// of the bands while waiting for the rest.
+
+// smaller bands are not worth the synchronization
+const int MIN_BAND_ROWS = 16;
+
+template <typename Kernel>
+void parallelRows(int rows, int threads, Kernel kernel)
+{
+  if (threads <= 0)
+  {
+    threads = std::max(QThread::idealThreadCount(), 1);
+  }
+
+  int bands = std::min(threads, rows/MIN_BAND_ROWS);
+
+  if (bands <= 1)
+  {
+    kernel(0, rows);
+    return;
+  }
+
+  std::vector<int> bandIndexes(bands);
+  for (int i = 0; i < bands; ++i)
+  {
+    bandIndexes[i] = i;
+  }
+
+  QtConcurrent::blockingMap(bandIndexes, [rows, bands, &kernel](int& band)
+  {
+    kernel(rows*band/bands, rows*(band + 1)/bands);
+  });
+}
@@ -0,0 +1,367 @@
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <immintrin.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "cpufeatures.h"
+#include "rowbands.h"
+
+// Scaling of 8-bit planes. A plane has channels interleaved samples per
+// pixel, so YUV420 is scaled as three planes with one channel and RGB32 as
+// one plane with four channels.
+//
+// Each destination row is made in two passes: a vertical pass combines the
+// source rows into a 16-bit row and a horizontal pass makes the destination
+// pixels from it. Bilinear interpolation is used for upscaling and small
+// downscaling, area averaging when downscaling to half or less so no source
+// pixels are skipped.
+
+// weights have 8 bits of precision
+const int SCALE_WEIGHT_BITS = 8;
+const int SCALE_WEIGHT_ONE = 1 << SCALE_WEIGHT_BITS;
+
+// the sums of area are kept in 16 bits
+const int SCALE_MAX_AREA_ROWS = 256;
+
+typedef void (*scale_vertical)(const uint8_t* row0, const uint8_t* row1, int weight,
+                               uint16_t* out, int samples);
+
+
+// Parameters shared by the bands of one plane
+struct ScalePlane
+{
+  const uint8_t* src;
+  int srcWidth;
+  int srcHeight;
+  uint8_t* dst;
+  int dstWidth;
+  int dstHeight;
+  int channels;
+};
+
+
+// out = row0*(256 - weight) + row1*weight. Fits to 16 bits.
+void scale_vertical_scalar(const uint8_t* row0, const uint8_t* row1, int weight,
+                           uint16_t* out, int samples)
+{
+  for (int i = 0; i < samples; ++i)
+  {
+    out[i] = row0[i]*(SCALE_WEIGHT_ONE - weight) + row1[i]*weight;
+  }
+}
+
+
+TARGET_SSE41 void scale_vertical_sse41(const uint8_t* row0, const uint8_t* row1, int weight,
+                                       uint16_t* out, int samples)
+{
+  const __m128i w0 = _mm_set1_epi16(SCALE_WEIGHT_ONE - weight);
+  const __m128i w1 = _mm_set1_epi16(weight);
+
+  int i = 0;
+  for (; i + 8 <= samples; i += 8)
+  {
+    __m128i a = _mm_cvtepu8_epi16(_mm_loadl_epi64((__m128i const*)&row0[i]));
+    __m128i b = _mm_cvtepu8_epi16(_mm_loadl_epi64((__m128i const*)&row1[i]));
+
+    // the products are unsigned and fit to 16 bits so the low half is enough
+    __m128i sum = _mm_add_epi16(_mm_mullo_epi16(a, w0), _mm_mullo_epi16(b, w1));
+    _mm_storeu_si128((__m128i*)&out[i], sum);
+  }
+  scale_vertical_scalar(row0 + i, row1 + i, weight, out + i, samples - i);
+}
+
+
+TARGET_AVX2 void scale_vertical_avx2(const uint8_t* row0, const uint8_t* row1, int weight,
+                                     uint16_t* out, int samples)
+{
+  const __m256i w0 = _mm256_set1_epi16(SCALE_WEIGHT_ONE - weight);
+  const __m256i w1 = _mm256_set1_epi16(weight);
+
+  int i = 0;
+  for (; i + 16 <= samples; i += 16)
+  {
+    __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i const*)&row0[i]));
+    __m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i const*)&row1[i]));
+
+    __m256i sum = _mm256_add_epi16(_mm256_mullo_epi16(a, w0), _mm256_mullo_epi16(b, w1));
+    _mm256_storeu_si256((__m256i*)&out[i], sum);
+  }
+  scale_vertical_scalar(row0 + i, row1 + i, weight, out + i, samples - i);
+}
+
+
+// out += row
+void scale_accumulate_scalar(const uint8_t* row, uint16_t* out, int samples)
+{
+  for (int i = 0; i < samples; ++i)
+  {
+    out[i] += row[i];
+  }
+}
+
+
+TARGET_SSE41 void scale_accumulate_sse41(const uint8_t* row, uint16_t* out, int samples)
+{
+  int i = 0;
+  for (; i + 8 <= samples; i += 8)
+  {
+    __m128i a = _mm_cvtepu8_epi16(_mm_loadl_epi64((__m128i const*)&row[i]));
+    __m128i sum = _mm_add_epi16(_mm_loadu_si128((__m128i const*)&out[i]), a);
+    _mm_storeu_si128((__m128i*)&out[i], sum);
+  }
+  scale_accumulate_scalar(row + i, out + i, samples - i);
+}
+
+
+TARGET_AVX2 void scale_accumulate_avx2(const uint8_t* row, uint16_t* out, int samples)
+{
+  int i = 0;
+  for (; i + 16 <= samples; i += 16)
+  {
+    __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i const*)&row[i]));
+    __m256i sum = _mm256_add_epi16(_mm256_loadu_si256((__m256i const*)&out[i]), a);
+    _mm256_storeu_si256((__m256i*)&out[i], sum);
+  }
+  scale_accumulate_scalar(row + i, out + i, samples - i);
+}
+
+
+// dst[j] = tmp[index[j]]*(256 - weight[j]) + tmp[index[j] + channels]*weight[j]
+void scale_horizontal_scalar(const uint16_t* tmp, const int32_t* index, const int32_t* weight,
+                             int channels, uint8_t* dst, int samples)
+{
+  for (int j = 0; j < samples; ++j)
+  {
+    uint32_t a = tmp[index[j]];
+    uint32_t b = tmp[index[j] + channels];
+    dst[j] = (a*(SCALE_WEIGHT_ONE - weight[j]) + b*weight[j] + (1 << 15)) >> 16;
+  }
+}
+
+
+// The neighbours are gathered as 32-bit values from 16-bit samples, so tmp
+// must have one extra sample after the last neighbour.
+TARGET_AVX2 void scale_horizontal_avx2(const uint16_t* tmp, const int32_t* index,
+                                       const int32_t* weight, int channels,
+                                       uint8_t* dst, int samples)
+{
+  const __m256i low_half = _mm256_set1_epi32(0xffff);
+  const __m256i one = _mm256_set1_epi32(SCALE_WEIGHT_ONE);
+  const __m256i round = _mm256_set1_epi32(1 << 15);
+  const __m256i neighbour = _mm256_set1_epi32(channels);
+  const __m256i lanes = _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0);
+
+  int j = 0;
+  for (; j + 8 <= samples; j += 8)
+  {
+    __m256i idx = _mm256_loadu_si256((__m256i const*)&index[j]);
+    __m256i w1 = _mm256_loadu_si256((__m256i const*)&weight[j]);
+    __m256i w0 = _mm256_sub_epi32(one, w1);
+
+    __m256i a = _mm256_and_si256(_mm256_i32gather_epi32((int const*)tmp, idx, 2), low_half);
+    __m256i b = _mm256_and_si256(_mm256_i32gather_epi32((int const*)tmp,
+                                                        _mm256_add_epi32(idx, neighbour), 2),
+                                 low_half);
+
+    __m256i sum = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(a, w0),
+                                                    _mm256_mullo_epi32(b, w1)), round);
+    sum = _mm256_srli_epi32(sum, 16);
+    sum = _mm256_packus_epi16(_mm256_packus_epi32(sum, sum), sum);
+    sum = _mm256_permutevar8x32_epi32(sum, lanes);
+
+    _mm_storel_epi64((__m128i*)&dst[j], _mm256_castsi256_si128(sum));
+  }
+  scale_horizontal_scalar(tmp, index + j, weight + j, channels, dst + j, samples - j);
+}
+
+
+// Box average of area sums. start[j] is the first sample of the box,
+// count[j] the width of box in pixels and reciprocal 65536/(rows*columns).
+void scale_area_horizontal(const uint16_t* tmp, const int32_t* start, const int32_t* count,
+                           const uint32_t* reciprocal, int channels,
+                           uint8_t* dst, int samples)
+{
+  for (int j = 0; j < samples; ++j)
+  {
+    uint32_t sum = 0;
+    const uint16_t* box = &tmp[start[j]];
+    for (int k = 0; k < count[j]; ++k)
+    {
+      sum += box[k*channels];
+    }
+    dst[j] = std::min<uint32_t>((sum*reciprocal[j] + (1 << 15)) >> 16, 255);
+  }
+}
+
+
+// position of destination pixel center in source with 16 bits of fraction
+inline int64_t scale_position(int dst, int srcSize, int dstSize)
+{
+  int64_t step = ((int64_t)srcSize << 16)/dstSize;
+  return std::max<int64_t>(dst*step + step/2 - (1 << 15), 0);
+}
+
+
+void scale_bilinear_rows(const ScalePlane& plane, SIMDLevel level, int firstRow, int lastRow)
+{
+  const int samples = plane.srcWidth*plane.channels;
+  const int dstSamples = plane.dstWidth*plane.channels;
+
+  // reused between frames, so scaling does not allocate
+  static thread_local std::vector<uint16_t> tmp;
+  static thread_local std::vector<int32_t> index;
+  static thread_local std::vector<int32_t> weight;
+
+  tmp.resize(samples + plane.channels + 2);
+  index.resize(dstSamples);
+  weight.resize(dstSamples);
+
+  for (int x = 0; x < plane.dstWidth; ++x)
+  {
+    int64_t pos = scale_position(x, plane.srcWidth, plane.dstWidth);
+    int x0 = pos >> 16;
+    int fraction = (pos >> (16 - SCALE_WEIGHT_BITS)) & (SCALE_WEIGHT_ONE - 1);
+    if (x0 >= plane.srcWidth - 1)
+    {
+      x0 = plane.srcWidth - 1;
+      fraction = 0;
+    }
+
+    for (int c = 0; c < plane.channels; ++c)
+    {
+      index[x*plane.channels + c] = x0*plane.channels + c;
+      weight[x*plane.channels + c] = fraction;
+    }
+  }
+
+  scale_vertical vertical = scale_vertical_scalar;
+  if (level >= SIMD_AVX2)
+  {
+    vertical = scale_vertical_avx2;
+  }
+  else if (level >= SIMD_SSE41)
+  {
+    vertical = scale_vertical_sse41;
+  }
+
+  for (int y = firstRow; y < lastRow; ++y)
+  {
+    int64_t pos = scale_position(y, plane.srcHeight, plane.dstHeight);
+    int y0 = std::min<int>(pos >> 16, plane.srcHeight - 1);
+    int y1 = std::min(y0 + 1, plane.srcHeight - 1);
+    int fraction = (pos >> (16 - SCALE_WEIGHT_BITS)) & (SCALE_WEIGHT_ONE - 1);
+
+    vertical(&plane.src[y0*samples], &plane.src[y1*samples], fraction, tmp.data(), samples);
+
+    // the last pixel is its own neighbour
+    for (int i = samples; i < (int)tmp.size(); ++i)
+    {
+      tmp[i] = tmp[samples - plane.channels + (i - samples) % plane.channels];
+    }
+
+    uint8_t* out = &plane.dst[y*dstSamples];
+    if (level >= SIMD_AVX2)
+    {
+      scale_horizontal_avx2(tmp.data(), index.data(), weight.data(), plane.channels,
+                            out, dstSamples);
+    }
+    else
+    {
+      scale_horizontal_scalar(tmp.data(), index.data(), weight.data(), plane.channels,
+                              out, dstSamples);
+    }
+  }
+}
+
+
+void scale_area_rows(const ScalePlane& plane, SIMDLevel level, int firstRow, int lastRow)
+{
+  const int samples = plane.srcWidth*plane.channels;
+  const int dstSamples = plane.dstWidth*plane.channels;
+
+  static thread_local std::vector<uint16_t> tmp;
+  static thread_local std::vector<int32_t> start;
+  static thread_local std::vector<int32_t> count;
+  static thread_local std::vector<uint32_t> reciprocal;
+
+  tmp.resize(samples);
+  start.resize(dstSamples);
+  count.resize(dstSamples);
+  reciprocal.resize(dstSamples);
+
+  void (*accumulate)(const uint8_t*, uint16_t*, int) = scale_accumulate_scalar;
+  if (level >= SIMD_AVX2)
+  {
+    accumulate = scale_accumulate_avx2;
+  }
+  else if (level >= SIMD_SSE41)
+  {
+    accumulate = scale_accumulate_sse41;
+  }
+
+  for (int x = 0; x < plane.dstWidth; ++x)
+  {
+    int x0 = (int64_t)x*plane.srcWidth/plane.dstWidth;
+    int x1 = std::max<int>((int64_t)(x + 1)*plane.srcWidth/plane.dstWidth, x0 + 1);
+
+    for (int c = 0; c < plane.channels; ++c)
+    {
+      start[x*plane.channels + c] = x0*plane.channels + c;
+      count[x*plane.channels + c] = x1 - x0;
+    }
+  }
+
+  int reciprocalRows = 0;
+
+  for (int y = firstRow; y < lastRow; ++y)
+  {
+    int y0 = (int64_t)y*plane.srcHeight/plane.dstHeight;
+    int y1 = std::max<int>((int64_t)(y + 1)*plane.srcHeight/plane.dstHeight, y0 + 1);
+    y1 = std::min(y1, y0 + SCALE_MAX_AREA_ROWS);
+
+    std::fill(tmp.begin(), tmp.end(), 0);
+    for (int row = y0; row < y1; ++row)
+    {
+      accumulate(&plane.src[row*samples], tmp.data(), samples);
+    }
+
+    // the box height only varies when the ratio is not an integer
+    if (reciprocalRows != y1 - y0)
+    {
+      reciprocalRows = y1 - y0;
+      for (int j = 0; j < dstSamples; ++j)
+      {
+        int area = count[j]*reciprocalRows;
+        reciprocal[j] = (65536 + area/2)/area;
+      }
+    }
+
+    scale_area_horizontal(tmp.data(), start.data(), count.data(), reciprocal.data(),
+                          plane.channels, &plane.dst[y*dstSamples], dstSamples);
+  }
+}
+
+
+// Scales one plane with the best kernels of level. 0 threads means one per core.
+void scale_plane(SIMDLevel level, const uint8_t* src, int srcWidth, int srcHeight,
+                 uint8_t* dst, int dstWidth, int dstHeight, int channels, int threads)
+{
+  ScalePlane plane = {src, srcWidth, srcHeight, dst, dstWidth, dstHeight, channels};
+
+  bool area = srcWidth >= 2*dstWidth && srcHeight >= 2*dstHeight &&
+      srcHeight/dstHeight < SCALE_MAX_AREA_ROWS;
+
+  parallelRows(dstHeight, threads, [&plane, level, area](int firstRow, int lastRow)
+  {
+    if (area)
+    {
+      scale_area_rows(plane, level, firstRow, lastRow);
+    }
+    else
+    {
+      scale_bilinear_rows(plane, level, firstRow, lastRow);
+    }
+  });
+}
@@ -10,7 +10,14 @@
 
 #include <omp.h>
 
-int yuv2rgb_i_sse41(uint8_t* input, uint8_t* output, uint16_t width, uint16_t height)
+#include "cpufeatures.h"
+
+// The planes may have padding at the end of their rows, strides are the row
+// lengths in bytes. Packed planes have strides of width and width/2.
+
+TARGET_SSE41 int yuv2rgb_i_sse41(const uint8_t* in_y, const uint8_t* in_u, const uint8_t* in_v,
+                                 uint32_t y_stride, uint32_t uv_stride,
+                                 uint8_t* output, uint16_t width, uint16_t height)
 {
   const int mini[4] = { 0,0,0,0 };
   const int middle[4] = { 128, 128, 128, 128 };
@@ -24,9 +31,6 @@ int yuv2rgb_i_sse41(uint8_t* input, uint8_t* output, uint16_t width, uint16_t he
   uint8_t *row_g = (uint8_t *)malloc(width*4);
   uint8_t *row_b = (uint8_t *)malloc(width*4);
 
-  uint8_t *in_y = &input[0];
-  uint8_t *in_u = &input[width*height];
-  uint8_t *in_v = &input[width*height + (width*height >> 2)];
   uint8_t *out = output;
 
   int8_t row = 0;   
@@ -110,6 +114,12 @@ int yuv2rgb_i_sse41(uint8_t* input, uint8_t* output, uint16_t width, uint16_t he
     // Track rows for chroma
     pix += 16;
     if (pix == width) {
+      // skip the padding of rows
+      in_y += y_stride - width;
+      if (!row) {
+        in_u += uv_stride - width/2;
+        in_v += uv_stride - width/2;
+      }
       row = !row;
       pix = 0;
     }
@@ -128,7 +138,9 @@ int yuv2rgb_i_sse41(uint8_t* input, uint8_t* output, uint16_t width, uint16_t he
 // 32 bytes is enough for AVX2
 #define SIMD_ALIGNMENT 32
 
-int yuv2rgb_i_avx2(uint8_t* input, uint8_t* output, uint16_t width, uint16_t height, uint8_t threads)
+TARGET_AVX2 int yuv2rgb_i_avx2(const uint8_t* in_y_base, const uint8_t* in_u_base, const uint8_t* in_v_base,
+                               uint32_t y_stride, uint32_t uv_stride,
+                               uint8_t* output, uint16_t width, uint16_t height, uint8_t threads)
 {
   const int mini[8] = { 0,0,0,0,0,0,0,0 };
   const int middle[8] = { 128, 128, 128, 128,128, 128, 128, 128 };
@@ -138,10 +150,6 @@ int yuv2rgb_i_avx2(uint8_t* input, uint8_t* output, uint16_t width, uint16_t hei
   const __m256i middle_val = _mm256_loadu_si256((__m256i const*)middle);
   const __m256i max_val = _mm256_loadu_si256((__m256i const*)maxi);
 
-  uint8_t *in_y_base = &input[0];;
-  uint8_t *in_u_base = &input[width*height];;
-  uint8_t *in_v_base = &input[width*height + (width*height >> 2)];
-
   __m128i luma_shufflemask_lo = _mm_set_epi8(-1, -1, -1, 3, -1, -1, -1, 2, -1, -1, -1, 1, -1, -1, -1, 0);
   __m128i luma_shufflemask_hi = _mm_set_epi8(-1, -1, -1, 7, -1, -1, -1, 6, -1, -1, -1, 5, -1, -1, -1, 4);
   __m128i chroma_shufflemask_lo = _mm_set_epi8(-1, -1, -1, 1, -1, -1, -1, 1, -1, -1, -1, 0, -1, -1, -1, 0);
@@ -153,9 +161,10 @@ int yuv2rgb_i_avx2(uint8_t* input, uint8_t* output, uint16_t width, uint16_t hei
   for (uint32_t i = 0; i < width*height; i += 16) {
     uint8_t *out = output + 4*i;
 
-    int8_t row = i%(width*2) >= width ? 1 : 0;
+    uint32_t y = i/width;
+    uint32_t x = i%width;
 
-    uint8_t *in_y = in_y_base + i;
+    const uint8_t *in_y = in_y_base + y*y_stride + x;
 
     // Load 16 bytes (16 luma pixels)
     __m128i y_a = _mm_loadu_si128((__m128i const*) in_y);
@@ -167,10 +176,9 @@ int yuv2rgb_i_avx2(uint8_t* input, uint8_t* output, uint16_t width, uint16_t hei
 
     __m128i u_a, v_a;
 
-    int32_t temp = row?width/4:0;
-    uint8_t *in_u = in_u_base + ((i - i%width)/4) + (i%width)/2 - temp;
+    const uint8_t *in_u = in_u_base + (y/2)*uv_stride + x/2;
     u_a = _mm_loadl_epi64((__m128i const*) in_u);
-    uint8_t *in_v = in_v_base + ((i - i%width)/4) + (i%width)/2 - temp;
+    const uint8_t *in_v = in_v_base + (y/2)*uv_stride + x/2;
     v_a = _mm_loadl_epi64((__m128i const*) in_v);
 
     __m128i chroma_u_lo = _mm_shuffle_epi8(u_a, chroma_shufflemask_lo);
@@ -227,7 +235,9 @@ int yuv2rgb_i_avx2(uint8_t* input, uint8_t* output, uint16_t width, uint16_t hei
 }
 
 
-int yuv2rgb_i_avx2_single(uint8_t* input, uint8_t* output, uint16_t width, uint16_t height)
+TARGET_AVX2 int yuv2rgb_i_avx2_single(const uint8_t* in_y, const uint8_t* in_u, const uint8_t* in_v,
+                                      uint32_t y_stride, uint32_t uv_stride,
+                                      uint8_t* output, uint16_t width, uint16_t height)
 {
   const int mini[8] = { 0,0,0,0,0,0,0,0 };
   const int middle[8] = { 128, 128, 128, 128,128, 128, 128, 128 };
@@ -246,10 +256,6 @@ int yuv2rgb_i_avx2_single(uint8_t* input, uint8_t* output, uint16_t width, uint1
   uint8_t *row_g = (uint8_t*)ALIGNED_POINTER(row_g_temp, SIMD_ALIGNMENT);
   uint8_t *row_b = (uint8_t*)ALIGNED_POINTER(row_b_temp, SIMD_ALIGNMENT);
 
-
-  uint8_t *in_y = &input[0];
-  uint8_t *in_u = &input[width*height];
-  uint8_t *in_v = &input[width*height + (width*height >> 2)];
   uint8_t *out = output;
 
   int8_t row = 0;
@@ -355,6 +361,12 @@ int yuv2rgb_i_avx2_single(uint8_t* input, uint8_t* output, uint16_t width, uint1
     // Track rows for chroma
     pix += 16;
     if (pix == width) {
+      // skip the padding of rows
+      in_y += y_stride - width;
+      if (!row) {
+        in_u += uv_stride - width/2;
+        in_v += uv_stride - width/2;
+      }
       row = !row;
       pix = 0;
     }
@@ -13,6 +13,9 @@ OpusDecoderFilter::OpusDecoderFilter(uint32_t sessionID, QAudioFormat format, St
   sessionID_(sessionID)
 {
   pcmOutput_ = new int16_t[max_data_bytes_];
+
+  // only the RTP receiver sends us input
+  enableLockFreeBuffer();
 }
 
 
@@ -62,7 +65,7 @@ void OpusDecoderFilter::process()
 
     if(len > -1)
     {
-      std::unique_ptr<uchar[]> pcm_frame(new uchar[datasize]);
+      FrameBuffer pcm_frame(datasize);
       memcpy(pcm_frame.get(), pcmOutput_, datasize);
       input->data_size = datasize;
 
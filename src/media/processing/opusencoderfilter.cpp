@@ -3,21 +3,28 @@
 #include "statisticsinterface.h"
 
 #include "common.h"
-#include "global.h"
 
 #include <QDateTime>
 #include <QSettings>
 
+// the loss we prepare for with forward error correction
+const int EXPECTED_PACKET_LOSS = 5; // %
 
-OpusEncoderFilter::OpusEncoderFilter(QString id, QAudioFormat format, StatisticsInterface* stats):
+
+OpusEncoderFilter::OpusEncoderFilter(QString id, QAudioFormat format, uint16_t frameDuration,
+                                     StatisticsInterface* stats):
   Filter(id, "Opus Encoder", stats, RAWAUDIO, OPUSAUDIO),
   enc_(nullptr),
   opusOutput_(nullptr),
   max_data_bytes_(65536),
   format_(format),
+  frameDuration_(frameDuration),
   samplesPerFrame_(0)
 {
   opusOutput_ = new uchar[max_data_bytes_];
+
+  // only AEC sends us input
+  enableLockFreeBuffer();
 }
 
 
@@ -42,7 +49,7 @@ bool OpusEncoderFilter::init()
     return false;
   }
 
-  samplesPerFrame_ = format_.sampleRate()/AUDIO_FRAMES_PER_SECOND;
+  samplesPerFrame_ = format_.sampleRate()*frameDuration_/1000;
 
   updateSettings();
 
@@ -61,6 +68,10 @@ void OpusEncoderFilter::updateSettings()
   opus_encoder_ctl(enc_, OPUS_SET_BITRATE(bitrate));
   opus_encoder_ctl(enc_, OPUS_SET_COMPLEXITY(complexity));
 
+  // the receiving jitter buffer recovers a lost packet from the next one
+  opus_encoder_ctl(enc_, OPUS_SET_INBAND_FEC(1));
+  opus_encoder_ctl(enc_, OPUS_SET_PACKET_LOSS_PERC(EXPECTED_PACKET_LOSS));
+
   if (type == "Auto")
   {
     opus_encoder_ctl(enc_, OPUS_SET_SIGNAL(OPUS_AUTO));
@@ -111,7 +122,7 @@ void OpusEncoderFilter::process()
 
     std::unique_ptr<Data> u_copy(shallowDataCopy(input.get()));
 
-    std::unique_ptr<uchar[]> opus_frame(new uchar[len]);
+    FrameBuffer opus_frame(len);
     memcpy(opus_frame.get(), opusOutput_ + pos, len);
     u_copy->data_size = len;
 
@@ -7,7 +7,9 @@
 class OpusEncoderFilter : public Filter
 {
 public:
-  OpusEncoderFilter(QString id, QAudioFormat format, StatisticsInterface* stats);
+  // encodes frames of frameDuration ms
+  OpusEncoderFilter(QString id, QAudioFormat format, uint16_t frameDuration,
+                    StatisticsInterface* stats);
   ~OpusEncoderFilter();
 
   virtual void updateSettings();
@@ -25,5 +27,6 @@ private:
 
   QAudioFormat format_;
 
+  uint16_t frameDuration_;
   uint32_t samplesPerFrame_;
 };
@@ -0,0 +1,75 @@
+#include "resamplefilter.h"
+
+#include "statisticsinterface.h"
+
+#include "common.h"
+
+#include <cstring>
+
+
+ResampleFilter::ResampleFilter(QString id, StatisticsInterface* stats, QAudioFormat input,
+                               QAudioFormat output, uint16_t frameDuration):
+  Filter(id, "Resampler", stats, RAWAUDIO, RAWAUDIO),
+  resampler_(input.sampleRate(), output.sampleRate(), output.channelCount()),
+  outputRate_(output.sampleRate()),
+  frameSamples_(output.sampleRate()*output.channelCount()*frameDuration/1000),
+  output_()
+{
+  if (input.channelCount() != output.channelCount())
+  {
+    printProgramWarning(this, "Resampler does not convert the number of channels");
+  }
+
+  stats->kernelInfo("Resampler", simdName(resampler_.simd()));
+
+  printNormal(this, "Resampling audio", {"Rates"},
+              {QString::number(input.sampleRate()) + " -> " +
+               QString::number(output.sampleRate())});
+
+  // only one filter sends us input
+  enableLockFreeBuffer();
+}
+
+
+void ResampleFilter::process()
+{
+  std::unique_ptr<Data> input = getInput();
+
+  while(input)
+  {
+    resampler_.process((const int16_t*)input->data.get(), input->data_size/sizeof(int16_t),
+                       output_);
+
+    if (frameSamples_ == 0)
+    {
+      uint32_t datasize = output_.size()*sizeof(int16_t);
+      input->data = FrameBuffer(datasize);
+      memcpy(input->data.get(), output_.data(), datasize);
+      input->data_size = datasize;
+      input->framerate = outputRate_;
+      output_.clear();
+
+      sendOutput(std::move(input));
+    }
+    else
+    {
+      // the frame that completes an output frame gives its timing to it
+      uint32_t sent = 0;
+      while (output_.size() - sent >= frameSamples_)
+      {
+        uint32_t datasize = frameSamples_*sizeof(int16_t);
+        std::unique_ptr<Data> frame(shallowDataCopy(input.get()));
+        frame->data = FrameBuffer(datasize);
+        memcpy(frame->data.get(), output_.data() + sent, datasize);
+        frame->data_size = datasize;
+        frame->framerate = outputRate_;
+        sent += frameSamples_;
+
+        sendOutput(std::move(frame));
+      }
+      output_.erase(output_.begin(), output_.begin() + sent);
+    }
+
+    input = getInput();
+  }
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include "filter.h"
+#include "resampler.h"
+
+#include <QAudioFormat>
+
+#include <vector>
+
+// Converts raw audio to another sample rate. With a frame duration the output
+// is cut to frames of exactly that many ms, which AEC and Opus need. Without
+// it each input gives one output so the RTP information of packets is kept.
+
+class ResampleFilter : public Filter
+{
+public:
+  ResampleFilter(QString id, StatisticsInterface* stats, QAudioFormat input,
+                 QAudioFormat output, uint16_t frameDuration = 0);
+
+protected:
+
+  // resamples input until buffer is empty
+  void process();
+
+private:
+
+  Resampler resampler_;
+
+  uint16_t outputRate_;
+
+  // 0 if the input framing is kept
+  uint32_t frameSamples_;
+
+  std::vector<int16_t> output_;
+};
@@ -0,0 +1,137 @@
+#include "resampler.h"
+
+#include "optimized/resample.h"
+
+#include <algorithm>
+#include <cmath>
+
+// the length of the filter in zero crossings of the sinc on each side
+const int ZERO_CROSSINGS = 16;
+
+// the part of the lower Nyquist frequency kept in the passband
+const double PASSBAND = 0.9;
+
+const double PI = 3.14159265358979323846;
+
+
+Resampler::Resampler(uint32_t inputRate, uint32_t outputRate, uint16_t channels):
+  up_(1),
+  down_(1),
+  channels_(std::max(channels, (uint16_t)1)),
+  taps_(0),
+  coeffs_(),
+  simd_(bestSIMD(SIMD_AVX2)),
+  dot_(resample_kernel(simd_)),
+  history_(channels_),
+  index_(0),
+  phase_(0)
+{
+  // greatest common divisor
+  uint32_t a = inputRate;
+  uint32_t b = outputRate;
+  while (b != 0)
+  {
+    uint32_t r = a%b;
+    a = b;
+    b = r;
+  }
+
+  if (a > 0)
+  {
+    up_ = outputRate/a;
+    down_ = inputRate/a;
+  }
+
+  designFilter();
+
+  // the first outputs see silence before the stream
+  index_ = taps_ - 1;
+  for (auto& history : history_)
+  {
+    history.assign(taps_ - 1, 0.0f);
+  }
+}
+
+
+void Resampler::designFilter()
+{
+  // downsampling needs a longer filter for its lower cutoff
+  int taps = 2*ZERO_CROSSINGS*std::max<uint32_t>(1, (down_ + up_ - 1)/up_);
+  taps_ = (taps + RESAMPLE_TAP_ALIGNMENT - 1)/RESAMPLE_TAP_ALIGNMENT*RESAMPLE_TAP_ALIGNMENT;
+
+  // the prototype filter runs at the input rate times up_
+  uint32_t length = taps*up_;
+  double cutoff = PASSBAND*0.5/std::max(up_, down_);
+  double center = (length - 1)/2.0;
+
+  std::vector<double> prototype(length, 0.0);
+  for (uint32_t j = 0; j < length; ++j)
+  {
+    double x = 2*cutoff*(j - center);
+    double sinc = x == 0 ? 1.0 : std::sin(PI*x)/(PI*x);
+
+    // Blackman window
+    double window = 0.42 - 0.5*std::cos(2*PI*j/(length - 1))
+        + 0.08*std::cos(4*PI*j/(length - 1));
+
+    prototype[j] = 2*cutoff*sinc*window;
+  }
+
+  // Phase p gets every up_:th tap starting from p. Each phase is normalized
+  // so that silence stays silent and level stays the same in every phase.
+  coeffs_.assign(up_*taps_, 0.0f);
+  for (uint32_t p = 0; p < up_; ++p)
+  {
+    double sum = 0;
+    for (int k = 0; k < taps; ++k)
+    {
+      sum += prototype[p + k*up_];
+    }
+
+    float* phase = &coeffs_[p*taps_];
+    for (int k = 0; k < taps; ++k)
+    {
+      phase[taps_ - 1 - k] = prototype[p + k*up_]/sum;
+    }
+  }
+}
+
+
+void Resampler::process(const int16_t* input, uint32_t samples, std::vector<int16_t>& output)
+{
+  uint32_t frames = samples/channels_;
+
+  for (uint16_t c = 0; c < channels_; ++c)
+  {
+    std::vector<float>& history = history_[c];
+    history.reserve(history.size() + frames);
+    for (uint32_t i = 0; i < frames; ++i)
+    {
+      history.push_back(input[i*channels_ + c]);
+    }
+  }
+
+  uint32_t available = history_[0].size();
+  while (index_ < available)
+  {
+    const float* coeffs = &coeffs_[phase_*taps_];
+    for (uint16_t c = 0; c < channels_; ++c)
+    {
+      float sample = dot_(coeffs, &history_[c][index_ + 1 - taps_], taps_);
+      sample = std::min(std::max(sample, -32768.0f), 32767.0f);
+      output.push_back((int16_t)std::lrint(sample));
+    }
+
+    phase_ += down_;
+    index_ += phase_/up_;
+    phase_ %= up_;
+  }
+
+  // keep only what the next outputs need
+  uint32_t used = index_ + 1 - taps_;
+  for (auto& history : history_)
+  {
+    history.erase(history.begin(), history.begin() + used);
+  }
+  index_ -= used;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "optimized/cpufeatures.h"
+
+#include <stdint.h>
+#include <vector>
+
+// Converts 16-bit audio from one sample rate to another with a polyphase
+// windowed sinc filter. The rates are reduced to a ratio of up/down, so any
+// pair of rates works. The filter state is kept between calls, so a stream
+// can be given in pieces of any size.
+
+class Resampler
+{
+public:
+  Resampler(uint32_t inputRate, uint32_t outputRate, uint16_t channels);
+
+  // Appends the resampled input to output. Samples are interleaved and
+  // counted over all channels.
+  void process(const int16_t* input, uint32_t samples, std::vector<int16_t>& output);
+
+  SIMDLevel simd() const
+  {
+    return simd_;
+  }
+
+private:
+
+  void designFilter();
+
+  uint32_t up_;
+  uint32_t down_;
+  uint16_t channels_;
+
+  // taps of one phase, padded for the SIMD kernels
+  int taps_;
+
+  // The phases one after the other. The taps of a phase are in reverse order
+  // so they line up with the input samples from oldest to newest.
+  std::vector<float> coeffs_;
+
+  SIMDLevel simd_;
+  float (*dot_)(const float* coeffs, const float* samples, int taps);
+
+  // The input of each channel. The newest input of the next output sample
+  // is at index_ and phase_ tells which phase of the filter it uses.
+  std::vector<std::vector<float>> history_;
+  uint32_t index_;
+  uint32_t phase_;
+};
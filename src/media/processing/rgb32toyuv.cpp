@@ -1,15 +1,18 @@
 #include "rgb32toyuv.h"
 
 #include "optimized/rgb2yuv.h"
+#include "statisticsinterface.h"
 #include "common.h"
 
 #include <QSettings>
+#include <QDebug>
 
 RGB32toYUV::RGB32toYUV(QString id, StatisticsInterface *stats) :
   Filter(id, "RGB32toYUV", stats, RGB32VIDEO, YUV420VIDEO),
-  sse_(true),
+  simd_(bestSIMD(SIMD_AVX512)),
   threadCount_(0)
 {
+  stats->kernelInfo("RGB32 to YUV", simdName(simd_));
   updateSettings();
 }
 
@@ -39,53 +42,19 @@ void RGB32toYUV::process()
 
   while(input)
   {
-    uint32_t finalDataSize = input->width*input->height + input->width*input->height/2;
-    std::unique_ptr<uchar[]> yuv_data(new uchar[finalDataSize]);
-
-    if(sse_ && input->width % 4 == 0)
+    if (input->width % 2 || input->height % 2)
     {
-      if (threadCount_ != 1)
-      {
-        rgb2yuv_i_sse41(input->data.get(), yuv_data.get(), input->width, input->height, threadCount_);
-      }
-      else
-      {
-        rgb2yuv_i_sse41_single(input->data.get(), yuv_data.get(), input->width, input->height);
-      }
+      printDebug(DEBUG_WARNING, this, "Odd resolution cannot be converted to YUV420.",
+                 {"Resolution"}, {QString::number(input->width) + "x" + QString::number(input->height)});
+      input = getInput();
+      continue;
     }
-    else
-    {
-      uint8_t* Y = yuv_data.get();
-      uint8_t* U = &(yuv_data[input->width*input->height]);
-      uint8_t* V = &(yuv_data[input->width*input->height + input->width*input->height/4]);
-
-      // Luma pixels
-      for(unsigned int i = 0; i < input->data_size; i += 4)
-      {
-        int32_t ypixel = 76*input->data[i] + 150 * input->data[i+1]
-            + 29 * input->data[i+2];
-        Y[input->width*input->height - i/4 - 1] = (ypixel + 128) >> 8;
-      }
-
-      for(unsigned int i = 0; i < input->data_size - input->width*4; i += 2*input->width*4)
-      {
-        for(unsigned int j = i; j < i+input->width*4; j += 4*2)
-        {
-          int32_t upixel = -43 * input->data[j+2]                   - 84 * input->data[j+1]                   + 127 * input->data[j];
-          upixel += -43 * input->data[j+2+4]                 - 84 * input->data[j+1+4]                 + 127 * input->data[j+4];
-          upixel += -43 * input->data[j+2+input->width*4]    - 84  * input->data[j+1+input->width*4]   + 127 * input->data[j+input->width*4];
-          upixel += -43 * input->data[j+2+4+input->width*4]  - 84  * input->data[j+1+4+input->width*4] + 127 * input->data[j+4+input->width*4];
-          U[input->width*input->height/4 - (i/16 + (j-i)/8) - 1] = ((upixel + 512) >> 10) + 128;
 
+    uint32_t finalDataSize = input->width*input->height + input->width*input->height/2;
+    // Kvazaar lets us write directly to its input picture
+    FrameBuffer yuv_data = allocateOutput(finalDataSize, input->width, input->height);
 
-          int32_t vpixel =  127 * input->data[j+2]                  - 106 * input->data[j+1]                  - 21 * input->data[j];
-          vpixel +=  127 * input->data[j+2+4]                - 106 * input->data[j+1+4]                - 21 * input->data[j+4];
-          vpixel +=  127 * input->data[j+2+input->width*4]   - 106 * input->data[j+1+input->width*4]   - 21 * input->data[j+input->width*4];
-          vpixel +=  127 * input->data[j+2+4+input->width*4] - 106 * input->data[j+1+4+input->width*4] - 21 * input->data[j+4+input->width*4];
-          V[input->width*input->height/4 - (i/16 + (j-i)/8) - 1] = ((vpixel + 512) >> 10) + 128;
-        }
-      }
-    }
+    rgb2yuv(rgb2yuv_kernel(simd_), input->data.get(), yuv_data.get(), input->width, input->height, threadCount_);
 
     input->type = YUV420VIDEO;
     input->data = std::move(yuv_data);
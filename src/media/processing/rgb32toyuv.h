@@ -1,5 +1,6 @@
 #pragma once
 #include "filter.h"
+#include "optimized/cpufeatures.h"
 
 // converts the RGB32 video frame to and YUV420 frame. May use optimizations.
 
@@ -13,12 +14,13 @@ public:
 
 protected:
 
-  // flips input
+  // flips input. Rows are converted in bands on the global thread pool.
   void process();
 
 private:
 
-  bool sse_;
+  // best instruction set of this CPU our kernels have
+  SIMDLevel simd_;
 
   int threadCount_;
 };
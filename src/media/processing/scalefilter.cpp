@@ -1,29 +1,30 @@
 #include "scalefilter.h"
 
-#include "common.h"
+#include "optimized/scale.h"
+#include "statisticsinterface.h"
 
-#include <QImage>
+#include "common.h"
 
-ScaleFilter::ScaleFilter(QString id, StatisticsInterface *stats):
-  Filter(id, "Scaler", stats, RGB32VIDEO, RGB32VIDEO),
-  newSize_(QSize(0,0))
+ScaleFilter::ScaleFilter(QString id, StatisticsInterface *stats, DataType format):
+  Filter(id, "Scaler", stats, format, format),
+  settingsMutex_(),
+  newSize_(QSize(0,0)),
+  keepAspect_(false),
+  simd_(bestSIMD(SIMD_AVX2))
 {
-
+  stats->kernelInfo("Scaler", simdName(simd_));
 }
 
-void ScaleFilter::setResolution(QSize newResolution)
+void ScaleFilter::setResolution(QSize newResolution, bool keepAspect)
 {
+  settingsMutex_.lock();
   newSize_ = newResolution;
+  keepAspect_ = keepAspect;
+  settingsMutex_.unlock();
 }
 
 void ScaleFilter::process()
 {
-  if(newSize_ == QSize(0,0))
-  {
-    printDebug(DEBUG_PROGRAM_ERROR, this, "Size not set for scaler.");
-    return;
-  }
-
   std::unique_ptr<Data> input = getInput();
   while(input)
   {
@@ -34,49 +35,98 @@ void ScaleFilter::process()
       return;
     }
 
-    QImage::Format format;
-
-    switch(input->type)
+    if(input->type == RGB32VIDEO || input->type == YUV420VIDEO)
+    {
+      input = scaleFrame(std::move(input));
+    }
+    else
     {
-      case RGB32VIDEO:
-      {
-        format = QImage::Format_RGB32;
-        break;
-      }
-      default:
-      {
-        printDebug(DEBUG_PROGRAM_ERROR, this,  "Wrong video format for scaler.",
-                        {"Input type"},{QString::number(input->type)});
-        format = QImage::Format_Invalid;
-        break;
-      }
+      printDebug(DEBUG_PROGRAM_ERROR, this,  "Wrong video format for scaler.",
+                      {"Input type"},{QString::number(input->type)});
     }
 
-    if(format != QImage::Format_Invalid)
+    if(input)
     {
-      input = scaleFrame(std::move(input));
+      sendOutput(std::move(input));
     }
-    sendOutput(std::move(input));
+    input = getInput();
   }
 }
 
 std::unique_ptr<Data> ScaleFilter::scaleFrame(std::unique_ptr<Data> input)
 {
-  QImage image(
-        input->data.get(),
-        input->width,
-        input->height,
-        QImage::Format_RGB32);
-
-  QImage scaled = image.scaled(newSize_);
-  if(newSize_.width() * newSize_.height()
-     > input->width * input->height)
+  QSize size = outputSize(QSize(input->width, input->height));
+
+  if(size.isEmpty())
+  {
+    printDebug(DEBUG_PROGRAM_ERROR, this, "Size not set for scaler.");
+    return nullptr;
+  }
+
+  if(size == QSize(input->width, input->height))
   {
-    input->data = std::unique_ptr<uchar[]>(new uchar[scaled.sizeInBytes()]);
+    return input;
   }
-  memcpy(input->data.get(), scaled.bits(), scaled.sizeInBytes());
-  input->width = newSize_.width();
-  input->height = newSize_.height();
-  input->data_size = scaled.sizeInBytes();
+
+  uint32_t pixels = size.width()*size.height();
+  uint32_t finalDataSize = input->type == RGB32VIDEO ? pixels*4 : pixels + pixels/2;
+
+  // the input data may be shared with other filters so we cannot write over it
+  FrameBuffer scaled = allocateOutput(finalDataSize, size.width(), size.height());
+
+  if(input->type == RGB32VIDEO)
+  {
+    scale_plane(simd_, input->data.get(), input->width, input->height,
+                scaled.get(), size.width(), size.height(), 4, 0);
+  }
+  else
+  {
+    const uint8_t* src = input->data.get();
+    uint8_t* dst = scaled.get();
+
+    // Y, U and V planes one after another
+    for(int plane = 0; plane < 3; ++plane)
+    {
+      int divider = plane == 0 ? 1 : 2;
+      int srcWidth = input->width/divider;
+      int srcHeight = input->height/divider;
+      int dstWidth = size.width()/divider;
+      int dstHeight = size.height()/divider;
+
+      scale_plane(simd_, src, srcWidth, srcHeight, dst, dstWidth, dstHeight, 1, 0);
+
+      src += srcWidth*srcHeight;
+      dst += dstWidth*dstHeight;
+    }
+  }
+
+  input->data = std::move(scaled);
+  input->width = size.width();
+  input->height = size.height();
+  input->data_size = finalDataSize;
   return input;
 }
+
+QSize ScaleFilter::outputSize(QSize input)
+{
+  settingsMutex_.lock();
+  QSize size = newSize_;
+  bool keepAspect = keepAspect_;
+  settingsMutex_.unlock();
+
+  if(keepAspect && !size.isEmpty())
+  {
+    if(input.width() <= size.width() && input.height() <= size.height())
+    {
+      return input;
+    }
+    size = input.scaled(size, Qt::KeepAspectRatio);
+  }
+
+  // YUV420 chroma needs even dimensions
+  if(inputType() == YUV420VIDEO)
+  {
+    size = QSize(size.width() - size.width()%2, size.height() - size.height()%2);
+  }
+  return size;
+}
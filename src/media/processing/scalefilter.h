@@ -1,17 +1,22 @@
 #pragma once
 
 #include "filter.h"
+#include "optimized/cpufeatures.h"
 
 #include <QSize>
+#include <QMutex>
 
-// A filter that can scale video frame.
+// A filter that can scale video frame. Works with both YUV420 and RGB32 so
+// the scaling can be done before the colour conversion.
 
 class ScaleFilter : public Filter
 {
 public:
-  ScaleFilter(QString id, StatisticsInterface *stats);
+  ScaleFilter(QString id, StatisticsInterface *stats, DataType format = RGB32VIDEO);
 
-  void setResolution(QSize newResolution);
+  // With keepAspect the frame is scaled to fit inside the resolution and it
+  // is never made larger, which is what a preview needs.
+  void setResolution(QSize newResolution, bool keepAspect = false);
 
   void process();
 
@@ -19,5 +24,12 @@ public:
 
 private:
 
+  // the output size for this input
+  QSize outputSize(QSize input);
+
+  QMutex settingsMutex_;
   QSize newSize_;
+  bool keepAspect_;
+
+  SIMDLevel simd_;
 };
@@ -37,7 +37,7 @@ void ScreenShareFilter::process()
 
   newImage->presentationTime = QDateTime::currentMSecsSinceEpoch();
   newImage->type = output_;
-  newImage->data = std::unique_ptr<uchar[]>(new uchar[image.sizeInBytes()]);
+  newImage->data = FrameBuffer(image.sizeInBytes());
 
   image = image.mirrored(false, true);
   uchar *bits = image.bits();
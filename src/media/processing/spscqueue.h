@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// A bounded lock-free queue for exactly one producer thread and one consumer
+// thread. The producer may only call push and the consumer may only call pop
+// and peek. Size can be called from both, but it is only a snapshot.
+
+template <typename T>
+class SPSCQueue
+{
+public:
+  // capacity is rounded up to next power of two
+  explicit SPSCQueue(uint32_t capacity):
+    slots_(),
+    mask_(0),
+    head_(0),
+    tail_(0)
+  {
+    uint32_t rounded = 2;
+    while (rounded < capacity)
+    {
+      rounded <<= 1;
+    }
+
+    slots_.resize(rounded);
+    mask_ = rounded - 1;
+  }
+
+  // Producer. Returns false and leaves the item untouched if the queue is full.
+  bool push(std::unique_ptr<T>& item)
+  {
+    const uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == slots_.size())
+    {
+      return false;
+    }
+
+    slots_[tail & mask_] = std::move(item);
+    tail_.store(tail + 1, std::memory_order_seq_cst);
+    return true;
+  }
+
+  // Consumer. Returns nullptr if the queue is empty.
+  std::unique_ptr<T> pop()
+  {
+    const uint32_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire))
+    {
+      return nullptr;
+    }
+
+    std::unique_ptr<T> item = std::move(slots_[head & mask_]);
+    head_.store(head + 1, std::memory_order_release);
+    return item;
+  }
+
+  // Consumer. Returns the item at index counting from the oldest, nullptr if
+  // there is no such item.
+  T* peek(uint32_t index) const
+  {
+    const uint32_t head = head_.load(std::memory_order_relaxed);
+    if (tail_.load(std::memory_order_acquire) - head <= index)
+    {
+      return nullptr;
+    }
+    return slots_[(head + index) & mask_].get();
+  }
+
+  uint32_t size() const
+  {
+    return tail_.load(std::memory_order_seq_cst) - head_.load(std::memory_order_acquire);
+  }
+
+  bool empty() const
+  {
+    return size() == 0;
+  }
+
+  uint32_t capacity() const
+  {
+    return slots_.size();
+  }
+
+private:
+
+  std::vector<std::unique_ptr<T>> slots_;
+  uint32_t mask_;
+
+  // indexes grow forever and wrap around naturally, only the difference matters.
+  // They are on separate cache lines so producer and consumer don't fight over them.
+  alignas(64) std::atomic<uint32_t> head_;
+  alignas(64) std::atomic<uint32_t> tail_;
+};
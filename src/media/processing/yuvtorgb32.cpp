@@ -1,6 +1,7 @@
 #include "yuvtorgb32.h"
 
 #include "optimized/yuv2rgb.h"
+#include "statisticsinterface.h"
 
 #include "common.h"
 
@@ -20,10 +21,10 @@ uint8_t clamp(int32_t input)
 
 YUVtoRGB32::YUVtoRGB32(QString id, StatisticsInterface *stats) :
   Filter(id, "YUVtoRGB32", stats, YUV420VIDEO, RGB32VIDEO),
-  sse_(true),
-  avx2_(true),
+  simd_(bestSIMD(SIMD_AVX2)),
   threadCount_(0)
 {
+  stats->kernelInfo("YUV to RGB32", simdName(simd_));
   updateSettings();
 }
 
@@ -53,41 +54,60 @@ void YUVtoRGB32::process()
   while(input)
   {
     uint32_t finalDataSize = input->width*input->height*4;
-    std::unique_ptr<uchar[]> rgb32_frame(new uchar[finalDataSize]);
+    FrameBuffer rgb32_frame(finalDataSize);
 
+    const uint8_t* y_plane = input->data.get();
+    const uint8_t* u_plane = y_plane + input->width*input->height;
+    const uint8_t* v_plane = u_plane + input->width*input->height/4;
+    uint32_t y_stride = input->width;
+    uint32_t uv_stride = input->width/2;
+
+    // the decoder gives us its own picture with padded rows
+    if (input->planes[0] != nullptr)
+    {
+      y_plane = input->planes[0];
+      u_plane = input->planes[1];
+      v_plane = input->planes[2];
+      y_stride = input->strides[0];
+      uv_stride = input->strides[1];
+    }
 
     // TODO: Select thread count based on input resolution. Anything above fullhd should be around 2
-    if(threadCount_ == 1 && input->width % 16 == 0)
+    if(simd_ >= SIMD_AVX2 && threadCount_ == 1 && input->width % 16 == 0)
     {
-      yuv2rgb_i_avx2_single(input->data.get(), rgb32_frame.get(), input->width, input->height);
+      yuv2rgb_i_avx2_single(y_plane, u_plane, v_plane, y_stride, uv_stride,
+                            rgb32_frame.get(), input->width, input->height);
     }
-    else if(avx2_ && input->width % 16 == 0)
+    else if(simd_ >= SIMD_AVX2 && input->width % 16 == 0)
     {
-      yuv2rgb_i_avx2(input->data.get(), rgb32_frame.get(), input->width, input->height, threadCount_);
+      yuv2rgb_i_avx2(y_plane, u_plane, v_plane, y_stride, uv_stride,
+                     rgb32_frame.get(), input->width, input->height, threadCount_);
     }
-    else if(sse_ && input->width % 16 == 0)
+    else if(simd_ >= SIMD_SSE41 && input->width % 16 == 0)
     {
-      yuv2rgb_i_sse41(input->data.get(), rgb32_frame.get(), input->width, input->height);
+      yuv2rgb_i_sse41(y_plane, u_plane, v_plane, y_stride, uv_stride,
+                      rgb32_frame.get(), input->width, input->height);
     }
     else
     {
       // Luma pixels
-      for(int i = 0; i < input->width*input->height; ++i)
+      for(int y = 0; y < input->height; ++y)
       {
-        rgb32_frame[i*4] = input->data[i];
-        rgb32_frame[i*4+1] = input->data[i];
-        rgb32_frame[i*4+2] = input->data[i];
+        for(int x = 0; x < input->width; ++x)
+        {
+          int i = x + y*input->width;
+          rgb32_frame[i*4] = y_plane[x + y*y_stride];
+          rgb32_frame[i*4+1] = y_plane[x + y*y_stride];
+          rgb32_frame[i*4+2] = y_plane[x + y*y_stride];
+        }
       }
 
-      uint32_t u_offset = input->width*input->height;
-      uint32_t v_offset = input->width*input->height + input->height*input->width/4;
-
       for(int y = 0; y < input->height/2; ++y)
       {
         for(int x = 0; x < input->width/2; ++x)
         {
-          int32_t cr = input->data[x + y*input->width/2 + u_offset] - 128;
-          int32_t cb = input->data[x + y*input->width/2 + v_offset] - 128;
+          int32_t cr = u_plane[x + y*uv_stride] - 128;
+          int32_t cb = v_plane[x + y*uv_stride] - 128;
 
           int32_t rpixel = cr + (cr >> 2) + (cr >> 3) + (cr >> 5);
           int32_t gpixel = - ((cb >> 2) + (cb >> 4) + (cb >> 5)) - ((cr >> 1)+(cr >> 3)+(cr >> 4)+(cr >> 5));
@@ -142,6 +162,7 @@ void YUVtoRGB32::process()
     input->type = RGB32VIDEO;
     input->data = std::move(rgb32_frame);
     input->data_size = finalDataSize;
+    input->planes[0] = nullptr;
     sendOutput(std::move(input));
 
     input = getInput();
@@ -1,5 +1,6 @@
 #pragma once
 #include "filter.h"
+#include "optimized/cpufeatures.h"
 
 // converts the YUV420 video frame to and RGB32 frame. May use optimizations.
 
@@ -10,12 +11,17 @@ public:
 
   virtual void updateSettings();
 
+  virtual bool stridedInput() const
+  {
+    return true;
+  }
+
 protected:
   void process();
 
 private:
-  bool sse_;
-  bool avx2_;
+  // best instruction set of this CPU our kernels have
+  SIMDLevel simd_;
   int threadCount_;
 };
 
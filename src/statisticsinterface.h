@@ -40,6 +40,11 @@ public:
   // one packet has been presented to user
   virtual void presentPackage(uint32_t sessionID, QString type) = 0;
 
+  // how long the jitter buffer holds the media before presentation and
+  // how many packets have arrived too late to be presented in time
+  virtual void jitterBuffer(uint32_t sessionID, QString type, uint32_t targetDelay,
+                            uint32_t lateFrames) = 0;
+
   // For tracking of encoding bitrate and possibly other information.
   virtual void addEncodedPacket(QString type, uint32_t size) = 0;
 
@@ -65,6 +70,9 @@ public:
   // Tracking of packets dropped due to buffer overflow
   virtual void packetDropped(uint32_t id) = 0;
 
+  // which implementation of an optimized kernel was chosen for this CPU
+  virtual void kernelInfo(QString kernel, QString implementation) = 0;
+
 
   // SIP
   // Tracking of sent and received SIP Messages
@@ -87,7 +87,7 @@ StatisticsInterface(),
   fillTableHeaders(ui_->table_outgoing, sessionMutex_,
                           {"IP", "Audio Ports", "Video Ports"});
   fillTableHeaders(ui_->table_incoming, sessionMutex_,
-                          {"IP", "Audio Ports", "Video Ports"});
+                          {"IP", "Audio Ports", "Video Ports", "Audio Buffer", "Video Buffer"});
   fillTableHeaders(ui_->filterTable, filterMutex_,
                           {"Filter", "Info", "TID", "Buffer Size", "Dropped"});
   fillTableHeaders(ui_->sent_list, sipMutex_,
@@ -174,6 +174,7 @@ void StatisticsWindow::addSession(uint32_t sessionID)
                           0, std::vector<ValueInfo*>(BUFFERSIZE, nullptr),
                           0, std::vector<ValueInfo*>(BUFFERSIZE, nullptr),
                           0, std::vector<ValueInfo*>(BUFFERSIZE, nullptr),
+                          0, 0, 0, 0,
                           -1};
 }
 
@@ -270,6 +271,24 @@ uint32_t StatisticsWindow::addFilter(QString type, QString identifier, uint64_t
 }
 
 
+void StatisticsWindow::kernelInfo(QString kernel, QString implementation)
+{
+  // kernel rows are never removed, so they don't affect the filter row indexes
+  filterMutex_.lock();
+  QList<QTableWidgetItem*> existing = ui_->filterTable->findItems(kernel, Qt::MatchExactly);
+  if (!existing.empty())
+  {
+    ui_->filterTable->item(existing.first()->row(), 1)->setText(implementation);
+    filterMutex_.unlock();
+    return;
+  }
+  filterMutex_.unlock();
+
+  addTableRow(ui_->filterTable, filterMutex_, {kernel, implementation, "-", "-", "-"},
+              "Instruction set used by the conversion");
+}
+
+
 void StatisticsWindow::removeFilter(uint32_t id)
 {
   filterMutex_.lock();
@@ -393,6 +412,25 @@ void StatisticsWindow::receiveDelay(uint32_t sessionID, QString type, int32_t de
 }
 
 
+void StatisticsWindow::jitterBuffer(uint32_t sessionID, QString type, uint32_t targetDelay,
+                                    uint32_t lateFrames)
+{
+  if(sessions_.find(sessionID) != sessions_.end())
+  {
+    if(type == "video" || type == "Video")
+    {
+      sessions_.at(sessionID).videoBufferDelay = targetDelay;
+      sessions_.at(sessionID).videoLateFrames = lateFrames;
+    }
+    else if(type == "audio" || type == "Audio")
+    {
+      sessions_.at(sessionID).audioBufferDelay = targetDelay;
+      sessions_.at(sessionID).audioLateFrames = lateFrames;
+    }
+  }
+}
+
+
 void StatisticsWindow::presentPackage(uint32_t sessionID, QString type)
 {
   Q_ASSERT(sessions_.find(sessionID) != sessions_.end());
@@ -629,7 +667,22 @@ void StatisticsWindow::paintEvent(QPaintEvent *event)
     }
     case PARAMETERS_TAB:
     {
-      // do nothing since parameters have no continous data
+      // only the jitter buffers of incoming media change
+      sessionMutex_.lock();
+      for(auto& d : sessions_)
+      {
+        int index = d.second.tableIndex;
+        if (index != -1 && index < ui_->table_incoming->rowCount())
+        {
+          ui_->table_incoming->setItem(index, 3, new QTableWidgetItem(
+                                         QString::number(d.second.audioBufferDelay) + " ms, " +
+                                         QString::number(d.second.audioLateFrames) + " late"));
+          ui_->table_incoming->setItem(index, 4, new QTableWidgetItem(
+                                         QString::number(d.second.videoBufferDelay) + " ms, " +
+                                         QString::number(d.second.videoLateFrames) + " late"));
+        }
+      }
+      sessionMutex_.unlock();
       break;
     }
     case DELIVERY_TAB:
@@ -696,8 +749,9 @@ void StatisticsWindow::paintEvent(QPaintEvent *event)
 
           ui_->v_bitrate_chart->addPoint(d.second.tableIndex + 2, videoBitrate);
           ui_->a_bitrate_chart->addPoint(d.second.tableIndex + 2, audioBitrate);
-          ui_->v_delay_chart->addPoint(d.second.tableIndex + 2, videoDelay);
-          ui_->a_delay_chart->addPoint(d.second.tableIndex + 2, audioDelay);
+          // the media waits in the jitter buffer before it is presented
+          ui_->v_delay_chart->addPoint(d.second.tableIndex + 2, videoDelay + d.second.videoBufferDelay);
+          ui_->a_delay_chart->addPoint(d.second.tableIndex + 2, audioDelay + d.second.audioBufferDelay);
           ui_->v_framerate_chart->addPoint(d.second.tableIndex + 2, presentationVideoFramerate);
 
           sessionMutex_.unlock();
@@ -46,6 +46,8 @@ public:
   virtual void sendDelay(QString type, uint32_t delay);
   virtual void receiveDelay(uint32_t sessionID, QString type, int32_t delay);
   virtual void presentPackage(uint32_t sessionID, QString type);
+  virtual void jitterBuffer(uint32_t sessionID, QString type, uint32_t targetDelay,
+                            uint32_t lateFrames);
   virtual void addEncodedPacket(QString type, uint32_t size);
 
   // delivery
@@ -58,6 +60,7 @@ public:
   virtual void updateBufferStatus(uint32_t id, uint16_t buffersize,
                                   uint16_t maxBufferSize);
   virtual void packetDropped(uint32_t id);
+  virtual void kernelInfo(QString kernel, QString implementation);
 
   // sip
   virtual void addSentSIPMessage(QString type, QString message, QString address);
@@ -130,6 +133,12 @@ private:
     uint32_t audioDelayIndex;
     std::vector<ValueInfo*> audioDelay;
 
+    // jitter buffer delay in ms and packets that arrived too late for it
+    uint32_t videoBufferDelay;
+    uint32_t videoLateFrames;
+    uint32_t audioBufferDelay;
+    uint32_t audioLateFrames;
+
     // index for all UI tables this peer is part of
     int tableIndex;
   };
@@ -1,12 +1,33 @@
 #include "videodrawhelper.h"
 
+#include "media/processing/decodescheduler.h"
+#include "statisticsinterface.h"
+
 #include "common.h"
 
 #include <QDebug>
 #include <QWidget>
 #include <QKeyEvent>
+#include <QEvent>
+#include <QDateTime>
+
+#include <algorithm>
+#include <cstdlib>
+
+// holds the maximum playout delay of 60 fps video
+const uint16_t VIEWBUFFERSIZE = 15;
+
+// ms, after this it is better to show the frames late than to wait for them
+const double MAX_PLAYOUT_DELAY = 200;
 
-const uint16_t VIEWBUFFERSIZE = 5;
+// how many times the jitter we wait, covers most of the arrivals
+const double JITTER_MULTIPLIER = 3;
+
+// ms per frame the minimum transit may rise so it follows the clock drift
+const double TRANSIT_DRIFT = 0.01;
+
+// ms between jitter buffer reports
+const int64_t STATS_INTERVAL = 1000;
 
 
 VideoDrawHelper::VideoDrawHelper(uint32_t sessionID, uint32_t index, uint8_t borderSize):
@@ -16,12 +37,29 @@ VideoDrawHelper::VideoDrawHelper(uint32_t sessionID, uint32_t index, uint8_t bor
   firstImageReceived_(false),
   previousSize_(QSize(0,0)),
   borderSize_(borderSize),
-  currentFrame_(0)
-{}
+  reportedSize_(),
+  currentFrame_(0),
+  stats_(nullptr),
+  playoutTimer_(),
+  transitValid_(false),
+  previousTransit_(0),
+  minTransit_(0),
+  jitter_(0),
+  targetDelay_(0),
+  lateFrames_(0),
+  lastReport_(0)
+{
+  playoutTimer_.setSingleShot(true);
+}
 
 VideoDrawHelper::~VideoDrawHelper()
 {
   frameBuffer_.clear();
+
+  if (reportedSize_.isValid())
+  {
+    DecodeScheduler::instance().removeView(sessionID_);
+  }
 }
 
 void VideoDrawHelper::initWidget(QWidget* widget)
@@ -37,6 +75,41 @@ void VideoDrawHelper::initWidget(QWidget* widget)
   //widget->showFullScreen();
   widget->setWindowState(Qt::WindowFullScreen);
   widget->setUpdatesEnabled(true);
+
+  widget->installEventFilter(this);
+
+  QObject::connect(&playoutTimer_, &QTimer::timeout, widget, [widget]()
+  {
+    widget->update();
+  });
+}
+
+
+bool VideoDrawHelper::eventFilter(QObject* object, QEvent* event)
+{
+  if (event->type() == QEvent::Show || event->type() == QEvent::Hide)
+  {
+    reportView(static_cast<QWidget*>(object));
+  }
+  return QObject::eventFilter(object, event);
+}
+
+
+void VideoDrawHelper::reportView(QWidget* widget)
+{
+  // Our own video is not decoded. Before the first picture we don't know the
+  // size and the decoder must not hold back the picture that would tell us.
+  if (sessionID_ == 0 || !firstImageReceived_)
+  {
+    return;
+  }
+
+  QSize size = widget->isVisible() && !widget->window()->isMinimized() ? targetRect_.size() : QSize(0, 0);
+  if (size != reportedSize_)
+  {
+    reportedSize_ = size;
+    DecodeScheduler::instance().setViewSize(sessionID_, size);
+  }
 }
 
 bool VideoDrawHelper::readyToDraw()
@@ -44,13 +117,50 @@ bool VideoDrawHelper::readyToDraw()
   return firstImageReceived_;
 }
 
-void VideoDrawHelper::inputImage(QWidget* widget, std::unique_ptr<uchar[]> data, QImage &image,
+int64_t VideoDrawHelper::playoutTime(int64_t timestamp)
+{
+  int64_t now = QDateTime::currentMSecsSinceEpoch();
+
+  // our own video is shown as soon as possible
+  if (sessionID_ == 0)
+  {
+    return now;
+  }
+
+  int64_t transit = now - timestamp;
+  if (!transitValid_)
+  {
+    previousTransit_ = transit;
+    minTransit_ = transit;
+    transitValid_ = true;
+  }
+
+  // interarrival jitter as in RFC 3550
+  jitter_ += (std::abs(transit - previousTransit_) - jitter_)/16;
+  previousTransit_ = transit;
+
+  minTransit_ = std::min((double)transit, minTransit_ + TRANSIT_DRIFT);
+  targetDelay_ = (uint32_t)std::min(JITTER_MULTIPLIER*jitter_, MAX_PLAYOUT_DELAY);
+
+  int64_t playout = timestamp + (int64_t)minTransit_ + targetDelay_;
+  if (playout < now)
+  {
+    ++lateFrames_;
+    return now;
+  }
+  return playout;
+}
+
+
+void VideoDrawHelper::inputImage(QWidget* widget, FrameBuffer data, QImage &image,
                                  int64_t timestamp)
 {
+  int64_t playout = playoutTime(timestamp);
+
   if(!firstImageReceived_)
   {
     currentFrame_ = timestamp;
-    lastFrame_ = {image, std::move(data), timestamp};
+    lastFrame_ = {image, std::move(data), timestamp, playout};
     firstImageReceived_ = true;
     updateTargetRect(widget);
   }
@@ -61,13 +171,13 @@ void VideoDrawHelper::inputImage(QWidget* widget, std::unique_ptr<uchar[]> data,
       qDebug() << "Drawing," << metaObject()->className()
                << ": Video widget needs to update its target rectangle because of resolution change.";
       frameBuffer_.clear();
-      frameBuffer_.push_front({image, std::move(data), timestamp});
+      frameBuffer_.push_front({image, std::move(data), timestamp, playout});
 
       updateTargetRect(widget);
     }
     else
     {
-      frameBuffer_.push_front({image, std::move(data), timestamp});
+      frameBuffer_.push_front({image, std::move(data), timestamp, playout});
     }
 
     // delete oldes image if there is too much buffer
@@ -97,18 +207,30 @@ bool VideoDrawHelper::getRecentImage(QImage& image)
   Q_ASSERT(readyToDraw());
   if(readyToDraw())
   {
-    if(!frameBuffer_.empty())
-    {
-      image = frameBuffer_.back().image;
+    int64_t now = QDateTime::currentMSecsSinceEpoch();
+    bool newImage = false;
 
+    // if several frames are due, only the newest of them is worth showing
+    while(!frameBuffer_.empty() && frameBuffer_.back().playoutTime <= now)
+    {
       lastFrame_ = std::move(frameBuffer_.back());
       frameBuffer_.pop_back();
-      return true;
+      newImage = true;
     }
-    else
+
+    if(!frameBuffer_.empty())
     {
-      image = lastFrame_.image;
+      playoutTimer_.start(frameBuffer_.back().playoutTime - now);
     }
+
+    if(stats_ && sessionID_ != 0 && now - lastReport_ >= STATS_INTERVAL)
+    {
+      stats_->jitterBuffer(sessionID_, "Video", targetDelay_, lateFrames_);
+      lastReport_ = now;
+    }
+
+    image = lastFrame_.image;
+    return newImage;
   }
   return false;
 }
@@ -143,6 +265,9 @@ void VideoDrawHelper::updateTargetRect(QWidget* widget)
     newFrameRect_.moveCenter(widget->rect().center());
 
     previousSize_ = lastFrame_.image.size();
+
+    // no reason to spend threads on decoding pixels that are not shown
+    reportView(widget);
   }
   else
   {
@@ -3,11 +3,15 @@
 class QWidget;
 class QMouseEvent;
 class QKeyEvent;
+class StatisticsInterface;
+
+#include "media/processing/framepool.h"
 
 #include <QObject>
 #include <QSize>
 #include <QImage>
 #include <QRect>
+#include <QTimer>
 
 #include <QElapsedTimer>
 
@@ -17,6 +21,10 @@ class QKeyEvent;
 /*
  * Purpose of the VideoDrawHelper is to process all the mouse and keyboard events
  * for video view widgets. It also includes the buffer for images waiting to be drawn.
+ *
+ * Received frames wait in the buffer until their playout time. The playout
+ * delay follows the jitter of the frame arrivals, so the frames are shown at
+ * the pace they were captured instead of the pace the network delivers them.
 */
 
 // This class could possibly be combined with displayfilter.
@@ -33,10 +41,19 @@ public:
 
   void initWidget(QWidget* widget);
 
+  // where the target delay and late frames of the jitter buffer are reported
+  void setStats(StatisticsInterface* stats)
+  {
+    stats_ = stats;
+  }
+
   bool readyToDraw();
-  void inputImage(QWidget *widget, std::unique_ptr<uchar[]> data, QImage &image, int64_t timestamp);
 
-  // returns whether this is a new image or the previous one
+  // timestamp is the media time of the frame in ms
+  void inputImage(QWidget *widget, FrameBuffer data, QImage &image, int64_t timestamp);
+
+  // Gives the newest image whose playout time has come. Returns whether this
+  // is a new image or the previous one.
   bool getRecentImage(QImage& image);
 
   void mouseDoubleClickEvent(QWidget* widget);
@@ -55,6 +72,11 @@ public:
     return newFrameRect_;
   }
 
+protected:
+
+  // follows when the widget is shown and hidden
+  bool eventFilter(QObject* object, QEvent* event);
+
 signals:
 
   void reattach(uint32_t sessionID_);
@@ -64,6 +86,12 @@ private:
   void enterFullscreen(QWidget* widget);
   void exitFullscreen(QWidget* widget);
 
+  // tells the decoder how large the video is shown, if at all
+  void reportView(QWidget* widget);
+
+  // updates the jitter estimate and returns when the frame should be shown
+  int64_t playoutTime(int64_t timestamp);
+
   uint32_t sessionID_;
   uint32_t index_;
 
@@ -77,15 +105,34 @@ private:
 
   int borderSize_;
 
+  QSize reportedSize_;
+
   struct Frame
   {
     QImage image;
-    std::unique_ptr<uchar[]> data;
+    FrameBuffer data;
     int64_t timestamp;
+    int64_t playoutTime;
   };
 
   Frame lastFrame_;
   std::deque<Frame> frameBuffer_;
 
   int64_t currentFrame_;
+
+  StatisticsInterface* stats_;
+
+  // wakes the widget when the next frame is due
+  QTimer playoutTimer_;
+
+  // transit is the arrival time minus the media time. Its variation is the
+  // jitter and its minimum is the transit without any queuing.
+  bool transitValid_;
+  int64_t previousTransit_;
+  double minTransit_;
+  double jitter_;
+
+  uint32_t targetDelay_;
+  uint32_t lateFrames_;
+  int64_t lastReport_;
 };
@@ -26,7 +26,7 @@ VideoGLWidget::VideoGLWidget(QWidget* parent, uint32_t sessionID, uint32_t index
 VideoGLWidget::~VideoGLWidget()
 {}
 
-void VideoGLWidget::inputImage(std::unique_ptr<uchar[]> data, QImage &image, int64_t timestamp)
+void VideoGLWidget::inputImage(FrameBuffer data, QImage &image, int64_t timestamp)
 {
   drawMutex_.lock();
   // if the resolution has changed in video
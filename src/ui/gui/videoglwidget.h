@@ -31,10 +31,11 @@ public:
   void setStats(StatisticsInterface* stats)
   {
     stats_ = stats;
+    helper_.setStats(stats);
   }
 
-  // Takes ownership of the image data
-  void inputImage(std::unique_ptr<uchar[]> data, QImage &image, int64_t timestamp);
+  // Holds a reference to the image data until the image has been drawn
+  void inputImage(FrameBuffer data, QImage &image, int64_t timestamp);
 
   virtual VideoFormat supportedFormat()
   {
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "media/processing/framepool.h"
+
 #include <QImage>
 
 #include <memory>
@@ -22,8 +24,9 @@ public:
   // set stats to use with this video view.
   virtual void setStats(StatisticsInterface* stats) = 0;
 
-  // Takes ownership of the image data
-  virtual void inputImage(std::unique_ptr<uchar[]> data, QImage &image, int64_t timestamp) = 0;
+  // Holds a reference to the image data until the image has been drawn.
+  // The timestamp is the media time in ms, which paces the presentation.
+  virtual void inputImage(FrameBuffer data, QImage &image, int64_t timestamp) = 0;
 
   virtual VideoFormat supportedFormat() = 0;
 };
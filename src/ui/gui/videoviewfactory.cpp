@@ -15,7 +15,8 @@
 VideoviewFactory::VideoviewFactory():
   sessionIDtoWidgetlist_(),
   sessionIDtoVideolist_(),
-  opengl_(false)
+  yuvChecked_(false),
+  yuvSupported_(false)
 {}
 
 uint32_t VideoviewFactory::createWidget(uint32_t sessionID, QWidget* parent,
@@ -29,7 +30,18 @@ uint32_t VideoviewFactory::createWidget(uint32_t sessionID, QWidget* parent,
   QWidget* vw = nullptr;
   VideoInterface* video = nullptr;
 
-  if(false && !opengl_) // YUV widget not working yet
+  // the shaders are checked only once
+  if (opengl == 1 && !yuvChecked_)
+  {
+    yuvChecked_ = true;
+    yuvSupported_ = VideoYUVWidget::supported();
+
+    printDebug(DEBUG_NORMAL, "VideoviewFactory", "Checked YUV drawing support",
+               {"Supported"}, {yuvSupported_ ? "Yes" : "No"});
+  }
+
+  // YUV is drawn as it is, the others need a conversion to RGB32 first
+  if(opengl == 1 && yuvSupported_)
   {
     VideoYUVWidget* yuv = new VideoYUVWidget(parent, sessionID);
     vw = yuv;
@@ -41,8 +53,6 @@ uint32_t VideoviewFactory::createWidget(uint32_t sessionID, QWidget* parent,
     // signals reattaching after fullscreen mode
     QObject::connect(yuv, &VideoYUVWidget::reattach, conf, &ConferenceView::reattachWidget);
     QObject::connect(yuv, &VideoYUVWidget::detach, conf, &ConferenceView::detachWidget);
-
-    opengl_ = true;
   }
   else if(opengl == 1)
   {
@@ -42,5 +42,7 @@ private:
   std::map<uint32_t, std::shared_ptr<std::vector<QWidget*>>> sessionIDtoWidgetlist_;
   std::map<uint32_t, std::shared_ptr<std::vector<VideoInterface*>>> sessionIDtoVideolist_;
 
-  bool opengl_;
+  // whether OpenGL can draw YUV on this system
+  bool yuvChecked_;
+  bool yuvSupported_;
 };
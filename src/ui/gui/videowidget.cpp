@@ -30,7 +30,7 @@ VideoWidget::VideoWidget(QWidget* parent, uint32_t sessionID, uint32_t index, ui
 VideoWidget::~VideoWidget()
 {}
 
-void VideoWidget::inputImage(std::unique_ptr<uchar[]> data, QImage &image,
+void VideoWidget::inputImage(FrameBuffer data, QImage &image,
                              int64_t timestamp)
 {
   drawMutex_.lock();
@@ -26,10 +26,11 @@ public:
   virtual void setStats(StatisticsInterface* stats)
   {
     stats_ = stats;
+    helper_.setStats(stats);
   }
 
-  // Takes ownership of the image data
-  virtual void inputImage(std::unique_ptr<uchar[]> data, QImage &image, int64_t timestamp);
+  // Holds a reference to the image data until the image has been drawn
+  virtual void inputImage(FrameBuffer data, QImage &image, int64_t timestamp);
 
   virtual VideoFormat supportedFormat()
   {
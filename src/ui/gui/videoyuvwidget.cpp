@@ -2,12 +2,41 @@
 
 #include "statisticsinterface.h"
 
-#include <QPaintEvent>
-#include <QDebug>
-#include <QCoreApplication>
-#include <QEvent>
+#include "common.h"
+
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
 #include <QKeyEvent>
-#include <QLayout>
+
+static const char *vertexShaderSource =
+    "attribute vec2 position;\n"
+    "attribute vec2 texCoord;\n"
+    "varying vec2 coord;\n"
+    "void main() {\n"
+    "   coord = texCoord;\n"
+    "   gl_Position = vec4(position, 0.0, 1.0);\n"
+    "}\n";
+
+// BT.601
+static const char *fragmentShaderSource =
+    "#ifdef GL_ES\n"
+    "precision mediump float;\n"
+    "#endif\n"
+    "uniform sampler2D yPlane;\n"
+    "uniform sampler2D uPlane;\n"
+    "uniform sampler2D vPlane;\n"
+    "varying vec2 coord;\n"
+    "void main() {\n"
+    "   float y = texture2D(yPlane, coord).r;\n"
+    "   float u = texture2D(uPlane, coord).r - 0.5;\n"
+    "   float v = texture2D(vPlane, coord).r - 0.5;\n"
+    "   gl_FragColor = vec4(y + 1.402*v, y - 0.344*u - 0.714*v, y + 1.772*u, 1.0);\n"
+    "}\n";
+
+// the whole viewport, the first row of the picture is at the top
+static const GLfloat vertices[] = {-1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f};
+static const GLfloat texCoords[] = {0.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f};
+
 
 VideoYUVWidget::VideoYUVWidget(QWidget* parent, uint32_t sessionID,
                                uint32_t index, uint8_t borderSize)
@@ -15,9 +44,9 @@ VideoYUVWidget::VideoYUVWidget(QWidget* parent, uint32_t sessionID,
   stats_(nullptr),
   sessionID_(sessionID),
   helper_(sessionID, index, borderSize),
-  texture_(0),
-  prog_(nullptr)
-
+  prog_(nullptr),
+  textures_{0, 0, 0},
+  textureSize_()
 {
   helper_.initWidget(this);
 
@@ -27,287 +56,178 @@ VideoYUVWidget::VideoYUVWidget(QWidget* parent, uint32_t sessionID,
   QObject::connect(&helper_, &VideoDrawHelper::reattach, this, &VideoYUVWidget::reattach);
 }
 
+
 VideoYUVWidget::~VideoYUVWidget()
-{}
+{
+  makeCurrent();
+  if (textures_[0] != 0)
+  {
+    glDeleteTextures(3, textures_);
+  }
+  prog_.reset();
+  doneCurrent();
+}
+
+
+bool VideoYUVWidget::supported()
+{
+  QOffscreenSurface surface;
+  surface.create();
+
+  QOpenGLContext context;
+  if (!context.create() || !context.makeCurrent(&surface))
+  {
+    return false;
+  }
 
-void VideoYUVWidget::inputImage(std::unique_ptr<uchar[]> data, QImage &image, int64_t timestamp)
+  bool shaders = QOpenGLShaderProgram::hasOpenGLShaderPrograms(&context);
+  context.doneCurrent();
+  return shaders;
+}
+
+
+void VideoYUVWidget::inputImage(FrameBuffer data, QImage &image, int64_t timestamp)
 {
   Q_ASSERT(data != nullptr);
   drawMutex_.lock();
-  // if the resolution has changed in video
 
   helper_.inputImage(this, std::move(data), image, timestamp);
 
-  //update();
-
   emit newImage();
   drawMutex_.unlock();
 }
 
-/*
-static const char *fragmentShaderSource =
-    "uniform sampler2D s_texture;\n"
-    "void main() {\n"
-        "float y = texture2D(s_texture, gl_FragCoord.xy).r;\n"
-        "float u = texture2D(s_texture, gl_FragCoord.xy).r - 0.5;\n"
-        "float v = texture2D(s_texture, gl_FragCoord.xy).r - 0.5;\n"
-        "float r = y +             1.402 * v;\n"
-        "float g = y - 0.344 * u - 0.714 * v;\n"
-        "float b = y + 1.772 * u;\n"
-       // "gl_FragColor = vec4(r,g,b,1.0);\n"
-        "gl_FragColor = vec4(1.0,0.0,0.0,1.0);\n"
-    "}\n";
-*/
-
-/*
-static const char *vertexShaderSource =
-    "attribute vec4 vertex;\n"
-    "void main() {\n"
-    "   gl_Position = vertex;\n"
-    "}\n";
-*/
-
-static const char *vertexShaderSource2 =
-    "attribute vec4 posAttr;\n"
-    "attribute lowp vec4 colAttr;\n"
-    "varying lowp vec4 col;\n"
-    "uniform mat4 matrix;\n"
-    "void main() {\n"
-    "   col = colAttr;\n"
-    "   gl_Position = matrix * posAttr;\n"
-    "}\n";
-
-static const char *fragmentShaderSource2 =
-    "varying lowp vec4 col;\n"
-    "void main() {\n"
-    "   gl_FragColor = col;\n"
-    "}\n";
-
 
 void VideoYUVWidget::initializeGL()
 {
   initializeOpenGLFunctions();
 
-  if(prog_ == nullptr)
+  prog_ = std::unique_ptr<QOpenGLShaderProgram>(new QOpenGLShaderProgram());
+  if (!prog_->addShaderFromSourceCode(QOpenGLShader::Vertex, vertexShaderSource) ||
+      !prog_->addShaderFromSourceCode(QOpenGLShader::Fragment, fragmentShaderSource) ||
+      !prog_->link())
   {
-    //makeCurrent();
-    qDebug() << "Initializing OpenGLProgram:" << glGetError();
-    prog_ = new QOpenGLShaderProgram();
-    prog_->addShaderFromSourceCode(QOpenGLShader::Vertex, vertexShaderSource2);
-    prog_->addShaderFromSourceCode(QOpenGLShader::Fragment, fragmentShaderSource2);
-    prog_->link();
-     qDebug() << "Opengl initialization linking:" << glGetError() << prog_->log();
-    m_posAttr = prog_->attributeLocation("posAttr");
-    qDebug() << "Opengl initialization:" << glGetError();
-    m_colAttr = prog_->attributeLocation("colAttr");
-    qDebug() << "Opengl initialization:" << glGetError();
-    m_matrixUniform = prog_->uniformLocation("matrix");
-    qDebug() << "Opengl initialization:" << glGetError();
-
-    m_frame = 0;
-    //doneCurrent();
-    qDebug() << "Opengl initialization:" << glGetError();
+    printDebug(DEBUG_PROGRAM_ERROR, this, "Failed to build YUV shaders.",
+               {"Log"}, {prog_->log()});
+    prog_.reset();
+    return;
   }
 
-  /*
-  qDebug() << "=== Initializing YUV OpenGL drawing widget for sessionID:" << sessionID_;
-
-
-  qDebug() << "Opengl:" << glGetError();
+  prog_->bind();
+  prog_->setUniformValue("yPlane", 0);
+  prog_->setUniformValue("uPlane", 1);
+  prog_->setUniformValue("vPlane", 2);
+  prog_->release();
 
-  if(!prog_.isLinked())
+  glGenTextures(3, textures_);
+  for (unsigned int i = 0; i < 3; ++i)
   {
-    //static const GLfloat texCoords[] = { 0.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f };
-    static const GLfloat vertices[]= {1.0f, 1.0f, -1.0f, 1.0f, 1.0f, -1.0f,  -1.0f, -1.0f };
-
-    vbo_.create();
-    vbo_.bind();
-    vbo_.allocate(vertices, 8*sizeof(GLfloat));
-
-    prog_.addShaderFromSourceCode(QOpenGLShader::Vertex, vertexShaderSource);
-    qDebug() << "Opengl:" << glGetError();
-
-    prog_.addShaderFromSourceCode(QOpenGLShader::Fragment, fragmentShaderSource);
-    qDebug() << "Opengl source:" << glGetError();
-
-    prog_.bindAttributeLocation("vertex", 0);
-    qDebug() << "Opengl attribute:" << glGetError();
-
-    prog_.link();
-    qDebug() << "Opengl Link:" << glGetError();
+    glBindTexture(GL_TEXTURE_2D, textures_[i]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
   }
+  textureSize_ = QSize();
+}
 
-  if(texture_ == 0)
-  {
-    prog_.bind();
-    qDebug() << "Opengl bind:" << glGetError();
-
-    glEnable(GL_TEXTURE_2D);
-    qDebug() << "Opengl:" << glGetError();
-
-    glGenTextures(1, &texture_);
-    qDebug() << "Opengl:" << glGetError();
-
-    glBindTexture(GL_TEXTURE_2D, texture_);
-    qDebug() << "Opengl:" << glGetError();
-
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    qDebug() << "Opengl:" << glGetError();
 
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    qDebug() << "Opengl:" << glGetError();
+void VideoYUVWidget::uploadPlanes(const QImage& frame)
+{
+  const uchar* planes[3];
+  planes[0] = frame.constBits();
+  planes[1] = planes[0] + frame.width()*frame.height();
+  planes[2] = planes[1] + frame.width()*frame.height()/4;
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, 1600, 1344, 0,
-                 GL_BGRA, GL_UNSIGNED_BYTE, nullptr);
+  bool resized = textureSize_ != frame.size();
+  textureSize_ = frame.size();
 
-    //glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, lastImage_.size().width(), lastImage_.size().height(), 0,
-    //              GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+  // the rows of chroma planes are not aligned to 4 bytes
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
-    //prog_.bindAttributeLocation("vertex", 0);
-    int loc = prog_.uniformLocation("s_texture");
-    prog_.setUniformValue(loc, texture_);
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    int width = i == 0 ? frame.width() : frame.width()/2;
+    int height = i == 0 ? frame.height() : frame.height()/2;
 
-    prog_.release();
+    glBindTexture(GL_TEXTURE_2D, textures_[i]);
+    if (resized)
+    {
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, width, height, 0,
+                   GL_LUMINANCE, GL_UNSIGNED_BYTE, planes[i]);
+    }
+    else
+    {
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height,
+                      GL_LUMINANCE, GL_UNSIGNED_BYTE, planes[i]);
+    }
   }
+}
 
-  //glOrtho(-1.0, 1.0, -1.0, 1.0, 0.1, 50);
 
-  qDebug() << "Opengl Initialization:" << glGetError() << ":" << prog_.log();
-  qDebug() << "Image size:" << lastImage_.size();
-  */
-}
-void VideoYUVWidget::drawOpenGL(bool updateImage)
+void VideoYUVWidget::paintGL()
 {
-  Q_UNUSED(updateImage);
-  /*
-  qDebug() << "Drawing with OpenGL --------------------------------------------------";
+  glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
   glClear(GL_COLOR_BUFFER_BIT);
-  glBindTexture(GL_TEXTURE_2D, texture_);
 
-  if(updateImage)
+  if(!helper_.readyToDraw() || prog_ == nullptr)
   {
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 400, 1344,
-                   GL_BGRA,  GL_UNSIGNED_BYTE, dataBuffer_.back().get());
+    return;
   }
-  prog_.bind();
-*/
-  //glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, lastImage_.size().width(), lastImage_.size().height(),
-  //                 GL_RGB, GL_UNSIGNED_BYTE, dataBuffer_.back().get());
-
-  //prog_.enableAttributeArray(0);
-  //prog_.setAttributeBuffer(0, GL_FLOAT, 0, 2, 2*sizeof(GLfloat));
 
-  //glBindBuffer();
-  //glEnableVertexAttribArray();
-  //glVertexAttribPointer();
-  //glDrawArrays(GL_TRIANGLES, 0, 3);
+  drawMutex_.lock();
 
-  qDebug() << "Drawing with OpenGL shaders";
+  QImage frame;
+  if(helper_.getRecentImage(frame))
+  {
+    // sessionID 0 is the self display and we are not interested
+    // update stats only for each new image.
+    if(stats_ && sessionID_ != 0)
+    {
+      stats_->presentPackage(sessionID_, "Video");
+    }
 
-  if(prog_ == nullptr)
+    uploadPlanes(frame);
+  }
+  else if (textureSize_ != frame.size())
   {
-    initializeGL();
+    // the textures have been lost with the context
+    uploadPlanes(frame);
   }
 
- // makeCurrent();
-
-  const qreal retinaScale = devicePixelRatio();
-  glViewport(0, 0, width() * retinaScale, height() * retinaScale);
-  qDebug() << "Opengl:" << glGetError();
+  drawMutex_.unlock();
 
-  glClear(GL_COLOR_BUFFER_BIT);
-  qDebug() << "Opengl:" << glGetError();
+  // OpenGL counts rows from the bottom
+  const qreal scale = devicePixelRatio();
+  QRect target = helper_.getTargetRect();
+  glViewport(target.x()*scale, (height() - target.bottom() - 1)*scale,
+             target.width()*scale, target.height()*scale);
 
   prog_->bind();
-  qDebug() << "Opengl bind:" << glGetError();
-
-  QMatrix4x4 matrix;
-  matrix.perspective(60.0f, 4.0f/3.0f, 0.1f, 100.0f);
-  matrix.translate(0, 0, -2);
-  matrix.rotate(100.0f * m_frame / 30, 0, 1, 0);
-
-  prog_->setUniformValue(m_matrixUniform, matrix);
-  qDebug() << "Opengl:" << glGetError() << prog_->log();
-
-  GLfloat vertices[] = {
-      0.0f, 0.707f,
-      -0.5f, -0.5f,
-      0.5f, -0.5f
-  };
-
-  GLfloat colors[] = {
-      1.0f, 0.0f, 0.0f,
-      0.0f, 1.0f, 0.0f,
-      0.0f, 0.0f, 1.0f
-  };
-
-  glVertexAttribPointer(m_posAttr, 2, GL_FLOAT, GL_FALSE, 0, vertices);
-  qDebug() << "Opengl:" << glGetError();
-  glVertexAttribPointer(m_colAttr, 3, GL_FLOAT, GL_FALSE, 0, colors);
-  qDebug() << "Opengl:" << glGetError();
-
-  glEnableVertexAttribArray(0);
-  qDebug() << "Opengl:" << glGetError();
-  glEnableVertexAttribArray(1);
-  qDebug() << "Opengl:" << glGetError();
-
-  glDrawArrays(GL_TRIANGLES, 0, 3);
-  qDebug() << "Opengl draw:" << glGetError();
-
-  glDisableVertexAttribArray(1);
-  qDebug() << "Opengl:" << glGetError();
-  glDisableVertexAttribArray(0);
-  qDebug() << "Opengl:" << glGetError();
-
-  prog_->release();
-
-  ++m_frame;
-
-  //doneCurrent();
-  qDebug() << "Opengl done:" << glGetError();
-}
+  prog_->enableAttributeArray("position");
+  prog_->enableAttributeArray("texCoord");
+  prog_->setAttributeArray("position", vertices, 2);
+  prog_->setAttributeArray("texCoord", texCoords, 2);
 
-void VideoYUVWidget::paintGL()
-{
-  //qDebug() << "PaintEvent for widget:" << sessionID_;
-  QPainter painter(this);
-
-  if(helper_.readyToDraw())
+  for (unsigned int i = 0; i < 3; ++i)
   {
-    drawMutex_.lock();
-
-    QImage frame;
-    if(helper_.getRecentImage(frame))
-    {
-      // sessionID 0 is the self display and we are not interested
-      // update stats only for each new image.
-      if(stats_ && sessionID_ != 0)
-      {
-        stats_->presentPackage(sessionID_, "Video");
-      }
-    }
-
-    drawOpenGL(true);
-    drawMutex_.unlock();
+    glActiveTexture(GL_TEXTURE0 + i);
+    glBindTexture(GL_TEXTURE_2D, textures_[i]);
   }
-  else
-  {
-    drawOpenGL(false);
-  }
-}
 
-void VideoYUVWidget::resizeGL(int width, int height)
-{
-  Q_UNUSED(width);
-  Q_UNUSED(height);
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
-  //int side = qMin(width, height);
-  //glViewport((width - side) / 2, (height - side) / 2, side, side);
+  prog_->disableAttributeArray("position");
+  prog_->disableAttributeArray("texCoord");
+  prog_->release();
+  glActiveTexture(GL_TEXTURE0);
 }
 
+
 void VideoYUVWidget::resizeEvent(QResizeEvent *event)
 {
   QOpenGLWidget::resizeEvent(event); // its important to call this resize function, not the qwidget one.
+  helper_.updateTargetRect(this);
 }
 
 
@@ -3,17 +3,15 @@
 #include "videointerface.h"
 #include "videodrawhelper.h"
 
-#include <QOpenGLFunctions_2_0>
+#include <QOpenGLFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLWidget>
 
-#include <QPainter>
 #include <QRect>
 #include <QSize>
 #include <QImage>
 #include <QMutex>
 
-#include <QtOpenGL>
-
-#include <deque>
 #include <memory>
 
 
@@ -21,7 +19,8 @@
 
 class StatisticsInterface;
 
-// The normal QOpenGLFunctions provides access to ES API so the whole API is used instead
+// Draws YUV420 frames as they are. The colour conversion is done by a shader
+// when the frame is drawn, so only the frames actually shown are converted.
 
 class VideoYUVWidget : public QOpenGLWidget, public VideoInterface, protected QOpenGLFunctions
 {
@@ -35,19 +34,21 @@ public:
   void setStats(StatisticsInterface* stats)
   {
     stats_ = stats;
+    helper_.setStats(stats);
   }
 
-  // Takes ownership of the image data
-  void inputImage(std::unique_ptr<uchar[]> data, QImage &image, int64_t timestamp);
-
-  static unsigned int number_;
+  // Holds a reference to the image data until the image has been drawn.
+  // The image is the luma plane, the chroma planes follow it in data.
+  void inputImage(FrameBuffer data, QImage &image, int64_t timestamp);
 
   virtual VideoFormat supportedFormat()
   {
-    //return VIDEO_RGB32;
     return VIDEO_YUV420;
   }
 
+  // whether this system can draw with our shaders
+  static bool supported();
+
 signals:
 
   // for reattaching after fullscreenmode
@@ -65,17 +66,11 @@ protected:
 
   virtual void initializeGL();
   virtual void paintGL();
-  virtual void resizeGL(int width, int height);
 
 private:
 
-  // update the rect in case the window or input has changed.
-  void updateTargetRect();
-
-  void enterFullscreen();
-  void exitFullscreen();
-
-  void drawOpenGL(bool updateImage);
+  // copies the planes of frame to textures
+  void uploadPlanes(const QImage& frame);
 
   QMutex drawMutex_;
 
@@ -84,14 +79,10 @@ private:
 
   VideoDrawHelper helper_;
 
-  GLuint texture_;
-
-  QOpenGLShaderProgram* prog_;
+  std::unique_ptr<QOpenGLShaderProgram> prog_;
 
-  QOpenGLBuffer vbo_;
+  // Y, U and V
+  GLuint textures_[3];
 
-  GLuint m_posAttr;
-  GLuint m_colAttr;
-  GLuint m_matrixUniform;
-  int m_frame;
+  QSize textureSize_;
 };
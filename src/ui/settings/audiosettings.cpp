@@ -47,6 +47,9 @@ AudioSettings::AudioSettings(QWidget* parent,
 
   connect(audioSettingsUI_->signal_combo, &QComboBox::currentTextChanged,
           this, &AudioSettings::showOkButton);
+
+  connect(audioSettingsUI_->frame_combo, &QComboBox::currentTextChanged,
+          this, &AudioSettings::showOkButton);
 }
 
 
@@ -125,6 +128,8 @@ void AudioSettings::restoreSettings()
     QString type = settings_.value("audio/signalType").toString();
     audioSettingsUI_->signal_combo->setCurrentText(type);
 
+    audioSettingsUI_->frame_combo->setCurrentText(settings_.value("audio/frameDuration").toString());
+
     for (auto& box : boxes_)
     {
       restoreCheckBox(box.first, box.second, settings_);
@@ -158,6 +163,9 @@ void AudioSettings::saveSettings()
 
   saveTextValue("audio/signalType",
                 audioSettingsUI_->signal_combo->currentText(), settings_);
+
+  saveTextValue("audio/frameDuration",
+                audioSettingsUI_->frame_combo->currentText(), settings_);
 }
 
 bool AudioSettings::checkSettings()
@@ -183,7 +191,8 @@ bool AudioSettings::checkSettings()
   }
 
   if(// !settings_.contains("audio/channels") ||
-     !settings_.contains("audio/signalType"))
+     !settings_.contains("audio/signalType") ||
+     !settings_.contains("audio/frameDuration"))
   {
     printError(this, "Missing an audio settings value.");
     everythingOK = false;